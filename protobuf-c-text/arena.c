@@ -0,0 +1,194 @@
+/** \file
+ * Arena allocator for text format protobufs.
+ *
+ * This file contains a bump allocator which hands out memory from large
+ * blocks and frees it all in one go.  It is exposed as a
+ * \c ProtobufCAllocator so it can be passed to any of the exported
+ * functions.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <protobuf-c/protobuf-c.h>
+#include "protobuf-c-text.h"
+#include "protobuf-c-util.h"
+#include "config.h"
+
+/** \defgroup arena Arena allocator
+ * \ingroup internal
+ * @{
+ */
+
+/** Default size of an arena block. */
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+/** Alignment of everything handed out by the arena. */
+#define ARENA_ALIGN sizeof(union { long double ld; void *p; uint64_t u; })
+
+/** Round \c n up to a multiple of \c ARENA_ALIGN. */
+#define ARENA_ROUND(n) (((n) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+/** A block of memory in the arena.
+ *
+ * The memory handed out follows the header.
+ */
+typedef struct _ArenaBlock {
+  struct _ArenaBlock *next;  /**< The next (older) block. */
+  size_t size;               /**< Bytes available after the header. */
+  size_t used;               /**< Bytes handed out so far. */
+} ArenaBlock;
+
+/** Size of the \c ArenaBlock header, padded to keep data aligned. */
+#define ARENA_HEADER ARENA_ROUND(sizeof(ArenaBlock))
+
+/** Return the start of the data in an \c ArenaBlock. */
+#define ARENA_DATA(block) ((uint8_t *)(block) + ARENA_HEADER)
+
+/** The arena.
+ *
+ * The \c ProtobufCAllocator in \c base has this struct as its
+ * \c allocator_data.
+ */
+struct _ProtobufCTextArena {
+  ProtobufCAllocator base;       /**< What gets passed to the API. */
+  ProtobufCAllocator *allocator; /**< Where the blocks come from. */
+  size_t block_size;             /**< Size of a normal block. */
+  ArenaBlock *blocks;            /**< Block being bumped first. */
+  void *last;                    /**< Most recent allocation. */
+};
+
+/** Allocate a new block.
+ *
+ * \param[in] size Bytes needed after the header.
+ * \param[in] allocator Allocator functions.
+ * \return The new block or \c NULL on allocation failure.
+ */
+static ArenaBlock *
+arena_block_new(size_t size, ProtobufCAllocator *allocator)
+{
+  ArenaBlock *block;
+
+  block = PBC_ALLOC(ARENA_HEADER + size);
+  if (!block) {
+    return NULL;
+  }
+  block->size = size;
+  block->used = 0;
+  return block;
+}
+
+/** \c ProtobufCAllocator \c alloc function for the arena.
+ *
+ * Bumps a pointer in the current block.  Requests bigger than a quarter
+ * of a block get a block of their own so they don't waste the rest of
+ * the current one.
+ *
+ * \param[in] allocator_data The \c ProtobufCTextArena.
+ * \param[in] size Bytes wanted.
+ * \return The memory or \c NULL on allocation failure.
+ */
+static void *
+arena_alloc(void *allocator_data, size_t size)
+{
+  ProtobufCTextArena *arena = allocator_data;
+  ProtobufCAllocator *allocator = arena->allocator;
+  ArenaBlock *block = arena->blocks;
+  void *p;
+
+  size = ARENA_ROUND(size? size: 1);
+  if (!block || block->size - block->used < size) {
+    if (size > arena->block_size / 4) {
+      block = arena_block_new(size, allocator);
+      if (!block) {
+        return NULL;
+      }
+      block->used = size;
+      if (arena->blocks) {
+        block->next = arena->blocks->next;
+        arena->blocks->next = block;
+      } else {
+        block->next = NULL;
+        arena->blocks = block;
+      }
+      return ARENA_DATA(block);
+    }
+    block = arena_block_new(arena->block_size, allocator);
+    if (!block) {
+      return NULL;
+    }
+    block->next = arena->blocks;
+    arena->blocks = block;
+  }
+
+  p = ARENA_DATA(block) + block->used;
+  block->used += size;
+  arena->last = p;
+  return p;
+}
+
+/** \c ProtobufCAllocator \c free function for the arena.
+ *
+ * Memory goes back when the arena is freed.  The one exception is the
+ * most recent allocation, which is cheap to take back so short lived
+ * scratch buffers don't pile up.
+ *
+ * \param[in] allocator_data The \c ProtobufCTextArena.
+ * \param[in] data The memory to free.
+ */
+static void
+arena_free(void *allocator_data, void *data)
+{
+  ProtobufCTextArena *arena = allocator_data;
+
+  if (data && data == arena->last) {
+    arena->blocks->used = (uint8_t *)data - ARENA_DATA(arena->blocks);
+    arena->last = NULL;
+  }
+}
+
+/** @} */  /* End of arena group. */
+
+/* See .h file for API docs. */
+
+ProtobufCTextArena *
+protobuf_c_text_arena_new(size_t block_size, ProtobufCAllocator *allocator)
+{
+  ProtobufCTextArena *arena;
+
+  arena = PBC_ALLOC(sizeof(ProtobufCTextArena));
+  if (!arena) {
+    return NULL;
+  }
+  arena->base.alloc = arena_alloc;
+  arena->base.free = arena_free;
+  arena->base.allocator_data = arena;
+  arena->allocator = allocator;
+  arena->block_size = ARENA_ROUND(block_size? block_size: ARENA_BLOCK_SIZE);
+  arena->blocks = NULL;
+  arena->last = NULL;
+  return arena;
+}
+
+ProtobufCAllocator *
+protobuf_c_text_arena_allocator(ProtobufCTextArena *arena)
+{
+  return &arena->base;
+}
+
+void
+protobuf_c_text_arena_free(ProtobufCTextArena *arena)
+{
+  ProtobufCAllocator *allocator;
+  ArenaBlock *block, *next;
+
+  if (!arena) {
+    return;
+  }
+  allocator = arena->allocator;
+  for (block = arena->blocks; block; block = next) {
+    next = block->next;
+    PBC_FREE(block);
+  }
+  PBC_FREE(arena);
+}
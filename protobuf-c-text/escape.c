@@ -0,0 +1,207 @@
+/** \file
+ * String escaping for text format protobufs.
+ *
+ * This file contains the escaping of \c string and \c bytes field
+ * values.  Most of a typical value needs no escaping, so the work is in
+ * finding the runs of bytes that can be copied as they are.  That is
+ * done 32 or 16 bytes at a time with AVX2 or SSE2 when the compiler
+ * targets them and 8 bytes at a time otherwise.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include <protobuf-c/protobuf-c.h>
+#include "protobuf-c-text.h"
+#include "config.h"
+
+/** \defgroup escape String escaping
+ * \ingroup internal
+ * @{
+ */
+
+/** Chars a byte takes up once escaped.
+ *
+ * Printable ASCII is copied, quotes, backslashes, \c \\n, \c \\r and
+ * \c \\t get a backslash and anything else becomes a 3 digit octal
+ * escape.
+ *
+ * \param[in] c The byte.
+ * \return 1, 2 or 4.
+ */
+static inline int
+esc_width(unsigned char c)
+{
+  switch (c) {
+    case '\'':
+    case '"':
+    case '\\':
+    case '\n':
+    case '\r':
+    case '\t':
+      return 2;
+    default:
+      return c < 0x20 || c >= 0x7f? 4: 1;
+  }
+}
+
+/** Repeat a byte across a \c uint64_t. */
+#define ESC_BYTES(c) (UINT64_C(0x0101010101010101) * (c))
+
+/** Non-zero if any byte of \c x is zero. */
+#define ESC_HAS_ZERO(x) \
+  (((x) - ESC_BYTES(1)) & ~(x) & ESC_BYTES(0x80))
+
+/** Non-zero if any byte of \c x is less than \c n (\c n <= 128). */
+#define ESC_HAS_LESS(x, n) \
+  (((x) - ESC_BYTES(n)) & ~(x) & ESC_BYTES(0x80))
+
+/** Count the leading bytes of \c src that need no escaping.
+ *
+ * \param[in] src The bytes to look at.
+ * \param[in] len Length of \c src.
+ * \return The number of bytes before the first one that needs escaping,
+ *         or \c len if none do.
+ */
+static size_t
+esc_span(const unsigned char *src, size_t len)
+{
+  size_t i = 0;
+  uint64_t w;
+
+#if defined(__AVX2__)
+  {
+    const __m256i low = _mm256_set1_epi8(0x1f);
+    const __m256i del = _mm256_set1_epi8(0x7f);
+    const __m256i dq = _mm256_set1_epi8('"');
+    const __m256i sq = _mm256_set1_epi8('\'');
+    const __m256i bs = _mm256_set1_epi8('\\');
+
+    for (; i + 32 <= len; i += 32) {
+      __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+      /* Signed compares: 0x80-0xff are negative so fail the first. */
+      __m256i ok = _mm256_and_si256(_mm256_cmpgt_epi8(v, low),
+          _mm256_cmpgt_epi8(del, v));
+      __m256i special = _mm256_or_si256(_mm256_cmpeq_epi8(v, dq),
+          _mm256_or_si256(_mm256_cmpeq_epi8(v, sq),
+            _mm256_cmpeq_epi8(v, bs)));
+      uint32_t mask = ~(uint32_t)_mm256_movemask_epi8(ok)
+        | (uint32_t)_mm256_movemask_epi8(special);
+
+      if (mask) {
+        return i + __builtin_ctz(mask);
+      }
+    }
+  }
+#endif
+#if defined(__SSE2__)
+  {
+    const __m128i low = _mm_set1_epi8(0x1f);
+    const __m128i del = _mm_set1_epi8(0x7f);
+    const __m128i dq = _mm_set1_epi8('"');
+    const __m128i sq = _mm_set1_epi8('\'');
+    const __m128i bs = _mm_set1_epi8('\\');
+
+    for (; i + 16 <= len; i += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+      __m128i ok = _mm_and_si128(_mm_cmpgt_epi8(v, low),
+          _mm_cmplt_epi8(v, del));
+      __m128i special = _mm_or_si128(_mm_cmpeq_epi8(v, dq),
+          _mm_or_si128(_mm_cmpeq_epi8(v, sq), _mm_cmpeq_epi8(v, bs)));
+      uint32_t mask = (~_mm_movemask_epi8(ok) & 0xffff)
+        | _mm_movemask_epi8(special);
+
+      if (mask) {
+        return i + __builtin_ctz(mask);
+      }
+    }
+  }
+#endif
+  /* Eight at a time while no byte in the word needs escaping. */
+  for (; i + 8 <= len; i += 8) {
+    memcpy(&w, src + i, 8);
+    if ((w & ESC_BYTES(0x80))
+        || ESC_HAS_LESS(w, 0x20)
+        || ESC_HAS_ZERO(w ^ ESC_BYTES(0x7f))
+        || ESC_HAS_ZERO(w ^ ESC_BYTES('"'))
+        || ESC_HAS_ZERO(w ^ ESC_BYTES('\''))
+        || ESC_HAS_ZERO(w ^ ESC_BYTES('\\'))) {
+      break;
+    }
+  }
+  for (; i < len; i++) {
+    if (esc_width(src[i]) != 1) {
+      break;
+    }
+  }
+  return i;
+}
+
+/** @} */  /* End of escape group. */
+
+/* See .h file for API docs. */
+
+size_t
+protobuf_c_text_escaped_size(const void *src, size_t len)
+{
+  const unsigned char *s = src;
+  size_t n, size = 0;
+
+  while (len) {
+    n = esc_span(s, len);
+    size += n;
+    s += n;
+    len -= n;
+    if (len) {
+      size += esc_width(*s++);
+      len--;
+    }
+  }
+  return size;
+}
+
+size_t
+protobuf_c_text_escape(const void *src, size_t len, char *dst)
+{
+  const unsigned char *s = src;
+  char *d = dst;
+  size_t n;
+
+  while (len) {
+    n = esc_span(s, len);
+    memcpy(d, s, n);
+    d += n;
+    s += n;
+    len -= n;
+    if (!len) {
+      break;
+    }
+    *d++ = '\\';
+    switch (*s) {
+      case '\n':
+        *d++ = 'n';
+        break;
+      case '\r':
+        *d++ = 'r';
+        break;
+      case '\t':
+        *d++ = 't';
+        break;
+      case '\'':
+      case '"':
+      case '\\':
+        *d++ = *s;
+        break;
+      default:
+        *d++ = '0' + (*s >> 6);
+        *d++ = '0' + ((*s >> 3) & 7);
+        *d++ = '0' + (*s & 7);
+        break;
+    }
+    s++;
+    len--;
+  }
+  return d - dst;
+}
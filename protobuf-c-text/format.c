@@ -0,0 +1,481 @@
+/** \file
+ * Number formatting for text format protobufs.
+ *
+ * This file contains the conversion of \c float and \c double values to
+ * a decimal string that reads back as the same value.  It uses Florian
+ * Loitsch's Grisu2 algorithm ("Printing Floating-Point Numbers Quickly
+ * and Accurately with Integers", PLDI 2010), which needs only 64 bit
+ * integer arithmetic and a small table of powers of ten.  The string
+ * always round-trips and is usually, but not always, the shortest that
+ * does.  It also holds the integer formatting shared with the code
+ * \c protoc-gen-c-text generates.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <protobuf-c/protobuf-c.h>
+#include "protobuf-c-text.h"
+#include "config.h"
+
+/** \defgroup format Number formatting
+ * \ingroup internal
+ * @{
+ */
+
+/** A floating point number with a 64 bit significand: \c f * 2^ \c e. */
+typedef struct _DiyFp {
+  uint64_t f;  /**< Significand. */
+  int e;       /**< Binary exponent. */
+} DiyFp;
+
+/** Layout of an IEEE 754 binary floating point type. */
+typedef struct _RealFormat {
+  int significand_bits;  /**< Bits stored in the significand. */
+  int exponent_bias;     /**< Bias of the exponent, plus \c significand_bits. */
+  int short_precision;   /**< Digits \c "%g" style output uses first. */
+  int long_precision;    /**< Digits always enough to round trip. */
+} RealFormat;
+
+/** The two digit strings \c "00" to \c "99" back to back. */
+static const char digit_pairs[201] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+/** The layout of a \c double. */
+static const RealFormat double_format = { 52, 1075, 15, 17 };
+
+/** The layout of a \c float. */
+static const RealFormat float_format = { 23, 150, 6, 9 };
+
+/** Normalised powers of ten from 1e-348 to 1e340 in steps of 8. */
+static const DiyFp cached_powers[] = {
+  { 0xfa8fd5a0081c0288ULL, -1220 },  /* 1e-348 */
+  { 0xbaaee17fa23ebf76ULL, -1193 },  /* 1e-340 */
+  { 0x8b16fb203055ac76ULL, -1166 },  /* 1e-332 */
+  { 0xcf42894a5dce35eaULL, -1140 },  /* 1e-324 */
+  { 0x9a6bb0aa55653b2dULL, -1113 },  /* 1e-316 */
+  { 0xe61acf033d1a45dfULL, -1087 },  /* 1e-308 */
+  { 0xab70fe17c79ac6caULL, -1060 },  /* 1e-300 */
+  { 0xff77b1fcbebcdc4fULL, -1034 },  /* 1e-292 */
+  { 0xbe5691ef416bd60cULL, -1007 },  /* 1e-284 */
+  { 0x8dd01fad907ffc3cULL,  -980 },  /* 1e-276 */
+  { 0xd3515c2831559a83ULL,  -954 },  /* 1e-268 */
+  { 0x9d71ac8fada6c9b5ULL,  -927 },  /* 1e-260 */
+  { 0xea9c227723ee8bcbULL,  -901 },  /* 1e-252 */
+  { 0xaecc49914078536dULL,  -874 },  /* 1e-244 */
+  { 0x823c12795db6ce57ULL,  -847 },  /* 1e-236 */
+  { 0xc21094364dfb5637ULL,  -821 },  /* 1e-228 */
+  { 0x9096ea6f3848984fULL,  -794 },  /* 1e-220 */
+  { 0xd77485cb25823ac7ULL,  -768 },  /* 1e-212 */
+  { 0xa086cfcd97bf97f4ULL,  -741 },  /* 1e-204 */
+  { 0xef340a98172aace5ULL,  -715 },  /* 1e-196 */
+  { 0xb23867fb2a35b28eULL,  -688 },  /* 1e-188 */
+  { 0x84c8d4dfd2c63f3bULL,  -661 },  /* 1e-180 */
+  { 0xc5dd44271ad3cdbaULL,  -635 },  /* 1e-172 */
+  { 0x936b9fcebb25c996ULL,  -608 },  /* 1e-164 */
+  { 0xdbac6c247d62a584ULL,  -582 },  /* 1e-156 */
+  { 0xa3ab66580d5fdaf6ULL,  -555 },  /* 1e-148 */
+  { 0xf3e2f893dec3f126ULL,  -529 },  /* 1e-140 */
+  { 0xb5b5ada8aaff80b8ULL,  -502 },  /* 1e-132 */
+  { 0x87625f056c7c4a8bULL,  -475 },  /* 1e-124 */
+  { 0xc9bcff6034c13053ULL,  -449 },  /* 1e-116 */
+  { 0x964e858c91ba2655ULL,  -422 },  /* 1e-108 */
+  { 0xdff9772470297ebdULL,  -396 },  /* 1e-100 */
+  { 0xa6dfbd9fb8e5b88fULL,  -369 },  /* 1e-92 */
+  { 0xf8a95fcf88747d94ULL,  -343 },  /* 1e-84 */
+  { 0xb94470938fa89bcfULL,  -316 },  /* 1e-76 */
+  { 0x8a08f0f8bf0f156bULL,  -289 },  /* 1e-68 */
+  { 0xcdb02555653131b6ULL,  -263 },  /* 1e-60 */
+  { 0x993fe2c6d07b7facULL,  -236 },  /* 1e-52 */
+  { 0xe45c10c42a2b3b06ULL,  -210 },  /* 1e-44 */
+  { 0xaa242499697392d3ULL,  -183 },  /* 1e-36 */
+  { 0xfd87b5f28300ca0eULL,  -157 },  /* 1e-28 */
+  { 0xbce5086492111aebULL,  -130 },  /* 1e-20 */
+  { 0x8cbccc096f5088ccULL,  -103 },  /* 1e-12 */
+  { 0xd1b71758e219652cULL,   -77 },  /* 1e-4 */
+  { 0x9c40000000000000ULL,   -50 },  /* 1e4 */
+  { 0xe8d4a51000000000ULL,   -24 },  /* 1e12 */
+  { 0xad78ebc5ac620000ULL,     3 },  /* 1e20 */
+  { 0x813f3978f8940984ULL,    30 },  /* 1e28 */
+  { 0xc097ce7bc90715b3ULL,    56 },  /* 1e36 */
+  { 0x8f7e32ce7bea5c70ULL,    83 },  /* 1e44 */
+  { 0xd5d238a4abe98068ULL,   109 },  /* 1e52 */
+  { 0x9f4f2726179a2245ULL,   136 },  /* 1e60 */
+  { 0xed63a231d4c4fb27ULL,   162 },  /* 1e68 */
+  { 0xb0de65388cc8ada8ULL,   189 },  /* 1e76 */
+  { 0x83c7088e1aab65dbULL,   216 },  /* 1e84 */
+  { 0xc45d1df942711d9aULL,   242 },  /* 1e92 */
+  { 0x924d692ca61be758ULL,   269 },  /* 1e100 */
+  { 0xda01ee641a708deaULL,   295 },  /* 1e108 */
+  { 0xa26da3999aef774aULL,   322 },  /* 1e116 */
+  { 0xf209787bb47d6b85ULL,   348 },  /* 1e124 */
+  { 0xb454e4a179dd1877ULL,   375 },  /* 1e132 */
+  { 0x865b86925b9bc5c2ULL,   402 },  /* 1e140 */
+  { 0xc83553c5c8965d3dULL,   428 },  /* 1e148 */
+  { 0x952ab45cfa97a0b3ULL,   455 },  /* 1e156 */
+  { 0xde469fbd99a05fe3ULL,   481 },  /* 1e164 */
+  { 0xa59bc234db398c25ULL,   508 },  /* 1e172 */
+  { 0xf6c69a72a3989f5cULL,   534 },  /* 1e180 */
+  { 0xb7dcbf5354e9beceULL,   561 },  /* 1e188 */
+  { 0x88fcf317f22241e2ULL,   588 },  /* 1e196 */
+  { 0xcc20ce9bd35c78a5ULL,   614 },  /* 1e204 */
+  { 0x98165af37b2153dfULL,   641 },  /* 1e212 */
+  { 0xe2a0b5dc971f303aULL,   667 },  /* 1e220 */
+  { 0xa8d9d1535ce3b396ULL,   694 },  /* 1e228 */
+  { 0xfb9b7cd9a4a7443cULL,   720 },  /* 1e236 */
+  { 0xbb764c4ca7a44410ULL,   747 },  /* 1e244 */
+  { 0x8bab8eefb6409c1aULL,   774 },  /* 1e252 */
+  { 0xd01fef10a657842cULL,   800 },  /* 1e260 */
+  { 0x9b10a4e5e9913129ULL,   827 },  /* 1e268 */
+  { 0xe7109bfba19c0c9dULL,   853 },  /* 1e276 */
+  { 0xac2820d9623bf429ULL,   880 },  /* 1e284 */
+  { 0x80444b5e7aa7cf85ULL,   907 },  /* 1e292 */
+  { 0xbf21e44003acdd2dULL,   933 },  /* 1e300 */
+  { 0x8e679c2f5e44ff8fULL,   960 },  /* 1e308 */
+  { 0xd433179d9c8cb841ULL,   986 },  /* 1e316 */
+  { 0x9e19db92b4e31ba9ULL,  1013 },  /* 1e324 */
+  { 0xeb96bf6ebadf77d9ULL,  1039 },  /* 1e332 */
+  { 0xaf87023b9bf0ee6bULL,  1066 }   /* 1e340 */
+};
+
+/** Powers of ten that fit in a \c uint64_t. */
+static const uint64_t powers_of_ten[] = {
+  1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+  10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+  100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+  100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+  100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+};
+
+/** Multiply two \c DiyFp values, rounding the result. */
+static DiyFp
+diy_fp_mul(DiyFp x, DiyFp y)
+{
+  const uint64_t m32 = 0xffffffffULL;
+  uint64_t a = x.f >> 32, b = x.f & m32, c = y.f >> 32, d = y.f & m32;
+  uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+  uint64_t tmp = (bd >> 32) + (ad & m32) + (bc & m32) + (1ULL << 31);
+  DiyFp r;
+
+  r.f = ac + (ad >> 32) + (bc >> 32) + (tmp >> 32);
+  r.e = x.e + y.e + 64;
+  return r;
+}
+
+/** Shift a \c DiyFp left until the top bit of the significand is set. */
+static DiyFp
+diy_fp_normalize(DiyFp x)
+{
+  while (!(x.f & (1ULL << 63))) {
+    x.f <<= 1;
+    x.e--;
+  }
+  return x;
+}
+
+/** Find a cached power of ten, c, such that e + c.e lands in [-60, -32].
+ *
+ * \param[in] e Binary exponent of the value to scale.
+ * \param[out] k The decimal exponent of the power is -k .
+ * \return The cached power.
+ */
+static DiyFp
+cached_power(int e, int *k)
+{
+  double dk = (-61 - e) * 0.30102999566398114 + 347;
+  int ik = (int)dk;
+  unsigned index;
+
+  if (dk - ik > 0.0) {
+    ik++;
+  }
+  index = (unsigned)((ik >> 3) + 1);
+  *k = -(-348 + (int)index * 8);
+  return cached_powers[index];
+}
+
+/** Nudge the last digit towards the exact value where the interval allows.
+ */
+static void
+grisu_round(char *buffer, int len, uint64_t delta, uint64_t rest,
+    uint64_t ten_kappa, uint64_t wp_w)
+{
+  while (rest < wp_w && delta - rest >= ten_kappa
+      && (rest + ten_kappa < wp_w
+        || wp_w - rest > rest + ten_kappa - wp_w)) {
+    buffer[len - 1]--;
+    rest += ten_kappa;
+  }
+}
+
+/** Generate the digits of a short number inside (Mp - delta, Mp].
+ *
+ * \param[in] w The scaled value.
+ * \param[in] mp The scaled upper boundary.
+ * \param[in] delta Width of the scaled interval.
+ * \param[out] buffer The digits.
+ * \param[out] len Number of digits.
+ * \param[in,out] k Decimal exponent; the value is \c buffer * 10^ \c k.
+ */
+static void
+digit_gen(DiyFp w, DiyFp mp, uint64_t delta, char *buffer, int *len, int *k)
+{
+  DiyFp one;
+  uint64_t wp_w = mp.f - w.f, p2, tmp;
+  uint32_t p1, d;
+  int kappa;
+
+  one.f = 1ULL << -mp.e;
+  one.e = mp.e;
+  p1 = (uint32_t)(mp.f >> -one.e);
+  p2 = mp.f & (one.f - 1);
+  for (kappa = 1; kappa < 10 && p1 >= powers_of_ten[kappa]; kappa++) {
+  }
+
+  *len = 0;
+  while (kappa > 0) {
+    d = p1 / powers_of_ten[kappa - 1];
+    p1 %= powers_of_ten[kappa - 1];
+    if (d || *len) {
+      buffer[(*len)++] = '0' + d;
+    }
+    kappa--;
+    tmp = ((uint64_t)p1 << -one.e) + p2;
+    if (tmp <= delta) {
+      *k += kappa;
+      grisu_round(buffer, *len, delta, tmp, powers_of_ten[kappa] << -one.e, wp_w);
+      return;
+    }
+  }
+
+  for (;;) {
+    p2 *= 10;
+    delta *= 10;
+    d = (uint32_t)(p2 >> -one.e);
+    if (d || *len) {
+      buffer[(*len)++] = '0' + d;
+    }
+    p2 &= one.f - 1;
+    kappa--;
+    if (p2 < delta) {
+      *k += kappa;
+      grisu_round(buffer, *len, delta, p2, one.f,
+          -kappa < 20? wp_w * powers_of_ten[-kappa]: 0);
+      return;
+    }
+  }
+}
+
+/** Find short digits that read back as a finite, non-zero value.
+ *
+ * They round-trip and are usually the shortest that do; Grisu2 can
+ * give a digit more in rare cases.
+ *
+ * \param[in] bits The IEEE 754 representation of the absolute value.
+ * \param[in] fmt Layout of the type \c bits came from.
+ * \param[out] buffer The digits; at least 18 chars.
+ * \param[out] len Number of digits.
+ * \param[out] k Decimal exponent; the value is \c buffer * 10^ \c k.
+ */
+static void
+grisu2(uint64_t bits, const RealFormat *fmt, char *buffer, int *len, int *k)
+{
+  uint64_t hidden = 1ULL << fmt->significand_bits;
+  uint64_t significand = bits & (hidden - 1);
+  int biased_e = (int)(bits >> fmt->significand_bits);
+  DiyFp v, w, plus, minus, c_mk;
+
+  if (biased_e) {
+    v.f = significand + hidden;
+    v.e = biased_e - fmt->exponent_bias;
+  } else {
+    v.f = significand;
+    v.e = 1 - fmt->exponent_bias;
+  }
+
+  /* The boundaries are halfway to the neighbouring values.  Below a power
+   * of two the lower neighbour is half as far away. */
+  plus.f = (v.f << 1) + 1;
+  plus.e = v.e - 1;
+  plus = diy_fp_normalize(plus);
+  if (v.f == hidden && biased_e > 1) {
+    minus.f = (v.f << 2) - 1;
+    minus.e = v.e - 2;
+  } else {
+    minus.f = (v.f << 1) - 1;
+    minus.e = v.e - 1;
+  }
+  minus.f <<= minus.e - plus.e;
+  minus.e = plus.e;
+
+  c_mk = cached_power(plus.e, k);
+  w = diy_fp_mul(diy_fp_normalize(v), c_mk);
+  plus = diy_fp_mul(plus, c_mk);
+  minus = diy_fp_mul(minus, c_mk);
+  minus.f++;
+  plus.f--;
+  digit_gen(w, plus, plus.f - minus.f, buffer, len, k);
+}
+
+/** Write a decimal exponent in \c "%g" style: a sign and at least two
+ * digits. */
+static int
+write_exponent(char *buf, int exp)
+{
+  int len = 0;
+
+  buf[len++] = 'e';
+  if (exp < 0) {
+    buf[len++] = '-';
+    exp = -exp;
+  } else {
+    buf[len++] = '+';
+  }
+  if (exp >= 100) {
+    buf[len++] = '0' + exp / 100;
+    exp %= 100;
+  }
+  buf[len++] = '0' + exp / 10;
+  buf[len++] = '0' + exp % 10;
+  return len;
+}
+
+/** Format a real number.
+ *
+ * The digits read back as the same value and are usually the shortest
+ * that do.  They are laid out as \c "%.*g" would with the type's short precision, or
+ * its long precision if more digits are needed.  That's also how
+ * \c protoc lays them out.
+ *
+ * \param[in] bits The IEEE 754 representation of the value.
+ * \param[in] fmt Layout of the type \c bits came from.
+ * \param[out] buf Where to write the number.
+ * \return The length of the number.
+ */
+static size_t
+format_real(uint64_t bits, const RealFormat *fmt, char *buf)
+{
+  uint64_t sign = 1ULL << (fmt->significand_bits
+      + (fmt == &double_format? 11: 8));
+  uint64_t exp_mask = sign - (1ULL << fmt->significand_bits);
+  char digits[20];
+  size_t pos = 0;
+  int len, k, exp, i;
+
+  if ((bits & exp_mask) == exp_mask) {
+    if (bits & ((1ULL << fmt->significand_bits) - 1)) {
+      memcpy(buf, "nan", 3);
+      return 3;
+    }
+    if (bits & sign) {
+      buf[pos++] = '-';
+    }
+    memcpy(buf + pos, "inf", 3);
+    return pos + 3;
+  }
+  if (bits & sign) {
+    buf[pos++] = '-';
+    bits &= ~sign;
+  }
+  if (!bits) {
+    buf[pos++] = '0';
+    return pos;
+  }
+
+  grisu2(bits, fmt, digits, &len, &k);
+  exp = len + k - 1;  /* Exponent of the first digit. */
+  if (exp < -4 || exp >= (len <= fmt->short_precision?
+        fmt->short_precision: fmt->long_precision)) {
+    buf[pos++] = digits[0];
+    if (len > 1) {
+      buf[pos++] = '.';
+      memcpy(buf + pos, digits + 1, len - 1);
+      pos += len - 1;
+    }
+    pos += write_exponent(buf + pos, exp);
+  } else if (exp < 0) {
+    buf[pos++] = '0';
+    buf[pos++] = '.';
+    for (i = exp + 1; i < 0; i++) {
+      buf[pos++] = '0';
+    }
+    memcpy(buf + pos, digits, len);
+    pos += len;
+  } else if (exp + 1 >= len) {
+    memcpy(buf + pos, digits, len);
+    pos += len;
+    for (i = len; i <= exp; i++) {
+      buf[pos++] = '0';
+    }
+  } else {
+    memcpy(buf + pos, digits, exp + 1);
+    pos += exp + 1;
+    buf[pos++] = '.';
+    memcpy(buf + pos, digits + exp + 1, len - exp - 1);
+    pos += len - exp - 1;
+  }
+  return pos;
+}
+
+/** @} */  /* End of format group. */
+
+/* See .h file for API docs. */
+
+size_t
+protobuf_c_text_format_uint64(uint64_t value, char *buf)
+{
+  char tmp[PROTOBUF_C_TEXT_INT_MAX], *p = tmp + sizeof(tmp);
+  size_t len;
+
+  /* Work from the end two digits at a time. */
+  while (value >= 100) {
+    p -= 2;
+    memcpy(p, digit_pairs + (value % 100) * 2, 2);
+    value /= 100;
+  }
+  if (value >= 10) {
+    p -= 2;
+    memcpy(p, digit_pairs + value * 2, 2);
+  } else {
+    *--p = '0' + value;
+  }
+  len = tmp + sizeof(tmp) - p;
+  memcpy(buf, p, len);
+  return len;
+}
+
+size_t
+protobuf_c_text_format_int64(int64_t value, char *buf)
+{
+  if (value < 0) {
+    *buf = '-';
+    return 1 + protobuf_c_text_format_uint64(-(uint64_t)value, buf + 1);
+  }
+  return protobuf_c_text_format_uint64(value, buf);
+}
+
+size_t
+protobuf_c_text_format_double(double value, char *buf)
+{
+  uint64_t bits;
+
+  memcpy(&bits, &value, sizeof(bits));
+  return format_real(bits, &double_format, buf);
+}
+
+size_t
+protobuf_c_text_format_float(float value, char *buf)
+{
+  uint32_t bits;
+
+  memcpy(&bits, &value, sizeof(bits));
+  return format_real(bits, &float_format, buf);
+}
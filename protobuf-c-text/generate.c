@@ -10,7 +10,10 @@
  */
 
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#include <limits.h>
+#include <errno.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
@@ -19,67 +22,287 @@
 #include "protobuf-c-text.h"
 #include "protobuf-c-util.h"
 #include "config.h"
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+/** Size of the staging buffer used when writing to a sink. */
+#define RS_STAGING_SIZE 4096
+
+/** Smallest string a growing ReturnString allocates. */
+#define RS_INITIAL_SIZE 256
 
 /** A dynamic string struct.
  *
  * Used to track additions to a growing string and memory allocation
- * errors that occur in processing
+ * errors that occur in processing.
+ *
+ * If \c sink is set, \c s is instead a fixed staging buffer of
+ * \c allocated bytes which is passed on to \c sink whenever it fills.
  */
 typedef struct _ReturnString {
-  int malloc_err;  /**< Set to 1 when there's been a malloc error. */
+  int malloc_err;  /**< Set to 1 when there's been a malloc (or sink
+                        write) error. */
   int allocated;   /**< Size of allocated string. */
   int pos;         /**< Current end of the string. */
   char *s;         /**< The string. */
+  ProtobufCBuffer *sink;  /**< Where to send the output or \c NULL to
+                               build up \c s. */
+  struct _GenSplit *split;  /**< If not \c NULL , large repeated message
+                                 fields are handed to it to be generated
+                                 on other threads. */
+  ProtobufCTextStats *stats;  /**< If not \c NULL , where to note the
+                                   depth and repeated field sizes. */
+  int indent;      /**< Spaces to indent each level of nesting by. */
+  char eol;        /**< What ends each field: a newline, or a space
+                        for compact output. */
+  unsigned depth;  /**< Messages open around the one being written. */
 } ReturnString;
 
-/** Append a string to the ReturnString.
+/** Give up on a ReturnString.
  *
- * Append the string built from \c format and its args to the \c rs
- * string. Note that \c malloc_err is checked and if it's true,
- * this function won't do anything.
+ * Frees the string (but not a staging buffer) and sets \c malloc_err so
+ * that further appends do nothing.
  *
- * \param[in,out] rs The string to append to.
- * \param[in] guess A guess at the number of chars being added.
+ * \param[in,out] rs The string to give up on.
  * \param[in] allocator allocator functions.
- * \param[in] format Printf-style format string.
- * \param[in] ... Variable number of args for \c format.
  */
-static void rs_append(ReturnString *rs, int guess,
-    ProtobufCAllocator *allocator,
-    const char *format, ...)
-  __attribute__((format(printf, 4, 5)));
 static void
-rs_append(ReturnString *rs, int guess,
-    ProtobufCAllocator *allocator,
-    const char *format, ...)
+rs_fail(ReturnString *rs, ProtobufCAllocator *allocator)
 {
-  va_list args;
-  int added;
-
-  if (rs->malloc_err) {
-    return;
+  if (!rs->sink) {
+    PBC_FREE(rs->s);
+    rs->s = NULL;
   }
+  rs->malloc_err = 1;
+}
 
-  if (rs->allocated - rs->pos < guess * 2) {
+/** Make room in a ReturnString.
+ *
+ * Only for a ReturnString building up a string, not one with a sink.
+ * The string at least doubles each time it grows so building up a
+ * large string copies it a bounded number of times.  It can't grow
+ * past \c INT_MAX chars; asking for more fails.
+ *
+ * \param[in,out] rs The string to grow.
+ * \param[in] len The number of chars needed after \c rs->pos.
+ * \param[in] allocator allocator functions.
+ * \return Success (1) or failure (0).
+ */
+static int
+rs_grow(ReturnString *rs, int len, ProtobufCAllocator *allocator)
+{
+  if (len > INT_MAX - rs->pos) {
+    rs_fail(rs, allocator);
+    return 0;
+  }
+  if (rs->allocated - rs->pos < len) {
     char *tmp;
+    int allocated;
 
-    tmp = PBC_ALLOC(rs->allocated + guess * 2);
+    if (!rs->allocated) {
+      allocated = RS_INITIAL_SIZE;
+    } else if (rs->allocated > INT_MAX / 2) {
+      allocated = INT_MAX;
+    } else {
+      allocated = rs->allocated * 2;
+    }
+    if (allocated - rs->pos < len) {
+      allocated = rs->pos + len;
+    }
+    tmp = PBC_ALLOC(allocated);
     if (!tmp) {
+      rs_fail(rs, allocator);
+      return 0;
+    }
+    if (rs->s) {
+      memcpy(tmp, rs->s, rs->pos);
       PBC_FREE(rs->s);
-      rs->s = NULL;
-      rs->malloc_err = 1;
-      return;
     }
-    memcpy(tmp, rs->s, rs->allocated);
-    PBC_FREE(rs->s);
     rs->s = tmp;
-    rs->allocated += guess * 2;
+    rs->allocated = allocated;
+  }
+  return 1;
+}
+
+/** Pass the staging buffer of a ReturnString on to its sink.
+ *
+ * \param[in,out] rs The string to flush.
+ */
+static void
+rs_flush(ReturnString *rs)
+{
+  if (rs->pos) {
+    rs->sink->append(rs->sink, rs->pos, (uint8_t *)rs->s);
+    rs->pos = 0;
+  }
+}
+
+/** Get space for \c len chars at the end of a ReturnString.
+ *
+ * The caller writes up to \c len chars and a \c NUL and then adds what
+ * it wrote to \c rs->pos.
+ *
+ * \param[in,out] rs The string to append to.
+ * \param[in] len The number of chars needed.
+ * \param[in] allocator allocator functions.
+ * \return Where to write, or \c NULL if there's been an error or if
+ *         \c len won't fit in a sink's staging buffer.
+ */
+static char *
+rs_reserve(ReturnString *rs, int len, ProtobufCAllocator *allocator)
+{
+  if (rs->malloc_err) {
+    return NULL;
+  }
+  if (rs->sink) {
+    if (rs->allocated - rs->pos <= len) {
+      rs_flush(rs);
+      if (rs->allocated <= len) {
+        return NULL;
+      }
+    }
+  } else if (len == INT_MAX) {
+    /* No room for the NUL. */
+    rs_fail(rs, allocator);
+    return NULL;
+  } else if (!rs_grow(rs, len + 1, allocator)) {
+    return NULL;
+  }
+  return rs->s + rs->pos;
+}
+
+/** Append \c len chars to the ReturnString.
+ *
+ * \param[in,out] rs The string to append to.
+ * \param[in] data The chars to append.
+ * \param[in] len The number of chars.
+ * \param[in] allocator allocator functions.
+ */
+static void
+rs_write(ReturnString *rs, const char *data, int len,
+    ProtobufCAllocator *allocator)
+{
+  char *p = rs_reserve(rs, len, allocator);
+
+  if (p) {
+    memcpy(p, data, len);
+    rs->pos += len;
+    p[len] = '\0';
+  } else if (!rs->malloc_err) {
+    /* Too big to stage - send it straight through. */
+    rs->sink->append(rs->sink, len, (const uint8_t *)data);
+  }
+}
+
+/** Append \c len spaces to the ReturnString.
+ *
+ * \param[in,out] rs The string to append to.
+ * \param[in] len The number of spaces.
+ * \param[in] allocator allocator functions.
+ */
+static void
+rs_indent(ReturnString *rs, int len, ProtobufCAllocator *allocator)
+{
+  char *p;
+  int chunk;
+
+  while (len) {
+    chunk = rs->sink && len >= rs->allocated? rs->allocated - 1: len;
+    p = rs_reserve(rs, chunk, allocator);
+    if (!p) {
+      return;
+    }
+    memset(p, ' ', chunk);
+    rs->pos += chunk;
+    p[chunk] = '\0';
+    len -= chunk;
+  }
+}
+
+/** Append a \c "name: value" line to the ReturnString.
+ *
+ * Copies the pieces straight in.  If \c quote is set the value is put
+ * in double quotes.
+ *
+ * \param[in,out] rs The string to append to.
+ * \param[in] level Indent level.
+ * \param[in] name The field name.
+ * \param[in] value The formatted value.
+ * \param[in] len Length of \c value.
+ * \param[in] quote Whether to quote \c value.
+ * \param[in] allocator allocator functions.
+ */
+static void
+rs_append_field(ReturnString *rs, int level, const char *name,
+    const char *value, int len, int quote, ProtobufCAllocator *allocator)
+{
+  int name_len = strlen(name), total = level + name_len + len + 3;
+  char *p;
+
+  if (quote) {
+    total += 2;
   }
-  va_start(args, format);
-  added = vsnprintf(rs->s + rs->pos, rs->allocated - rs->pos, format, args);
-  va_end(args);
-  rs->pos += added;
-  return;
+  p = rs_reserve(rs, total, allocator);
+  if (!p) {
+    rs_indent(rs, level, allocator);
+    rs_write(rs, name, name_len, allocator);
+    rs_write(rs, quote? ": \"": ": ", quote? 3: 2, allocator);
+    rs_write(rs, value, len, allocator);
+    if (quote) {
+      rs_write(rs, "\"", 1, allocator);
+    }
+    rs_write(rs, &rs->eol, 1, allocator);
+    return;
+  }
+  memset(p, ' ', level);
+  p += level;
+  memcpy(p, name, name_len);
+  p += name_len;
+  *p++ = ':';
+  *p++ = ' ';
+  if (quote) {
+    *p++ = '"';
+  }
+  memcpy(p, value, len);
+  p += len;
+  if (quote) {
+    *p++ = '"';
+  }
+  *p++ = rs->eol;
+  *p = '\0';
+  rs->pos += total;
+}
+
+/** Append the \c "name {" line that opens a nested message.
+ *
+ * \param[in,out] rs The string to append to.
+ * \param[in] level Indent level.
+ * \param[in] name The field name.
+ * \param[in] allocator allocator functions.
+ */
+static void
+rs_append_open(ReturnString *rs, int level, const char *name,
+    ProtobufCAllocator *allocator)
+{
+  rs_indent(rs, level, allocator);
+  rs_write(rs, name, strlen(name), allocator);
+  rs_write(rs, " {", 2, allocator);
+  rs_write(rs, &rs->eol, 1, allocator);
+}
+
+/** Append the \c "}" line that closes a nested message.
+ *
+ * \param[in,out] rs The string to append to.
+ * \param[in] level Indent level.
+ * \param[in] allocator allocator functions.
+ */
+static void
+rs_append_close(ReturnString *rs, int level, ProtobufCAllocator *allocator)
+{
+  rs_indent(rs, level, allocator);
+  rs_write(rs, "}", 1, allocator);
+  rs_write(rs, &rs->eol, 1, allocator);
 }
 
 /** @} */  /* End of utility group. */
@@ -90,76 +313,154 @@ rs_append(ReturnString *rs, int guess,
  * @{
  */
 
-/** Escape string.
+/** Room for any formatted integer or real. */
+#define SCALAR_MAX PROTOBUF_C_TEXT_REAL_MAX
+
+/** Append a \c "name: value" line for a scalar field.
+ *
+ * Handles everything but strings, bytes and messages.
+ *
+ * \param[in,out] rs The string being built up.
+ * \param[in] level Indent level.
+ * \param[in] f The field.
+ * \param[in] values The field's value, or array of values if repeated.
+ * \param[in] j Which of \c values to append.
+ * \param[in] allocator allocator functions.
+ */
+static void
+rs_append_scalar(ReturnString *rs, int level,
+    const ProtobufCFieldDescriptor *f, const void *values, size_t j,
+    ProtobufCAllocator *allocator)
+{
+  const ProtobufCEnumValue *enumv;
+  char buf[SCALAR_MAX];
+  const char *word;
+  int len;
+
+  switch (f->type) {
+    case PROTOBUF_C_TYPE_INT32:
+    case PROTOBUF_C_TYPE_UINT32:
+    case PROTOBUF_C_TYPE_FIXED32:
+      len = protobuf_c_text_format_uint64(((const uint32_t *)values)[j],
+          buf);
+      break;
+    case PROTOBUF_C_TYPE_SINT32:
+    case PROTOBUF_C_TYPE_SFIXED32:
+      len = protobuf_c_text_format_int64(((const int32_t *)values)[j],
+          buf);
+      break;
+    case PROTOBUF_C_TYPE_INT64:
+    case PROTOBUF_C_TYPE_UINT64:
+    case PROTOBUF_C_TYPE_FIXED64:
+      len = protobuf_c_text_format_uint64(((const uint64_t *)values)[j],
+          buf);
+      break;
+    case PROTOBUF_C_TYPE_SINT64:
+    case PROTOBUF_C_TYPE_SFIXED64:
+      len = protobuf_c_text_format_int64(((const int64_t *)values)[j],
+          buf);
+      break;
+    case PROTOBUF_C_TYPE_FLOAT:
+      len = protobuf_c_text_format_float(((const float *)values)[j], buf);
+      break;
+    case PROTOBUF_C_TYPE_DOUBLE:
+      len = protobuf_c_text_format_double(((const double *)values)[j], buf);
+      break;
+    case PROTOBUF_C_TYPE_BOOL:
+      word = ((const protobuf_c_boolean *)values)[j]? "true": "false";
+      rs_append_field(rs, level, f->name, word, strlen(word), 0, allocator);
+      return;
+    case PROTOBUF_C_TYPE_ENUM:
+      enumv = protobuf_c_enum_descriptor_get_value(
+          (const ProtobufCEnumDescriptor *)f->descriptor,
+          ((const int *)values)[j]);
+      word = enumv? enumv->name: "unknown";
+      rs_append_field(rs, level, f->name, word, strlen(word), 0, allocator);
+      return;
+    default:
+      rs_fail(rs, allocator);
+      return;
+  }
+  rs_append_field(rs, level, f->name, buf, len, 0, allocator);
+}
+
+/** Append a \c "name: \"value\"" line for a string or bytes field.
  *
- * Add escape characters to strings for problematic characters.
+ * The value is escaped straight into the output.  If the line won't fit
+ * in a sink's staging buffer the value is escaped a piece at a time.
  *
- * \param[in] src The unescaped string to process.
+ * \param[in,out] rs The string being built up.
+ * \param[in] level Indent level.
+ * \param[in] name The field name.
+ * \param[in] src The unescaped value.
  * \param[in] len Length of \c src. Note that \c src might have ASCII
  *                \c NULs so strlen() isn't good enough here.
  * \param[in] allocator allocator functions.
- * \return The fully escaped string, or \c NULL if there has been an
- *         allocation error.
  */
-static char *
-esc_str(char *src, int len, ProtobufCAllocator *allocator)
+static void
+rs_append_escaped(ReturnString *rs, int level, const char *name,
+    const void *src, size_t len, ProtobufCAllocator *allocator)
 {
-  int i, escapes = 0, dst_len = 0;
-  unsigned char *dst;
+  const unsigned char *s = src;
+  int name_len = strlen(name), chunk;
+  size_t total;
+  char *p = NULL;
 
-  for (i = 0; i < len; i++) {
-    if (!isprint(src[i])) {
-      escapes++;
-    }
+  if (rs->malloc_err) {
+    return;
   }
-  dst = PBC_ALLOC((escapes * 4) + ((len - escapes) * 2) + 1);
-  if (!dst) {
-    return NULL;
+  total = level + name_len + protobuf_c_text_escaped_size(src, len) + 5;
+  if (total < INT_MAX) {
+    p = rs_reserve(rs, total, allocator);
+  } else if (!rs->sink) {
+    /* A string can't be that long. */
+    rs_fail(rs, allocator);
+    return;
+  }
+  if (p) {
+    memset(p, ' ', level);
+    p += level;
+    memcpy(p, name, name_len);
+    p += name_len;
+    *p++ = ':';
+    *p++ = ' ';
+    *p++ = '"';
+    p += protobuf_c_text_escape(src, len, p);
+    *p++ = '"';
+    *p++ = rs->eol;
+    *p = '\0';
+    rs->pos += total;
+    return;
   }
 
-  for (i = 0; i < len; i++) {
-    switch (src[i]) {
-      /* Special cases. */
-      case '\'':
-        dst[dst_len++] = '\\';
-        dst[dst_len++] = '\'';
-        break;
-      case '\"':
-        dst[dst_len++] = '\\';
-        dst[dst_len++] = '\"';
-        break;
-      case '\\':
-        dst[dst_len++] = '\\';
-        dst[dst_len++] = '\\';
-        break;
-      case '\n':
-        dst[dst_len++] = '\\';
-        dst[dst_len++] = 'n';
-        break;
-      case '\r':
-        dst[dst_len++] = '\\';
-        dst[dst_len++] = 'r';
-        break;
-      case '\t':
-        dst[dst_len++] = '\\';
-        dst[dst_len++] = 't';
-        break;
-
-      /* Escape with octal if !isprint. */
-      default:
-        if (!isprint(src[i])) {
-          dst_len += sprintf(dst + dst_len, "\\%03o", src[i]);
-        } else {
-          dst[dst_len++] = src[i];
-        }
-        break;
+  rs_indent(rs, level, allocator);
+  rs_write(rs, name, name_len, allocator);
+  rs_write(rs, ": \"", 3, allocator);
+  /* Each byte escapes to at most 4 chars. */
+  chunk = (rs->allocated - 1) / 4;
+  while (len) {
+    if ((size_t)chunk > len) {
+      chunk = len;
+    }
+    p = rs_reserve(rs, chunk * 4, allocator);
+    if (!p) {
+      return;
     }
+    rs->pos += protobuf_c_text_escape(s, chunk, p);
+    rs->s[rs->pos] = '\0';
+    s += chunk;
+    len -= chunk;
   }
-  dst[dst_len] = '\0';
-
-  return dst;
+  rs_write(rs, "\"", 1, allocator);
+  rs_write(rs, &rs->eol, 1, allocator);
 }
 
+#ifdef HAVE_PTHREAD
+static int rs_split(ReturnString *rs, int level,
+    const ProtobufCFieldDescriptor *field, ProtobufCMessage **msgs,
+    size_t n, ProtobufCAllocator *allocator);
+#endif
+
 /** Internal function to back API function.
  *
  * Has a few extra params to better enable recursion.  This function gets
@@ -167,7 +468,7 @@ esc_str(char *src, int len, ProtobufCAllocator *allocator)
  * traversed.
  *
  * \param[in,out] rs The string being built up for the text format protobuf.
- * \param[in] level Indent level - increments in 2's.
+ * \param[in] level Indent level - increments by \c rs->indent .
  * \param[in] m The \c ProtobufCMessage being serialised.
  * \param[in] d The descriptor for the \c ProtobufCMessage.
  * \param[in] allocator allocator functions.
@@ -181,11 +482,11 @@ protobuf_c_text_to_string_internal(ReturnString *rs,
 {
   int i;
   size_t j, quantifier_offset;
-  double float_var;
   const ProtobufCFieldDescriptor *f;
-  ProtobufCEnumDescriptor *enumd;
-  const ProtobufCEnumValue *enumv;
 
+  if (rs->stats && rs->stats->max_depth <= rs->depth) {
+    rs->stats->max_depth = rs->depth + 1;
+  }
   f = d->fields;
   for (i = 0; i < d->n_fields; i++) {
     if (rs->malloc_err) {
@@ -216,6 +517,11 @@ protobuf_c_text_to_string_internal(ReturnString *rs,
         if (!STRUCT_MEMBER(size_t, m, f[i].quantifier_offset)) {
           continue;
         }
+        if (rs->stats && rs->stats->max_repeated
+            < STRUCT_MEMBER(size_t, m, f[i].quantifier_offset)) {
+          rs->stats->max_repeated =
+            STRUCT_MEMBER(size_t, m, f[i].quantifier_offset);
+        }
         break;
     }
 
@@ -225,264 +531,95 @@ protobuf_c_text_to_string_internal(ReturnString *rs,
       case PROTOBUF_C_TYPE_INT32:
       case PROTOBUF_C_TYPE_UINT32:
       case PROTOBUF_C_TYPE_FIXED32:
-        if (f[i].label == PROTOBUF_C_LABEL_REPEATED) {
-          for (j = 0; j < quantifier_offset; j++) {
-            rs_append(rs, level + strlen(f[i].name) + 20,
-                allocator,
-                "%*s%s: %u\n",
-                level, "", f[i].name,
-                STRUCT_MEMBER(uint32_t *, m, f[i].offset)[j]);
-          }
-        } else {
-          rs_append(rs, level + strlen(f[i].name) + 20,
-              allocator,
-              "%*s%s: %u\n",
-              level, "", f[i].name,
-              STRUCT_MEMBER(uint32_t, m, f[i].offset));
-        }
-        break;
       case PROTOBUF_C_TYPE_SINT32:
       case PROTOBUF_C_TYPE_SFIXED32:
-        if (f[i].label == PROTOBUF_C_LABEL_REPEATED) {
-          for (j = 0; j < quantifier_offset; j++) {
-            rs_append(rs, level + strlen(f[i].name) + 20,
-                allocator,
-                "%*s%s: %d\n",
-                level, "", f[i].name,
-                STRUCT_MEMBER(int32_t *, m, f[i].offset)[j]);
-          }
-        } else {
-          rs_append(rs, level + strlen(f[i].name) + 20,
-              allocator,
-              "%*s%s: %d\n",
-              level, "", f[i].name,
-              STRUCT_MEMBER(int32_t, m, f[i].offset));
-        }
-        break;
       case PROTOBUF_C_TYPE_INT64:
       case PROTOBUF_C_TYPE_UINT64:
       case PROTOBUF_C_TYPE_FIXED64:
-        if (f[i].label == PROTOBUF_C_LABEL_REPEATED) {
-          for (j = 0; j < quantifier_offset; j++) {
-            rs_append(rs, level + strlen(f[i].name) + 20,
-                allocator,
-                "%*s%s: %lu\n",
-                level, "", f[i].name,
-                STRUCT_MEMBER(uint64_t *, m, f[i].offset)[j]);
-          }
-        } else {
-          rs_append(rs, level + strlen(f[i].name) + 20,
-              allocator,
-              "%*s%s: %lu\n",
-              level, "", f[i].name,
-              STRUCT_MEMBER(uint64_t, m, f[i].offset));
-        }
-        break;
       case PROTOBUF_C_TYPE_SINT64:
       case PROTOBUF_C_TYPE_SFIXED64:
-        if (f[i].label == PROTOBUF_C_LABEL_REPEATED) {
-          for (j = 0; j < quantifier_offset; j++) {
-            rs_append(rs, level + strlen(f[i].name) + 20,
-                allocator,
-                "%*s%s: %ld\n",
-                level, "", f[i].name,
-                STRUCT_MEMBER(int64_t *, m, f[i].offset)[j]);
-          }
-        } else {
-          rs_append(rs, level + strlen(f[i].name) + 20,
-              allocator,
-              "%*s%s: %ld\n",
-              level, "", f[i].name,
-              STRUCT_MEMBER(int64_t, m, f[i].offset));
-        }
-        break;
       case PROTOBUF_C_TYPE_FLOAT:
-        if (f[i].label == PROTOBUF_C_LABEL_REPEATED) {
-          for (j = 0; j < quantifier_offset; j++) {
-            float_var = STRUCT_MEMBER(float *, m, f[i].offset)[j];
-            rs_append(rs, level + strlen(f[i].name) + 20,
-                allocator,
-                "%*s%s: %g\n",
-                level, "", f[i].name,
-                float_var);
-          }
-        } else {
-          float_var = STRUCT_MEMBER(float, m, f[i].offset);
-          rs_append(rs, level + strlen(f[i].name) + 20,
-              allocator,
-              "%*s%s: %g\n",
-              level, "", f[i].name,
-              float_var);
-        }
-        break;
       case PROTOBUF_C_TYPE_DOUBLE:
-        if (f[i].label == PROTOBUF_C_LABEL_REPEATED) {
-          for (j = 0; j < quantifier_offset; j++) {
-            rs_append(rs, level + strlen(f[i].name) + 20,
-                allocator,
-                "%*s%s: %g\n",
-                level, "", f[i].name,
-                STRUCT_MEMBER(double *, m, f[i].offset)[j]);
-          }
-        } else {
-          rs_append(rs, level + strlen(f[i].name) + 20,
-              allocator,
-              "%*s%s: %g\n",
-              level, "", f[i].name,
-              STRUCT_MEMBER(double, m, f[i].offset));
-        }
-        break;
       case PROTOBUF_C_TYPE_BOOL:
-        if (f[i].label == PROTOBUF_C_LABEL_REPEATED) {
-          for (j = 0; j < quantifier_offset; j++) {
-            rs_append(rs, level + strlen(f[i].name) + 20,
-                allocator,
-                "%*s%s: %s\n",
-                level, "", f[i].name,
-                STRUCT_MEMBER(protobuf_c_boolean *, m, f[i].offset)[j]?
-                "true": "false");
-          }
-        } else {
-          rs_append(rs, level + strlen(f[i].name) + 20,
-              allocator,
-              "%*s%s: %s\n",
-              level, "", f[i].name,
-              STRUCT_MEMBER(protobuf_c_boolean, m, f[i].offset)?
-              "true": "false");
-        }
-        break;
       case PROTOBUF_C_TYPE_ENUM:
-        enumd = (ProtobufCEnumDescriptor *)f[i].descriptor;
         if (f[i].label == PROTOBUF_C_LABEL_REPEATED) {
           for (j = 0; j < quantifier_offset; j++) {
-            enumv = protobuf_c_enum_descriptor_get_value(
-                enumd, STRUCT_MEMBER(int *, m, f[i].offset)[j]);
-            rs_append(rs, level + strlen(f[i].name) + 20,
-                allocator,
-                "%*s%s: %s\n",
-                level, "", f[i].name,
-                enumv? enumv->name: "unknown");
+            rs_append_scalar(rs, level, &f[i],
+                STRUCT_MEMBER(void *, m, f[i].offset), j, allocator);
           }
         } else {
-          enumv = protobuf_c_enum_descriptor_get_value(
-              enumd, STRUCT_MEMBER(int, m, f[i].offset));
-          rs_append(rs, level + strlen(f[i].name) + 20,
-              allocator,
-              "%*s%s: %s\n",
-              level, "", f[i].name,
-              enumv? enumv->name: "unknown");
+          rs_append_scalar(rs, level, &f[i],
+              STRUCT_MEMBER_PTR(void, m, f[i].offset), 0, allocator);
         }
         break;
       case PROTOBUF_C_TYPE_STRING:
         if (f[i].label == PROTOBUF_C_LABEL_REPEATED) {
           for (j = 0; j < quantifier_offset; j++) {
-            unsigned char *escaped;
+            const char *str = STRUCT_MEMBER(char **, m, f[i].offset)[j];
 
-            escaped = esc_str(
-                STRUCT_MEMBER(unsigned char **, m, f[i].offset)[j],
-                strlen(STRUCT_MEMBER(unsigned char **, m, f[i].offset)[j]),
+            rs_append_escaped(rs, level, f[i].name, str, strlen(str),
                 allocator);
-            if (!escaped) {
-              PBC_FREE(rs->s);
-              rs->s = NULL;
-              rs->malloc_err = 1;
-              return;
-            }
-            rs_append(rs, level + strlen(f[i].name) + strlen(escaped) + 10,
-                allocator,
-                "%*s%s: \"%s\"\n", level, "", f[i].name, escaped);
-            PBC_FREE(escaped);
           }
         } else {
-          unsigned char *escaped;
+          const char *str = STRUCT_MEMBER(char *, m, f[i].offset);
 
-          escaped = esc_str(STRUCT_MEMBER(unsigned char *, m, f[i].offset),
-              strlen(STRUCT_MEMBER(unsigned char *, m, f[i].offset)),
+          rs_append_escaped(rs, level, f[i].name, str, strlen(str),
               allocator);
-          if (!escaped) {
-            PBC_FREE(rs->s);
-            rs->s = NULL;
-            rs->malloc_err = 1;
-            return;
-          }
-          rs_append(rs, level + strlen(f[i].name) + strlen(escaped) + 10,
-              allocator,
-              "%*s%s: \"%s\"\n", level, "", f[i].name, escaped);
-          PBC_FREE(escaped);
         }
         break;
       case PROTOBUF_C_TYPE_BYTES:
         if (f[i].label == PROTOBUF_C_LABEL_REPEATED) {
           for (j = 0; j < quantifier_offset; j++) {
-            unsigned char *escaped;
+            const ProtobufCBinaryData *bin =
+              &STRUCT_MEMBER(ProtobufCBinaryData *, m, f[i].offset)[j];
 
-            escaped = esc_str(
-                STRUCT_MEMBER(ProtobufCBinaryData *, m, f[i].offset)[j].data,
-                STRUCT_MEMBER(ProtobufCBinaryData *, m, f[i].offset)[j].len,
+            rs_append_escaped(rs, level, f[i].name, bin->data, bin->len,
                 allocator);
-            if (!escaped) {
-              PBC_FREE(rs->s);
-              rs->s = NULL;
-              rs->malloc_err = 1;
-              return;
-            }
-            rs_append(rs, level + strlen(f[i].name) + strlen(escaped) + 10,
-                allocator,
-                "%*s%s: \"%s\"\n", level, "", f[i].name, escaped);
-            PBC_FREE(escaped);
           }
         } else {
-          unsigned char *escaped;
+          const ProtobufCBinaryData *bin =
+            STRUCT_MEMBER_PTR(ProtobufCBinaryData, m, f[i].offset);
 
-          escaped = esc_str(
-              STRUCT_MEMBER(ProtobufCBinaryData, m, f[i].offset).data,
-              STRUCT_MEMBER(ProtobufCBinaryData, m, f[i].offset).len,
+          rs_append_escaped(rs, level, f[i].name, bin->data, bin->len,
               allocator);
-          if (!escaped) {
-            PBC_FREE(rs->s);
-            rs->s = NULL;
-            rs->malloc_err = 1;
-            return;
-          }
-          rs_append(rs, level + strlen(f[i].name) + strlen(escaped) + 10,
-              allocator,
-              "%*s%s: \"%s\"\n", level, "", f[i].name, escaped);
-          PBC_FREE(escaped);
         }
         break;
 
       case PROTOBUF_C_TYPE_MESSAGE:
+#ifdef HAVE_PTHREAD
+        if (f[i].label == PROTOBUF_C_LABEL_REPEATED && rs->split
+            && rs_split(rs, level, &f[i],
+              STRUCT_MEMBER(ProtobufCMessage **, m, f[i].offset),
+              quantifier_offset, allocator)) {
+          break;
+        }
+#endif
         if (f[i].label == PROTOBUF_C_LABEL_REPEATED) {
           for (j = 0;
               j < STRUCT_MEMBER(size_t, m, f[i].quantifier_offset);
               j++) {
-            rs_append(rs, level + strlen(f[i].name) + 10,
-                allocator,
-                "%*s%s {\n", level, "", f[i].name);
-            protobuf_c_text_to_string_internal(rs, level + 2,
+            rs_append_open(rs, level, f[i].name, allocator);
+            rs->depth++;
+            protobuf_c_text_to_string_internal(rs, level + rs->indent,
                 STRUCT_MEMBER(ProtobufCMessage **, m, f[i].offset)[j],
                 (ProtobufCMessageDescriptor *)f[i].descriptor,
                 allocator);
-            rs_append(rs, level + 10,
-                allocator,
-                "%*s}\n", level, "");
+            rs->depth--;
+            rs_append_close(rs, level, allocator);
           }
         } else {
-          rs_append(rs, level + strlen(f[i].name) + 10,
-              allocator,
-              "%*s%s {\n", level, "", f[i].name);
-          protobuf_c_text_to_string_internal(rs, level + 2,
+          rs_append_open(rs, level, f[i].name, allocator);
+          rs->depth++;
+          protobuf_c_text_to_string_internal(rs, level + rs->indent,
               STRUCT_MEMBER(ProtobufCMessage *, m, f[i].offset),
               (ProtobufCMessageDescriptor *)f[i].descriptor,
               allocator);
-          rs_append(rs, level + 10,
-              allocator,
-              "%*s}\n", level, "");
+          rs->depth--;
+          rs_append_close(rs, level, allocator);
         }
         break;
       default:
-        PBC_FREE(rs->s);
-        rs->s = NULL;
+        rs_fail(rs, allocator);
         return;
         break;
     }
@@ -490,17 +627,1118 @@ protobuf_c_text_to_string_internal(ReturnString *rs,
   }
 }
 
-/** @} */  /* End of generate group. */
+#ifdef HAVE_PTHREAD
 
-/* See .h file for API docs. */
+/** Smallest slice of a repeated message field worth generating on
+ * another thread.  Fields with fewer than two slices' worth of elements
+ * are generated in line. */
+#ifndef PARALLEL_MIN_SLICE
+#define PARALLEL_MIN_SLICE 256
+#endif
 
-char *
-protobuf_c_text_to_string(ProtobufCMessage *m,
+/** Slices per thread a large field is cut into; more than one evens
+ * out the load. */
+#define PARALLEL_SLICES_PER_THREAD 4
+
+/** Most pieces handed to one \c writev() . */
+#define PARALLEL_IOV_MAX 64
+
+/** A piece of the output of a parallel generation.
+ *
+ * Either text generated in line, or a slice of a repeated message field
+ * to be generated on a thread.
+ */
+typedef struct _GenPiece {
+  char *s;       /**< The text, once it has been generated. */
+  size_t len;    /**< Length of \c s . */
+  const ProtobufCFieldDescriptor *field;  /**< For a slice, the field. */
+  ProtobufCMessage **msgs;  /**< For a slice, its first element, else
+                                 \c NULL . */
+  size_t n;      /**< For a slice, the number of elements. */
+  int level;     /**< For a slice, the indent level of the field. */
+} GenPiece;
+
+/** The pieces of a parallel generation, in output order. */
+typedef struct _GenSplit {
+  GenPiece *pieces;     /**< The pieces. */
+  size_t n_pieces;      /**< Pieces in use. */
+  size_t max_pieces;    /**< Size of \c pieces . */
+  size_t next;          /**< Next piece for a thread to look at. */
+  unsigned n_threads;   /**< Threads to use. */
+  int failed;           /**< Set once a slice fails. */
+  ProtobufCAllocator *allocator;  /**< Allocator functions. */
+  pthread_mutex_t lock; /**< Guards \c next and \c failed . */
+} GenSplit;
+
+/** Add a piece to the end of a \c GenSplit .
+ *
+ * \param[in,out] split The pieces so far.
+ * \param[in] piece The piece to add.
+ * \return Success (1) or failure (0).
+ */
+static int
+gen_add_piece(GenSplit *split, const GenPiece *piece)
+{
+  ProtobufCAllocator *allocator = split->allocator;
+
+  if (split->n_pieces == split->max_pieces) {
+    size_t max_pieces = split->max_pieces? split->max_pieces * 2: 16;
+    GenPiece *tmp;
+
+    tmp = PBC_ALLOC(max_pieces * sizeof(GenPiece));
+    if (!tmp) {
+      return 0;
+    }
+    if (split->pieces) {
+      memcpy(tmp, split->pieces, split->n_pieces * sizeof(GenPiece));
+      PBC_FREE(split->pieces);
+    }
+    split->pieces = tmp;
+    split->max_pieces = max_pieces;
+  }
+  split->pieces[split->n_pieces++] = *piece;
+  return 1;
+}
+
+/** Hand a large repeated message field to other threads.
+ *
+ * Ends the current piece of text with what \c rs holds and adds slices
+ * of the field after it; \c rs starts again empty for the text that
+ * follows.
+ *
+ * \param[in,out] rs The string being built up, with \c split set.
+ * \param[in] level Indent level of the field.
+ * \param[in] field The field.
+ * \param[in] msgs Its elements.
+ * \param[in] n Number of elements.
+ * \param[in] allocator allocator functions.
+ * \return 1 if the field was taken (or there was an error), 0 if it's
+ *         too small and should be generated in line.
+ */
+static int
+rs_split(ReturnString *rs, int level,
+    const ProtobufCFieldDescriptor *field, ProtobufCMessage **msgs,
+    size_t n, ProtobufCAllocator *allocator)
+{
+  GenSplit *split = rs->split;
+  GenPiece piece;
+  size_t i, n_slices, start;
+
+  if (n < 2 * PARALLEL_MIN_SLICE) {
+    return 0;
+  }
+  n_slices = (size_t)split->n_threads * PARALLEL_SLICES_PER_THREAD;
+  if (n_slices > n / PARALLEL_MIN_SLICE) {
+    n_slices = n / PARALLEL_MIN_SLICE;
+  }
+
+  memset(&piece, 0, sizeof(piece));
+  piece.s = rs->s;
+  piece.len = rs->pos;
+  if (!gen_add_piece(split, &piece)) {
+    rs_fail(rs, allocator);
+    return 1;
+  }
+  rs->s = NULL;
+  rs->allocated = 0;
+  rs->pos = 0;
+
+  for (i = 0; i < n_slices; i++) {
+    start = n * i / n_slices;
+    piece.field = field;
+    piece.msgs = msgs + start;
+    piece.n = n * (i + 1) / n_slices - start;
+    piece.level = level;
+    if (!gen_add_piece(split, &piece)) {
+      rs_fail(rs, allocator);
+      return 1;
+    }
+  }
+  return 1;
+}
+
+/** Generate slices until there are none left.
+ *
+ * Run on each thread of a parallel generation, including the calling
+ * one.
+ *
+ * \param[in,out] arg The \c GenSplit .
+ * \return \c NULL .
+ */
+static void *
+gen_worker(void *arg)
+{
+  GenSplit *split = arg;
+  ProtobufCAllocator *allocator = split->allocator;
+  GenPiece *piece;
+  size_t j;
+
+  for (;;) {
+    pthread_mutex_lock(&split->lock);
+    piece = NULL;
+    while (!split->failed && split->next < split->n_pieces) {
+      piece = &split->pieces[split->next++];
+      if (piece->msgs) {
+        break;
+      }
+      piece = NULL;
+    }
+    pthread_mutex_unlock(&split->lock);
+    if (!piece) {
+      return NULL;
+    }
+
+    {
+      ReturnString rs = { 0, 0, 0, NULL, NULL, NULL, NULL, 2, '\n', 0 };
+
+      for (j = 0; j < piece->n && !rs.malloc_err; j++) {
+        rs_append_open(&rs, piece->level, piece->field->name, allocator);
+        protobuf_c_text_to_string_internal(&rs, piece->level + rs.indent,
+            piece->msgs[j],
+            (ProtobufCMessageDescriptor *)piece->field->descriptor,
+            allocator);
+        rs_append_close(&rs, piece->level, allocator);
+      }
+      if (rs.malloc_err) {
+        pthread_mutex_lock(&split->lock);
+        split->failed = 1;
+        pthread_mutex_unlock(&split->lock);
+      } else {
+        piece->s = rs.s;
+        piece->len = rs.pos;
+      }
+    }
+  }
+}
+
+/** Free the pieces of a parallel generation.
+ *
+ * \param[in,out] split The pieces.
+ */
+static void
+gen_free(GenSplit *split)
+{
+  ProtobufCAllocator *allocator = split->allocator;
+  size_t i;
+
+  for (i = 0; i < split->n_pieces; i++) {
+    if (split->pieces[i].s) {
+      PBC_FREE(split->pieces[i].s);
+    }
+  }
+  if (split->pieces) {
+    PBC_FREE(split->pieces);
+  }
+}
+
+/** Generate a message as a list of pieces of text using several threads.
+ *
+ * Walks the message on the calling thread, handing large repeated
+ * message fields to rs_split(), then generates the slices on up to
+ * \c n_threads threads.  Concatenated in order the pieces are what
+ * protobuf_c_text_to_string() gives.
+ *
+ * \param[in] m The \c ProtobufCMessage to be serialised.
+ * \param[in] n_threads Threads to use, at least 2.
+ * \param[out] split The pieces.  Free them with gen_free() on success.
+ * \param[in] allocator allocator functions.
+ * \return Success (1) or failure (0).
+ */
+static int
+gen_parallel(ProtobufCMessage *m,
+    unsigned n_threads,
+    GenSplit *split,
     ProtobufCAllocator *allocator)
 {
-  ReturnString rs = { 0, 0, 0, NULL };
+  ReturnString rs = { 0, 0, 0, NULL, NULL, split, NULL, 2, '\n', 0 };
+  GenPiece piece;
+  pthread_t *threads;
+  size_t i, n_slices = 0, n_started = 0;
 
+  memset(split, 0, sizeof(GenSplit));
+  split->n_threads = n_threads;
+  split->allocator = allocator;
   protobuf_c_text_to_string_internal(&rs, 0, m, m->descriptor, allocator);
-
-  return rs.s;
+  if (!rs.malloc_err) {
+    memset(&piece, 0, sizeof(piece));
+    piece.s = rs.s;
+    piece.len = rs.pos;
+    if (!gen_add_piece(split, &piece)) {
+      rs_fail(&rs, allocator);
+    }
+  }
+  if (rs.malloc_err) {
+    gen_free(split);
+    return 0;
+  }
+
+  for (i = 0; i < split->n_pieces; i++) {
+    n_slices += split->pieces[i].msgs != NULL;
+  }
+  if (n_threads > n_slices) {
+    n_threads = n_slices;
+  }
+  threads = n_threads > 1? PBC_ALLOC(n_threads * sizeof(pthread_t)): NULL;
+
+  /* The calling thread works too; if threads can't be started it just
+   * does more of the work. */
+  pthread_mutex_init(&split->lock, NULL);
+  for (; threads && n_started + 1 < n_threads; n_started++) {
+    if (pthread_create(&threads[n_started], NULL, gen_worker, split)) {
+      break;
+    }
+  }
+  gen_worker(split);
+  for (i = 0; i < n_started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  pthread_mutex_destroy(&split->lock);
+  if (threads) {
+    PBC_FREE(threads);
+  }
+
+  if (split->failed) {
+    gen_free(split);
+    return 0;
+  }
+  return 1;
+}
+
+/** Work out how many threads to use.
+ *
+ * \param[in] n_threads Threads asked for, or 0 for one per online CPU.
+ * \return The number of threads.
+ */
+static unsigned
+gen_threads(unsigned n_threads)
+{
+  long n_cpus;
+
+  if (!n_threads) {
+    n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    n_threads = n_cpus > 0? n_cpus: 1;
+  }
+  return n_threads;
+}
+
+#endif /* HAVE_PTHREAD */
+
+/** A \c ProtobufCBuffer that writes to a \c FILE or file descriptor. */
+typedef struct _FileSink {
+  ProtobufCBuffer base;  /**< What gets passed to the generator. */
+  FILE *f;               /**< The \c FILE or \c NULL to use \c fd. */
+  int fd;                /**< The file descriptor. */
+  int err;               /**< Set to 1 once a write has failed. */
+} FileSink;
+
+/** \c ProtobufCBuffer \c append function for \c FileSink.
+ *
+ * \param[in] buffer The \c FileSink.
+ * \param[in] len Number of bytes to write.
+ * \param[in] data The bytes to write.
+ */
+static void
+file_sink_append(ProtobufCBuffer *buffer, size_t len, const uint8_t *data)
+{
+  FileSink *sink = (FileSink *)buffer;
+  ssize_t written;
+
+  if (sink->err) {
+    return;
+  }
+  if (sink->f) {
+    if (fwrite(data, 1, len, sink->f) != len) {
+      sink->err = 1;
+    }
+    return;
+  }
+  while (len) {
+    written = write(sink->fd, data, len);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      sink->err = 1;
+      return;
+    }
+    data += written;
+    len -= written;
+  }
+}
+
+/** A \c ProtobufCBuffer that only counts what is written to it. */
+typedef struct _CountSink {
+  ProtobufCBuffer base;  /**< What gets passed to the generator. */
+  size_t len;            /**< Bytes written so far. */
+} CountSink;
+
+/** \c ProtobufCBuffer \c append function for \c CountSink.
+ *
+ * \param[in] buffer The \c CountSink.
+ * \param[in] len Number of bytes written.
+ * \param[in] data The bytes written (ignored).
+ */
+static void
+count_sink_append(ProtobufCBuffer *buffer, size_t len, const uint8_t *data)
+{
+  (void)data;
+  ((CountSink *)buffer)->len += len;
+}
+
+/** Serialise a message to a sink through a staging buffer.
+ *
+ * \param[in] m The \c ProtobufCMessage to be serialised.
+ * \param[in] sink Where to send the text.
+ * \param[in] allocator allocator functions.
+ * \return Success (1) or failure (0).
+ */
+static int
+protobuf_c_text_to_sink(ProtobufCMessage *m,
+    ProtobufCBuffer *sink,
+    ProtobufCAllocator *allocator)
+{
+  char staging[RS_STAGING_SIZE];
+  ReturnString rs = { 0, sizeof(staging), 0, staging, sink, NULL, NULL, 2,
+    '\n', 0 };
+
+  protobuf_c_text_to_string_internal(&rs, 0, m, m->descriptor, allocator);
+  if (!rs.malloc_err) {
+    rs_flush(&rs);
+  }
+
+  return !rs.malloc_err;
+}
+
+/** @} */  /* End of generate group. */
+
+/** \defgroup wire Generating text straight from the wire format
+ * \ingroup internal
+ * @{
+ */
+
+/** Size of the error string for malformed wire format. */
+#define WIRE_ERROR_STR_MAX 160
+
+/** Most messages nested inside the top one; the default recursion limit
+ * of the protobuf parsers.  Deeper input is rejected rather than risk
+ * running out of stack. */
+#define WIRE_MAX_DEPTH 100
+
+/** State for rendering a packed message as text. */
+typedef struct _WireText {
+  ReturnString rs;         /**< The text so far. */
+  const uint8_t *base;     /**< Start of the input, for error offsets. */
+  int error;               /**< Set once the input turns out to be bad. */
+  char *error_str;         /**< Text of the error. */
+  ProtobufCAllocator *allocator;  /**< allocator functions. */
+  unsigned depth;          /**< Messages open inside the top one. */
+} WireText;
+
+/** A tag and value read from the wire format. */
+typedef struct _WireEntry {
+  const uint8_t *at;       /**< Where the tag starts. */
+  uint32_t id;             /**< Field number. */
+  int wire;                /**< Wire type. */
+  uint64_t v;              /**< The value for varint and fixed width
+                             wire types. */
+  const uint8_t *data;     /**< The value for \c WIRE_LENGTH . */
+  size_t len;              /**< Length of \c data . */
+} WireEntry;
+
+/** Note the input is malformed.
+ *
+ * Only the first error is kept.
+ *
+ * \param[in,out] wt The render state.
+ * \param[in] at Where in the input the problem is.
+ * \param[in] error_fmt printf style format string for the error message.
+ * \param[in] ... Arguments for \c error_fmt .
+ */
+static void wire_error(WireText *wt, const uint8_t *at,
+    const char *error_fmt, ...) __attribute__((format(printf, 3, 4)));
+static void
+wire_error(WireText *wt, const uint8_t *at, const char *error_fmt, ...)
+{
+  va_list args;
+  int error_idx;
+
+  if (wt->error) {
+    return;
+  }
+  wt->error = 1;
+  error_idx = snprintf(wt->error_str, WIRE_ERROR_STR_MAX,
+      "Error found at offset %zu.\n", (size_t)(at - wt->base));
+  if (error_idx < WIRE_ERROR_STR_MAX) {
+    va_start(args, error_fmt);
+    vsnprintf(wt->error_str + error_idx, WIRE_ERROR_STR_MAX - error_idx,
+        error_fmt, args);
+    va_end(args);
+  }
+}
+
+/** Read a varint.
+ *
+ * \param[in,out] p Where to read; moved past the varint.
+ * \param[in] end End of the input.
+ * \param[out] v The value.
+ * \return Success (1) or failure (0) if it's truncated or too long.
+ */
+static int
+wire_varint(const uint8_t **p, const uint8_t *end, uint64_t *v)
+{
+  const uint8_t *q = *p;
+  uint64_t val = 0;
+  int shift;
+
+  for (shift = 0; q < end && shift < 7 * VARINT_MAX; shift += 7) {
+    val |= (uint64_t)(*q & 0x7f) << shift;
+    if (!(*q++ & 0x80)) {
+      *p = q;
+      *v = val;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/** Read a little endian value of \c n bytes. */
+static uint64_t
+wire_fixed(const uint8_t *p, int n)
+{
+  uint64_t v = 0;
+
+  while (n--) {
+    v = (v << 8) | p[n];
+  }
+  return v;
+}
+
+/** Read the next tag and value of a message.
+ *
+ * \param[in,out] wt The render state.
+ * \param[in,out] p Where to read; moved past the value.
+ * \param[in] end End of the message.
+ * \param[out] e The tag and value.
+ * \return 1 for an entry, 0 at the end of the message or -1 if the
+ *         input is malformed.
+ */
+static int
+wire_next(WireText *wt, const uint8_t **p, const uint8_t *end,
+    WireEntry *e)
+{
+  uint64_t tag;
+
+  if (*p == end) {
+    return 0;
+  }
+  e->at = *p;
+  if (!wire_varint(p, end, &tag) || (tag >> 3) == 0
+      || (tag >> 3) > UINT32_MAX) {
+    wire_error(wt, e->at, "Bad field tag.");
+    return -1;
+  }
+  e->id = tag >> 3;
+  e->wire = tag & 7;
+  switch (e->wire) {
+    case WIRE_VARINT:
+      if (!wire_varint(p, end, &e->v)) {
+        wire_error(wt, e->at, "Bad varint for field %u.", e->id);
+        return -1;
+      }
+      return 1;
+    case WIRE_64BIT:
+    case WIRE_32BIT:
+      e->len = e->wire == WIRE_32BIT? 4: 8;
+      if ((size_t)(end - *p) < e->len) {
+        wire_error(wt, e->at, "Field %u runs past the end.", e->id);
+        return -1;
+      }
+      e->v = wire_fixed(*p, e->len);
+      *p += e->len;
+      return 1;
+    case WIRE_LENGTH:
+      if (!wire_varint(p, end, &e->v) || e->v > (uint64_t)(end - *p)) {
+        wire_error(wt, e->at, "Field %u runs past the end.", e->id);
+        return -1;
+      }
+      e->data = *p;
+      e->len = e->v;
+      *p += e->len;
+      return 1;
+    default:
+      wire_error(wt, e->at, "Unsupported wire type %d for field %u.",
+          e->wire, e->id);
+      return -1;
+  }
+}
+
+/** The wire type a field's values are encoded with.
+ *
+ * \param[in] f The field.
+ * \return The wire type, not counting packed repeated fields.
+ */
+static int
+wire_type(const ProtobufCFieldDescriptor *f)
+{
+  switch (f->type) {
+    case PROTOBUF_C_TYPE_FIXED32:
+    case PROTOBUF_C_TYPE_SFIXED32:
+    case PROTOBUF_C_TYPE_FLOAT:
+      return WIRE_32BIT;
+    case PROTOBUF_C_TYPE_FIXED64:
+    case PROTOBUF_C_TYPE_SFIXED64:
+    case PROTOBUF_C_TYPE_DOUBLE:
+      return WIRE_64BIT;
+    case PROTOBUF_C_TYPE_STRING:
+    case PROTOBUF_C_TYPE_BYTES:
+    case PROTOBUF_C_TYPE_MESSAGE:
+      return WIRE_LENGTH;
+    default:
+      return WIRE_VARINT;
+  }
+}
+
+/** Whether an entry holds packed values of a repeated scalar field. */
+#define WIRE_IS_PACKED(f, e) ((e)->wire == WIRE_LENGTH \
+    && (f)->label == PROTOBUF_C_LABEL_REPEATED \
+    && wire_type(f) != WIRE_LENGTH)
+
+/** Check an entry has the right wire type for its field.
+ *
+ * Packed values are checked too, so they can be rendered without
+ * further checks.
+ *
+ * \param[in,out] wt The render state.
+ * \param[in] f The field.
+ * \param[in] e The entry.
+ * \return Success (1) or failure (0).
+ */
+static int
+wire_check(WireText *wt, const ProtobufCFieldDescriptor *f,
+    const WireEntry *e)
+{
+  const uint8_t *p, *end;
+  uint64_t v;
+
+  if (WIRE_IS_PACKED(f, e)) {
+    if (wire_type(f) == WIRE_VARINT) {
+      p = e->data;
+      end = e->data + e->len;
+      while (p < end) {
+        if (!wire_varint(&p, end, &v)) {
+          wire_error(wt, e->at, "Bad packed varint for '%s'.", f->name);
+          return 0;
+        }
+      }
+    } else if (e->len % (wire_type(f) == WIRE_32BIT? 4: 8)) {
+      wire_error(wt, e->at, "Bad packed length for '%s'.", f->name);
+      return 0;
+    }
+    return 1;
+  }
+  if (e->wire != wire_type(f)) {
+    wire_error(wt, e->at, "Wrong wire type %d for '%s'.", e->wire, f->name);
+    return 0;
+  }
+  return 1;
+}
+
+/** Append a line for a scalar value read from the wire format.
+ *
+ * The value is converted to what the unpacked message would hold and
+ * handed to rs_append_scalar() so the text is the same.
+ *
+ * \param[in,out] wt The render state.
+ * \param[in] level Indent level.
+ * \param[in] f The field.
+ * \param[in] v The raw value.
+ */
+static void
+wire_append_scalar(WireText *wt, int level,
+    const ProtobufCFieldDescriptor *f, uint64_t v)
+{
+  union {
+    uint32_t u32;
+    int32_t i32;
+    uint64_t u64;
+    int64_t i64;
+    float f;
+    double d;
+    protobuf_c_boolean b;
+    int e;
+  } value;
+  uint32_t u32;
+
+  switch (f->type) {
+    case PROTOBUF_C_TYPE_INT32:
+    case PROTOBUF_C_TYPE_UINT32:
+    case PROTOBUF_C_TYPE_FIXED32:
+      value.u32 = v;
+      break;
+    case PROTOBUF_C_TYPE_SFIXED32:
+      value.i32 = (int32_t)(uint32_t)v;
+      break;
+    case PROTOBUF_C_TYPE_SINT32:
+      u32 = v;
+      value.i32 = (int32_t)(u32 >> 1) ^ -(int32_t)(u32 & 1);
+      break;
+    case PROTOBUF_C_TYPE_SINT64:
+      value.i64 = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+      break;
+    case PROTOBUF_C_TYPE_FLOAT:
+      u32 = v;
+      memcpy(&value.f, &u32, sizeof(value.f));
+      break;
+    case PROTOBUF_C_TYPE_DOUBLE:
+      memcpy(&value.d, &v, sizeof(value.d));
+      break;
+    case PROTOBUF_C_TYPE_BOOL:
+      value.b = v != 0;
+      break;
+    case PROTOBUF_C_TYPE_ENUM:
+      value.e = (int32_t)(uint32_t)v;
+      break;
+    default:
+      value.u64 = v;
+      break;
+  }
+  rs_append_scalar(&wt->rs, level, f, &value, 0, wt->allocator);
+}
+
+static void wire_append_message(WireText *wt, int level,
+    const ProtobufCMessageDescriptor *d, const uint8_t *data, size_t len);
+
+/** Append the text for one entry of a field.
+ *
+ * \param[in,out] wt The render state.
+ * \param[in] level Indent level.
+ * \param[in] f The field.
+ * \param[in] e The entry, already checked by wire_check().
+ */
+static void
+wire_append_entry(WireText *wt, int level,
+    const ProtobufCFieldDescriptor *f, const WireEntry *e)
+{
+  const uint8_t *p, *end, *nul;
+  uint64_t v;
+  int n;
+
+  switch (f->type) {
+    case PROTOBUF_C_TYPE_STRING:
+      /* An unpacked string is a C string, so it would end at a NUL. */
+      nul = memchr(e->data, '\0', e->len);
+      rs_append_escaped(&wt->rs, level, f->name, e->data,
+          nul? (size_t)(nul - e->data): e->len, wt->allocator);
+      return;
+    case PROTOBUF_C_TYPE_BYTES:
+      rs_append_escaped(&wt->rs, level, f->name, e->data, e->len,
+          wt->allocator);
+      return;
+    case PROTOBUF_C_TYPE_MESSAGE:
+      if (wt->depth == WIRE_MAX_DEPTH) {
+        wire_error(wt, e->at, "Messages nested more than %d deep.",
+            WIRE_MAX_DEPTH);
+        return;
+      }
+      rs_append_open(&wt->rs, level, f->name, wt->allocator);
+      wt->depth++;
+      wire_append_message(wt, level + wt->rs.indent,
+          (const ProtobufCMessageDescriptor *)f->descriptor,
+          e->data, e->len);
+      wt->depth--;
+      rs_append_close(&wt->rs, level, wt->allocator);
+      return;
+    default:
+      break;
+  }
+  if (!WIRE_IS_PACKED(f, e)) {
+    wire_append_scalar(wt, level, f, e->v);
+    return;
+  }
+  p = e->data;
+  end = e->data + e->len;
+  n = wire_type(f) == WIRE_32BIT? 4: 8;
+  while (p < end && !wt->rs.malloc_err) {
+    if (wire_type(f) == WIRE_VARINT) {
+      if (!wire_varint(&p, end, &v)) {
+        /* wire_check() has been through these already. */
+        wire_error(wt, e->at, "Bad packed varint for '%s'.", f->name);
+        return;
+      }
+    } else {
+      v = wire_fixed(p, n);
+      p += n;
+    }
+    wire_append_scalar(wt, level, f, v);
+  }
+}
+
+/** Append the text for a message in the wire format.
+ *
+ * Fields are written in descriptor order as the generator does.  A
+ * first pass checks the input and whether its fields are already in
+ * that order, which is how protobuf-c packs them.  If they are each
+ * field's entries are found by walking forward through the message
+ * once; if not the message is walked once per field.  As unpacking
+ * would, the last entry of a non-repeated field wins and unknown
+ * fields are skipped.
+ *
+ * \param[in,out] wt The render state.
+ * \param[in] level Indent level.
+ * \param[in] d The message descriptor.
+ * \param[in] data The packed message.
+ * \param[in] len Length of \c data .
+ */
+static void
+wire_append_message(WireText *wt, int level,
+    const ProtobufCMessageDescriptor *d, const uint8_t *data, size_t len)
+{
+  const uint8_t *p, *q, *end = data + len, *cursor = data;
+  const ProtobufCFieldDescriptor *f, *last = NULL;
+  WireEntry e, found;
+  int rv, sorted = 1, have;
+  unsigned i;
+
+  p = data;
+  while ((rv = wire_next(wt, &p, end, &e)) > 0) {
+    f = protobuf_c_message_descriptor_get_field(d, e.id);
+    if (!f) {
+      continue;
+    }
+    if (!wire_check(wt, f, &e)) {
+      return;
+    }
+    if (last && f < last) {
+      sorted = 0;
+    }
+    last = f;
+  }
+  if (rv < 0) {
+    return;
+  }
+
+  for (i = 0; i < d->n_fields; i++) {
+    f = &d->fields[i];
+    have = 0;
+    p = sorted? cursor: data;
+    while (!wt->error && !wt->rs.malloc_err) {
+      q = p;
+      if (wire_next(wt, &p, end, &e) <= 0) {
+        break;
+      }
+      if (e.id != f->id) {
+        if (sorted && protobuf_c_message_descriptor_get_field(d, e.id)) {
+          /* Later field; this one is done. */
+          p = q;
+          break;
+        }
+        continue;
+      }
+      if (f->label == PROTOBUF_C_LABEL_REPEATED) {
+        wire_append_entry(wt, level, f, &e);
+      } else {
+        found = e;
+      }
+      have = 1;
+    }
+    cursor = p;
+    if (wt->error || wt->rs.malloc_err) {
+      return;
+    }
+    if (have && f->label != PROTOBUF_C_LABEL_REPEATED) {
+      wire_append_entry(wt, level, f, &found);
+    } else if (!have && f->label == PROTOBUF_C_LABEL_REQUIRED) {
+      wire_error(wt, data, "Message '%s' is missing required field '%s'.",
+          d->name, f->name);
+      return;
+    }
+  }
+}
+
+/** @} */  /* End of wire group. */
+
+/* See .h file for API docs. */
+
+char *
+protobuf_c_text_to_string(ProtobufCMessage *m,
+    ProtobufCAllocator *allocator)
+{
+  return protobuf_c_text_to_string_sized(m, 0, allocator);
+}
+
+size_t
+protobuf_c_text_get_string_size(ProtobufCMessage *m,
+    ProtobufCAllocator *allocator)
+{
+  CountSink sink = { { count_sink_append }, 0 };
+
+  if (!protobuf_c_text_to_sink(m, &sink.base, allocator)
+      || sink.len >= INT_MAX) {
+    return 0;
+  }
+  return sink.len;
+}
+
+char *
+protobuf_c_text_to_string_sized(ProtobufCMessage *m,
+    size_t size,
+    ProtobufCAllocator *allocator)
+{
+  ReturnString rs = { 0, 0, 0, NULL, NULL, NULL, NULL, 2, '\n', 0 };
+
+  if (size >= INT_MAX) {
+    /* A ReturnString can't hold that much. */
+    return NULL;
+  }
+  if (size) {
+    rs.s = PBC_ALLOC(size + 1);
+    if (!rs.s) {
+      return NULL;
+    }
+    rs.allocated = size + 1;
+  }
+  protobuf_c_text_to_string_internal(&rs, 0, m, m->descriptor, allocator);
+  if (rs.s && !rs.pos) {
+    /* Empty message - return NULL as if nothing had been allocated. */
+    PBC_FREE(rs.s);
+    rs.s = NULL;
+  }
+
+  return rs.s;
+}
+
+char *
+protobuf_c_text_to_string_ex(ProtobufCMessage *m,
+    const ProtobufCTextGenerateOptions *options,
+    ProtobufCAllocator *allocator)
+{
+  ReturnString rs = { 0, 0, 0, NULL, NULL, NULL, NULL, 2, '\n', 0 };
+
+  if (options && options->compact) {
+    rs.indent = 0;
+    rs.eol = ' ';
+  } else if (options) {
+    if (options->indent > PROTOBUF_C_TEXT_MAX_INDENT) {
+      return NULL;
+    }
+    rs.indent = options->indent;
+  }
+  protobuf_c_text_to_string_internal(&rs, 0, m, m->descriptor, allocator);
+  if (rs.s && !rs.pos) {
+    PBC_FREE(rs.s);
+    rs.s = NULL;
+  } else if (rs.s && rs.eol == ' ') {
+    /* Drop the space after the last field. */
+    rs.s[--rs.pos] = '\0';
+  }
+
+  return rs.s;
+}
+
+char *
+protobuf_c_text_to_string_stats(ProtobufCMessage *m,
+    ProtobufCAllocator *allocator,
+    ProtobufCTextStats *stats)
+{
+  ReturnString rs = { 0, 0, 0, NULL, NULL, NULL, stats, 2, '\n', 0 };
+  StatsAllocator sa;
+  double start;
+
+  allocator = protobuf_c_text__stats_start(&sa, allocator, stats);
+  start = protobuf_c_text__stats_now();
+  protobuf_c_text_to_string_internal(&rs, 0, m, m->descriptor, allocator);
+  if (rs.s && !rs.pos) {
+    PBC_FREE(rs.s);
+    rs.s = NULL;
+  }
+  stats->bytes = rs.s? rs.pos: 0;
+  stats->build_seconds = protobuf_c_text__stats_now() - start;
+
+  return rs.s;
+}
+
+int
+protobuf_c_text_to_buffer(ProtobufCMessage *m,
+    ProtobufCBuffer *buffer,
+    ProtobufCAllocator *allocator)
+{
+  return protobuf_c_text_to_sink(m, buffer, allocator);
+}
+
+int
+protobuf_c_text_to_file(ProtobufCMessage *m,
+    FILE *msg_file,
+    ProtobufCAllocator *allocator)
+{
+  FileSink sink = { { file_sink_append }, msg_file, -1, 0 };
+
+  return protobuf_c_text_to_sink(m, &sink.base, allocator) && !sink.err;
+}
+
+int
+protobuf_c_text_to_fd(ProtobufCMessage *m,
+    int fd,
+    ProtobufCAllocator *allocator)
+{
+  FileSink sink = { { file_sink_append }, NULL, fd, 0 };
+
+  return protobuf_c_text_to_sink(m, &sink.base, allocator) && !sink.err;
+}
+
+char *
+protobuf_c_text_from_packed_to_string(
+    const ProtobufCMessageDescriptor *descriptor,
+    const uint8_t *data,
+    size_t len,
+    ProtobufCTextError *result,
+    ProtobufCAllocator *allocator)
+{
+  WireText wt = { { 0, 0, 0, NULL, NULL, NULL, NULL, 2, '\n', 0 }, data, 0,
+    NULL, allocator, 0 };
+
+  result->error_txt = NULL;
+  result->complete = -1;
+  wt.error_str = PBC_ALLOC(WIRE_ERROR_STR_MAX);
+  if (!wt.error_str) {
+    return NULL;
+  }
+  wire_append_message(&wt, 0, descriptor, data, len);
+  if (wt.error || wt.rs.malloc_err) {
+    if (wt.rs.s) {
+      PBC_FREE(wt.rs.s);
+    }
+    if (wt.error) {
+      result->error_txt = wt.error_str;
+    } else {
+      snprintf(wt.error_str, WIRE_ERROR_STR_MAX, "Malloc failure.");
+      result->error_txt = wt.error_str;
+    }
+    return NULL;
+  }
+  PBC_FREE(wt.error_str);
+  result->complete = 1;
+  if (wt.rs.s && !wt.rs.pos) {
+    PBC_FREE(wt.rs.s);
+    wt.rs.s = NULL;
+  }
+  return wt.rs.s;
+}
+
+char *
+protobuf_c_text_to_string_parallel(ProtobufCMessage *m,
+    unsigned n_threads,
+    ProtobufCAllocator *allocator)
+{
+#ifdef HAVE_PTHREAD
+  GenSplit split;
+  size_t i, len = 0;
+  char *s, *p;
+
+  n_threads = gen_threads(n_threads);
+  if (n_threads > 1) {
+    if (!gen_parallel(m, n_threads, &split, allocator)) {
+      return NULL;
+    }
+    for (i = 0; i < split.n_pieces; i++) {
+      len += split.pieces[i].len;
+    }
+    s = len? PBC_ALLOC(len + 1): NULL;
+    if (s) {
+      p = s;
+      for (i = 0; i < split.n_pieces; i++) {
+        if (split.pieces[i].len) {
+          memcpy(p, split.pieces[i].s, split.pieces[i].len);
+          p += split.pieces[i].len;
+        }
+      }
+      *p = '\0';
+    }
+    gen_free(&split);
+    return s;
+  }
+#endif
+  return protobuf_c_text_to_string(m, allocator);
+}
+
+int
+protobuf_c_text_to_buffer_parallel(ProtobufCMessage *m,
+    ProtobufCBuffer *buffer,
+    unsigned n_threads,
+    ProtobufCAllocator *allocator)
+{
+#ifdef HAVE_PTHREAD
+  GenSplit split;
+  size_t i;
+
+  n_threads = gen_threads(n_threads);
+  if (n_threads > 1) {
+    if (!gen_parallel(m, n_threads, &split, allocator)) {
+      return 0;
+    }
+    for (i = 0; i < split.n_pieces; i++) {
+      if (split.pieces[i].len) {
+        buffer->append(buffer, split.pieces[i].len,
+            (uint8_t *)split.pieces[i].s);
+      }
+    }
+    gen_free(&split);
+    return 1;
+  }
+#endif
+  return protobuf_c_text_to_buffer(m, buffer, allocator);
+}
+
+int
+protobuf_c_text_to_fd_parallel(ProtobufCMessage *m,
+    int fd,
+    unsigned n_threads,
+    ProtobufCAllocator *allocator)
+{
+#ifdef HAVE_PTHREAD
+  GenSplit split;
+  struct iovec iov[PARALLEL_IOV_MAX];
+  size_t i = 0, k, off = 0, left;
+  ssize_t written;
+  int n_iov, ok = 1;
+
+  n_threads = gen_threads(n_threads);
+  if (n_threads > 1) {
+    if (!gen_parallel(m, n_threads, &split, allocator)) {
+      return 0;
+    }
+    /* Write the pieces straight from where they were generated. */
+    while (i < split.n_pieces) {
+      n_iov = 0;
+      for (k = i; k < split.n_pieces && n_iov < PARALLEL_IOV_MAX; k++) {
+        left = split.pieces[k].len - (k == i? off: 0);
+        if (left) {
+          iov[n_iov].iov_base = split.pieces[k].s + (k == i? off: 0);
+          iov[n_iov++].iov_len = left;
+        }
+      }
+      if (!n_iov) {
+        break;
+      }
+      written = writev(fd, iov, n_iov);
+      if (written < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        ok = 0;
+        break;
+      }
+      for (; i < split.n_pieces; i++, off = 0) {
+        left = split.pieces[i].len - off;
+        if ((size_t)written < left) {
+          off += written;
+          break;
+        }
+        written -= left;
+      }
+    }
+    gen_free(&split);
+    return ok;
+  }
+#endif
+  return protobuf_c_text_to_fd(m, fd, allocator);
 }
@@ -130,6 +130,97 @@ typedef struct _ProtobufCTextError {
                          - >0: Message has all required fields set. */
 } ProtobufCTextError;
 
+/** Kinds of token counted in \c ProtobufCTextStats . */
+typedef enum {
+  PROTOBUF_C_TEXT_TOKEN_BAREWORD,  /**< Field names and enum values. */
+  PROTOBUF_C_TEXT_TOKEN_OBRACE,    /**< Opening braces. */
+  PROTOBUF_C_TEXT_TOKEN_CBRACE,    /**< Closing braces. */
+  PROTOBUF_C_TEXT_TOKEN_COLON,     /**< Colons. */
+  PROTOBUF_C_TEXT_TOKEN_QUOTED,    /**< Quoted strings. */
+  PROTOBUF_C_TEXT_TOKEN_NUMBER,    /**< Numbers. */
+  PROTOBUF_C_TEXT_TOKEN_BOOLEAN,   /**< Unquoted \c true and \c false. */
+  PROTOBUF_C_TEXT_TOKEN_TYPES      /**< Number of kinds of token. */
+} ProtobufCTextTokenType;
+
+/** Statistics on one parse or generate call.
+ *
+ * Filled in by the \c ..._stats() functions, which zero it first.
+ * Gathering them costs a couple of clock reads per token, so only ask
+ * for them when you want them.
+ */
+typedef struct _ProtobufCTextStats {
+  size_t bytes;        /**< Text consumed by a parse, or produced by a
+                            generate. */
+  size_t tokens[PROTOBUF_C_TEXT_TOKEN_TYPES];  /**< Tokens lexed, by
+                            \c ProtobufCTextTokenType .  Parsing
+                            only. */
+  size_t fills;        /**< Times the lexer ran out of buffered input
+                            and asked for more.  Parsing only. */
+  size_t allocs;       /**< Calls made to the allocator. */
+  size_t alloc_bytes;  /**< Bytes asked of the allocator. */
+  unsigned max_depth;  /**< Most messages open at once; 1 for a message
+                            with no message fields set. */
+  size_t max_repeated; /**< Most elements in any one repeated field. */
+  double lex_seconds;  /**< Wall time spent lexing.  Parsing only. */
+  double build_seconds;  /**< Wall time spent building the message
+                              from tokens, or the text from the
+                              message. */
+} ProtobufCTextStats;
+
+/** Smallest \c read_size in \c ProtobufCTextParseOptions . */
+#define PROTOBUF_C_TEXT_READ_SIZE_MIN (64 * 1024)
+
+/** Largest \c read_size in \c ProtobufCTextParseOptions . */
+#define PROTOBUF_C_TEXT_READ_SIZE_MAX (1024 * 1024)
+
+/** Limits on a parse, and how its input is read.
+ *
+ * For parsing untrusted input with bounded time and memory.  A limit
+ * of 0 means no limit, so a zeroed struct parses as
+ * protobuf_c_text_from_buffer() does.  Each limit fails the parse with
+ * its own error as soon as it is hit.
+ *
+ * They are passed to the \c _ex parsing functions, or set on a reader,
+ * push parser or context with its \c set_options function, in which
+ * case they apply to each record or parse on its own.
+ */
+typedef struct _ProtobufCTextParseOptions {
+  size_t max_bytes;    /**< Most bytes of input.  A longer buffer is
+                            rejected before any of it is parsed. */
+  unsigned max_depth;  /**< Most messages open at once, counting the
+                            top level one. */
+  size_t max_alloc;    /**< Most bytes to request from the allocator
+                            over the whole parse, error text
+                            included. */
+  size_t max_repeated; /**< Most elements in any one repeated field. */
+  size_t max_string;   /**< Longest string or bytes value, once
+                            unescaped. */
+  size_t read_size;    /**< Bytes to read from a \c FILE , file
+                            descriptor or reader's input at a time; 0
+                            for the default.  It is brought within
+                            \c PROTOBUF_C_TEXT_READ_SIZE_MIN and
+                            \c PROTOBUF_C_TEXT_READ_SIZE_MAX . */
+} ProtobufCTextParseOptions;
+
+/** Most spaces \c ProtobufCTextGenerateOptions can indent a level by. */
+#define PROTOBUF_C_TEXT_MAX_INDENT 64
+
+/** How to lay out generated text.
+ *
+ * Without options text is laid out a field per line, indented two
+ * spaces for each level of nesting.  Only protobuf_c_text_to_string_ex()
+ * takes options; the functions that write to a \c ProtobufCBuffer , a
+ * \c FILE or a file descriptor always use that layout.
+ */
+typedef struct _ProtobufCTextGenerateOptions {
+  int compact;      /**< If set, put it all on one line with a space
+                         between fields, as in \c "a: 1 b { c: 2 }".
+                         \c indent is ignored. */
+  unsigned indent;  /**< Spaces to indent each level of nesting by; 0
+                         for none and at most
+                         \c PROTOBUF_C_TEXT_MAX_INDENT . */
+} ProtobufCTextGenerateOptions;
+
 /** Convert a \c ProtobufCMessage to a string.
  *
  * Given a \c ProtobufCMessage serialise it as a text format protobuf.
@@ -152,6 +243,338 @@ typedef struct _ProtobufCTextError {
 extern char *protobuf_c_text_to_string(ProtobufCMessage *m,
     ProtobufCAllocator *allocator);
 
+/** Work out the length of the text format of a \c ProtobufCMessage.
+ *
+ * This is not a shortcut: it runs the whole generator, formatting every
+ * field into a small fixed buffer and throwing the text away, so it
+ * costs about as much as protobuf_c_text_to_string().  Measuring and
+ * then calling protobuf_c_text_to_string_sized() takes roughly twice
+ * the CPU time of a plain protobuf_c_text_to_string(); it's only worth
+ * it where one exactly sized allocation matters more, such as with an
+ * arena or a size limit.
+ *
+ * \param[in] m The \c ProtobufCMessage to be measured.
+ * \param[in] allocator This is the same \c ProtobufCAllocator type used
+ *                      by the \c libprotobuf-c library.  You can set it
+ *                      to \c NULL to accept \c protobuf_c_default_allocator -
+ *                      the default allocator.
+ * \return The number of chars protobuf_c_text_to_string() would return,
+ *         not counting the trailing \c NUL.  It is 0 for a message with
+ *         no fields set, on an allocation failure, or if the text is
+ *         \c INT_MAX chars or more, too long for a string to be built.
+ */
+extern size_t protobuf_c_text_get_string_size(ProtobufCMessage *m,
+    ProtobufCAllocator *allocator);
+
+/** Convert a \c ProtobufCMessage to a string of a known size.
+ *
+ * As protobuf_c_text_to_string() but the string starts out with room
+ * for \c size chars.  With the size from
+ * protobuf_c_text_get_string_size() the string is allocated exactly
+ * once; if \c size is too small the string grows as it normally would.
+ * protobuf_c_text_to_string() is this with a \c size of 0, where the
+ * string doubles in size each time it runs out of room.
+ *
+ * \param[in] m The \c ProtobufCMessage to be serialised.
+ * \param[in] size Expected length of the text, not counting the
+ *                 trailing \c NUL.  Must be less than \c INT_MAX .
+ * \param[in] allocator This is the same \c ProtobufCAllocator type used
+ *                      by the \c libprotobuf-c library.  You can set it
+ *                      to \c NULL to accept \c protobuf_c_default_allocator -
+ *                      the default allocator.
+ * \return See protobuf_c_text_to_string().  It is also \c NULL if
+ *         \c size is too large.
+ */
+extern char *protobuf_c_text_to_string_sized(ProtobufCMessage *m,
+    size_t size,
+    ProtobufCAllocator *allocator);
+
+/** Convert a \c ProtobufCMessage to a string laid out as asked.
+ *
+ * As protobuf_c_text_to_string() but \c options says how to lay the
+ * text out.  Compact text has no newlines and the least whitespace the
+ * text format allows, which can halve the size of deeply nested
+ * messages.  Any layout parses back to the same message.
+ *
+ * \param[in] m The \c ProtobufCMessage to be serialised.
+ * \param[in] options The layout, or \c NULL for the usual one.
+ * \param[in] allocator This is the same \c ProtobufCAllocator type used
+ *                      by the \c libprotobuf-c library.  You can set it
+ *                      to \c NULL to accept \c protobuf_c_default_allocator -
+ *                      the default allocator.
+ * \return See protobuf_c_text_to_string().  It is also \c NULL if
+ *         \c options->indent is more than \c PROTOBUF_C_TEXT_MAX_INDENT .
+ */
+extern char *protobuf_c_text_to_string_ex(ProtobufCMessage *m,
+    const ProtobufCTextGenerateOptions *options,
+    ProtobufCAllocator *allocator);
+
+/** Convert a \c ProtobufCMessage to a string and report how it went.
+ *
+ * As protobuf_c_text_to_string() but \c stats is filled in as well.
+ *
+ * \param[in] m The \c ProtobufCMessage to be serialised.
+ * \param[in] allocator This is the same \c ProtobufCAllocator type used
+ *                      by the \c libprotobuf-c library.  You can set it
+ *                      to \c NULL to accept \c protobuf_c_default_allocator -
+ *                      the default allocator.
+ * \param[out] stats Where to put the statistics.  They are filled in
+ *                   whether or not generation succeeds.
+ * \return See protobuf_c_text_to_string().
+ */
+extern char *protobuf_c_text_to_string_stats(ProtobufCMessage *m,
+    ProtobufCAllocator *allocator,
+    ProtobufCTextStats *stats);
+
+/** Write a \c ProtobufCMessage as text to a \c ProtobufCBuffer.
+ *
+ * Like protobuf_c_text_to_string() but rather than building up the
+ * whole string in memory the text is passed to \c buffer in chunks of
+ * up to 4 KiB as it is generated.  Memory use does not grow with the
+ * size of the message, only with the size of its largest \c string or
+ * \c bytes field.
+ *
+ * \param[in] m The \c ProtobufCMessage to be serialised.
+ * \param[in] buffer Where to send the text.  This is the same
+ *                   \c ProtobufCBuffer type used by
+ *                   \c protobuf_c_message_pack_to_buffer().
+ * \param[in] allocator This is the same \c ProtobufCAllocator type used
+ *                      by the \c libprotobuf-c library.  You can set it
+ *                      to \c NULL to accept \c protobuf_c_default_allocator -
+ *                      the default allocator.
+ * \return 1 on success.  On failure it will return 0; anything already
+ *         passed to \c buffer is not taken back.
+ */
+extern int protobuf_c_text_to_buffer(ProtobufCMessage *m,
+    ProtobufCBuffer *buffer,
+    ProtobufCAllocator *allocator);
+
+/** Write a \c ProtobufCMessage as text to a \c FILE.
+ *
+ * See protobuf_c_text_to_buffer().  The \c FILE is not flushed.
+ *
+ * \param[in] m The \c ProtobufCMessage to be serialised.
+ * \param[in] msg_file The \c FILE to write the text format protobuf to.
+ * \param[in] allocator This is the same \c ProtobufCAllocator type used
+ *                      by the \c libprotobuf-c library.  You can set it
+ *                      to \c NULL to accept \c protobuf_c_default_allocator -
+ *                      the default allocator.
+ * \return 1 on success or 0 on a write or allocation failure.
+ */
+extern int protobuf_c_text_to_file(ProtobufCMessage *m,
+    FILE *msg_file,
+    ProtobufCAllocator *allocator);
+
+/** Write a \c ProtobufCMessage as text to a file descriptor.
+ *
+ * See protobuf_c_text_to_buffer().  Writes are retried on \c EINTR and
+ * short writes.  The descriptor is not closed.
+ *
+ * \param[in] m The \c ProtobufCMessage to be serialised.
+ * \param[in] fd The open file descriptor to write the text format
+ *               protobuf to.
+ * \param[in] allocator This is the same \c ProtobufCAllocator type used
+ *                      by the \c libprotobuf-c library.  You can set it
+ *                      to \c NULL to accept \c protobuf_c_default_allocator -
+ *                      the default allocator.
+ * \return 1 on success or 0 on a write or allocation failure.
+ */
+extern int protobuf_c_text_to_fd(ProtobufCMessage *m,
+    int fd,
+    ProtobufCAllocator *allocator);
+
+/** Convert a \c ProtobufCMessage to a string using several threads.
+ *
+ * Meant for messages with large repeated message fields, like a table
+ * with millions of entries.  Such fields are cut into slices which are
+ * generated on a pool of threads, each into its own piece of text, and
+ * the pieces are joined in order.  The string is the same as
+ * protobuf_c_text_to_string() returns.  Repeated message fields with
+ * fewer than a few hundred elements are generated in line.
+ *
+ * \c allocator is called from all the threads at once, so it must be
+ * thread safe.  The default allocator is; an arena is not.
+ *
+ * \param[in] m The \c ProtobufCMessage to be serialised.
+ * \param[in] n_threads The most threads to use, counting the calling
+ *                      thread, or 0 for one per online CPU.
+ * \param[in] allocator This is the same \c ProtobufCAllocator type used
+ *                      by the \c libprotobuf-c library.  You can set it
+ *                      to \c NULL to accept \c protobuf_c_default_allocator -
+ *                      the default allocator.
+ * \return \c NULL on error, otherwise a string with the text format
+ *         protobuf, as protobuf_c_text_to_string().
+ */
+extern char *protobuf_c_text_to_string_parallel(ProtobufCMessage *m,
+    unsigned n_threads,
+    ProtobufCAllocator *allocator);
+
+/** Write a \c ProtobufCMessage as text to a \c ProtobufCBuffer using
+ * several threads.
+ *
+ * As protobuf_c_text_to_string_parallel() but each piece of text is
+ * passed to \c buffer in order rather than being joined.  Unlike
+ * protobuf_c_text_to_buffer() all the text is held in memory until it
+ * has been passed on.
+ *
+ * \param[in] m The \c ProtobufCMessage to be serialised.
+ * \param[in] buffer Where to send the text.
+ * \param[in] n_threads The most threads to use, counting the calling
+ *                      thread, or 0 for one per online CPU.
+ * \param[in] allocator A thread safe \c ProtobufCAllocator , or \c NULL
+ *                      for the default allocator.
+ * \return 1 on success.  On failure it will return 0 and nothing is
+ *         passed to \c buffer .
+ */
+extern int protobuf_c_text_to_buffer_parallel(ProtobufCMessage *m,
+    ProtobufCBuffer *buffer,
+    unsigned n_threads,
+    ProtobufCAllocator *allocator);
+
+/** Write a \c ProtobufCMessage as text to a file descriptor using
+ * several threads.
+ *
+ * As protobuf_c_text_to_string_parallel() but the pieces of text are
+ * written to \c fd in order with \c writev() rather than being joined.
+ * The descriptor is not closed.
+ *
+ * \param[in] m The \c ProtobufCMessage to be serialised.
+ * \param[in] fd The file descriptor to write to.
+ * \param[in] n_threads The most threads to use, counting the calling
+ *                      thread, or 0 for one per online CPU.
+ * \param[in] allocator A thread safe \c ProtobufCAllocator , or \c NULL
+ *                      for the default allocator.
+ * \return 1 on success.  On failure it will return 0; anything already
+ *         written is not taken back.
+ */
+extern int protobuf_c_text_to_fd_parallel(ProtobufCMessage *m,
+    int fd,
+    unsigned n_threads,
+    ProtobufCAllocator *allocator);
+
+/** Convert a binary protobuf straight to a text format string.
+ *
+ * Gives the string protobuf_c_text_to_string() would for the message
+ * \c protobuf_c_message_unpack() returns, but reads the wire format
+ * directly so no message is unpacked.  Unknown fields are skipped.
+ * Should a non-repeated field appear more than once the last one is
+ * used; for a message field that differs from unpacking, which merges
+ * them.  Messages nested more than 100 deep are an error.
+ *
+ * \param[in] descriptor The descriptor from the generated code.
+ * \param[in] data The binary protobuf.
+ * \param[in] len The length of \c data .
+ * \param[out] result This structure contains information on any error
+ *                    that halted processing.
+ * \param[in] allocator This is the same \c ProtobufCAllocator type used
+ *                      by the \c libprotobuf-c library.  You can set it
+ *                      to \c NULL to accept \c protobuf_c_default_allocator -
+ *                      the default allocator.
+ * \return \c NULL on error, when \c result->error_txt says why, or for a
+ *         message with nothing to print.  Otherwise a string with the
+ *         text format protobuf, as protobuf_c_text_to_string().
+ */
+extern char *protobuf_c_text_from_packed_to_string(
+    const ProtobufCMessageDescriptor *descriptor,
+    const uint8_t *data,
+    size_t len,
+    ProtobufCTextError *result,
+    ProtobufCAllocator *allocator);
+
+/** Longest string protobuf_c_text_format_int64() or
+ * protobuf_c_text_format_uint64() write. */
+#define PROTOBUF_C_TEXT_INT_MAX 20
+
+/** Format an unsigned integer as it appears in a text format protobuf.
+ *
+ * This is used by protobuf_c_text_to_string() and by code generated by
+ * \c protoc-gen-c-text.
+ *
+ * \param[in] value The value to format.
+ * \param[out] buf Where to write it.  It must have room for
+ *                 \c PROTOBUF_C_TEXT_INT_MAX chars.  No \c NUL is
+ *                 written.
+ * \return The number of chars written.
+ */
+extern size_t protobuf_c_text_format_uint64(uint64_t value, char *buf);
+
+/** Format a signed integer as it appears in a text format protobuf.
+ *
+ * As protobuf_c_text_format_uint64() but negative values get a leading
+ * \c - .
+ *
+ * \param[in] value The value to format.
+ * \param[out] buf Where to write it.  It must have room for
+ *                 \c PROTOBUF_C_TEXT_INT_MAX chars.  No \c NUL is
+ *                 written.
+ * \return The number of chars written.
+ */
+extern size_t protobuf_c_text_format_int64(int64_t value, char *buf);
+
+/** Longest string protobuf_c_text_format_double() or
+ * protobuf_c_text_format_float() write. */
+#define PROTOBUF_C_TEXT_REAL_MAX 32
+
+/** Format a \c double as it appears in a text format protobuf.
+ *
+ * The digits read back as the same \c double and are usually the
+ * shortest that do (Grisu2 - in rare cases one digit longer).  They are
+ * laid out as \c "%.15g" would, or \c "%.17g" if more than 15 digits
+ * are needed, which matches \c protoc .  Infinities and NaNs are
+ * written as \c inf , \c -inf and \c nan .
+ *
+ * This is used by protobuf_c_text_to_string() and by code generated by
+ * \c protoc-gen-c-text.
+ *
+ * \param[in] value The value to format.
+ * \param[out] buf Where to write it.  It must have room for
+ *                 \c PROTOBUF_C_TEXT_REAL_MAX chars.  No \c NUL is
+ *                 written.
+ * \return The number of chars written.
+ */
+extern size_t protobuf_c_text_format_double(double value, char *buf);
+
+/** Format a \c float as it appears in a text format protobuf.
+ *
+ * As protobuf_c_text_format_double() but the digits read back as the
+ * same \c float and are laid out as \c "%.6g" or \c "%.9g" would.
+ *
+ * \param[in] value The value to format.
+ * \param[out] buf Where to write it.  It must have room for
+ *                 \c PROTOBUF_C_TEXT_REAL_MAX chars.  No \c NUL is
+ *                 written.
+ * \return The number of chars written.
+ */
+extern size_t protobuf_c_text_format_float(float value, char *buf);
+
+/** Work out the length of a \c string or \c bytes value once escaped.
+ *
+ * \param[in] src The unescaped value.
+ * \param[in] len Length of \c src.
+ * \return The number of chars protobuf_c_text_escape() writes for it.
+ */
+extern size_t protobuf_c_text_escaped_size(const void *src, size_t len);
+
+/** Escape a \c string or \c bytes value as it appears in a text format
+ * protobuf.
+ *
+ * Printable ASCII is copied as is.  Quotes, backslashes, newlines,
+ * carriage returns and tabs are backslash escaped and every other byte
+ * is written as a 3 digit octal escape.  The surrounding quotes are not
+ * written.
+ *
+ * This is used by protobuf_c_text_to_string() and by code generated by
+ * \c protoc-gen-c-text.
+ *
+ * \param[in] src The unescaped value.
+ * \param[in] len Length of \c src.  It can contain \c NULs.
+ * \param[out] dst Where to write the escaped value.  It must have room
+ *                 for protobuf_c_text_escaped_size() chars, which is at
+ *                 most \c len * 4.  No \c NUL is written.
+ * \return The number of chars written.
+ */
+extern size_t protobuf_c_text_escape(const void *src, size_t len, char *dst);
+
 /** Import a text format protobuf from a string into a \c ProtobufCMessage.
  *
  * Given a string containing a text format protobuf, parse it and return
@@ -208,6 +631,755 @@ extern ProtobufCMessage *protobuf_c_text_from_file(
     ProtobufCTextError *result,
     ProtobufCAllocator *allocator);
 
+/** Import a text format protobuf from a memory buffer into a
+ * \c ProtobufCMessage.
+ *
+ * Like protobuf_c_text_from_string() but the input is given as a
+ * pointer and a length.  The buffer is lexed in place: it is never
+ * modified, it need not be \c NUL terminated and it may be a slice of
+ * a larger buffer.  Only the last few bytes of it are ever copied.
+ *
+ * The resulting \c ProtobufCMessage should be freed with
+ * \c protobuf_c_message_free_unpacked() or the generated
+ * \c ..._free_upacked() function. It does not reference \c buf.
+ *
+ * \param[in] descriptor The descriptor from the generated code.
+ * \param[in] buf The buffer containing the text format protobuf.
+ * \param[in] len The number of bytes in \c buf to parse.
+ * \param[out] result This structure contains information on any error
+ *                    that halted processing.
+ * \param[in] allocator This is the same \c ProtobufCAllocator type used
+ *                      by the \c libprotobuf-c library.  You can set it
+ *                      to \c NULL to accept \c protobuf_c_default_allocator -
+ *                      the default allocator.
+ * \return The resulting \c ProtobufCMessage . It returns \c NULL on error.
+ *         Check \c result->complete to make sure the message is valid.
+ */
+extern ProtobufCMessage *protobuf_c_text_from_buffer(
+    const ProtobufCMessageDescriptor *descriptor,
+    const void *buf,
+    size_t len,
+    ProtobufCTextError *result,
+    ProtobufCAllocator *allocator);
+
+/** Import a text format protobuf from a file descriptor into a
+ * \c ProtobufCMessage.
+ *
+ * If \c fd refers to a regular file it is \c mmap()ed and handed to
+ * protobuf_c_text_from_buffer(), so no \c read() or copy of the data
+ * takes place.  Anything else (pipes, sockets, systems without
+ * \c mmap()) is read as protobuf_c_text_from_file() would.  The
+ * descriptor is not closed.
+ *
+ * \param[in] descriptor The descriptor from the generated code.
+ * \param[in] fd The open file descriptor to read the text format
+ *               protobuf from.
+ * \param[out] result This structure contains information on any error
+ *                    that halted processing.
+ * \param[in] allocator This is the same \c ProtobufCAllocator type used
+ *                      by the \c libprotobuf-c library.  You can set it
+ *                      to \c NULL to accept \c protobuf_c_default_allocator -
+ *                      the default allocator.
+ * \return The resulting \c ProtobufCMessage . It returns \c NULL on error.
+ *         Check \c result->complete to make sure the message is valid.
+ */
+extern ProtobufCMessage *protobuf_c_text_from_fd(
+    const ProtobufCMessageDescriptor *descriptor,
+    int fd,
+    ProtobufCTextError *result,
+    ProtobufCAllocator *allocator);
+
+/** Import a text format protobuf from a memory buffer and report how
+ * it went.
+ *
+ * As protobuf_c_text_from_buffer() but \c stats is filled in as well.
+ * On an error \c stats->bytes is how far the parse got.
+ *
+ * \param[in] descriptor The descriptor from the generated code.
+ * \param[in] buf The buffer containing the text format protobuf.
+ * \param[in] len The number of bytes in \c buf to parse.
+ * \param[out] result This structure contains information on any error
+ *                    that halted processing.
+ * \param[in] allocator This is the same \c ProtobufCAllocator type used
+ *                      by the \c libprotobuf-c library.  You can set it
+ *                      to \c NULL to accept \c protobuf_c_default_allocator -
+ *                      the default allocator.
+ * \param[out] stats Where to put the statistics.  They are filled in
+ *                   whether or not the parse succeeds.
+ * \return See protobuf_c_text_from_buffer().
+ */
+extern ProtobufCMessage *protobuf_c_text_from_buffer_stats(
+    const ProtobufCMessageDescriptor *descriptor,
+    const void *buf,
+    size_t len,
+    ProtobufCTextError *result,
+    ProtobufCAllocator *allocator,
+    ProtobufCTextStats *stats);
+
+/** Import a text format protobuf from a \c FILE and report how it went.
+ *
+ * As protobuf_c_text_from_file() but \c stats is filled in as well.
+ *
+ * \param[in] descriptor The descriptor from the generated code.
+ * \param[in] msg_file The \c FILE containing the text format protobuf.
+ * \param[out] result This structure contains information on any error
+ *                    that halted processing.
+ * \param[in] allocator This is the same \c ProtobufCAllocator type used
+ *                      by the \c libprotobuf-c library.  You can set it
+ *                      to \c NULL to accept \c protobuf_c_default_allocator -
+ *                      the default allocator.
+ * \param[out] stats Where to put the statistics.  They are filled in
+ *                   whether or not the parse succeeds.
+ * \return See protobuf_c_text_from_file().
+ */
+extern ProtobufCMessage *protobuf_c_text_from_file_stats(
+    const ProtobufCMessageDescriptor *descriptor,
+    FILE *msg_file,
+    ProtobufCTextError *result,
+    ProtobufCAllocator *allocator,
+    ProtobufCTextStats *stats);
+
+/** Import a text format protobuf from a memory buffer within limits.
+ *
+ * As protobuf_c_text_from_buffer() but the parse fails as soon as it
+ * goes past any of the limits in \c options , with
+ * \c result->error_txt saying which.  If \c max_alloc is too small
+ * for even the parser's own state it fails as on a malloc failure,
+ * with no error text.
+ *
+ * \param[in] descriptor The descriptor from the generated code.
+ * \param[in] buf The buffer containing the text format protobuf.
+ * \param[in] len The number of bytes in \c buf to parse.
+ * \param[in] options The limits, or \c NULL for none.
+ * \param[out] result This structure contains information on any error
+ *                    that halted processing.
+ * \param[in] allocator This is the same \c ProtobufCAllocator type used
+ *                      by the \c libprotobuf-c library.  You can set it
+ *                      to \c NULL to accept \c protobuf_c_default_allocator -
+ *                      the default allocator.
+ * \return See protobuf_c_text_from_buffer().
+ */
+extern ProtobufCMessage *protobuf_c_text_from_buffer_ex(
+    const ProtobufCMessageDescriptor *descriptor,
+    const void *buf,
+    size_t len,
+    const ProtobufCTextParseOptions *options,
+    ProtobufCTextError *result,
+    ProtobufCAllocator *allocator);
+
+/** Import a text format protobuf from a \c FILE within limits.
+ *
+ * As protobuf_c_text_from_buffer_ex() for a \c FILE .  Input is read
+ * \c read_size bytes at a time, so up to that much past \c max_bytes
+ * may be read before the parse fails.
+ *
+ * \param[in] descriptor The descriptor from the generated code.
+ * \param[in] msg_file The \c FILE containing the text format protobuf.
+ * \param[in] options The limits, or \c NULL for none.
+ * \param[out] result This structure contains information on any error
+ *                    that halted processing.
+ * \param[in] allocator This is the same \c ProtobufCAllocator type used
+ *                      by the \c libprotobuf-c library.  You can set it
+ *                      to \c NULL to accept \c protobuf_c_default_allocator -
+ *                      the default allocator.
+ * \return See protobuf_c_text_from_file().
+ */
+extern ProtobufCMessage *protobuf_c_text_from_file_ex(
+    const ProtobufCMessageDescriptor *descriptor,
+    FILE *msg_file,
+    const ProtobufCTextParseOptions *options,
+    ProtobufCTextError *result,
+    ProtobufCAllocator *allocator);
+
+/** Import a text format protobuf from a file descriptor within limits.
+ *
+ * As protobuf_c_text_from_fd() with the limits of
+ * protobuf_c_text_from_buffer_ex() for a regular file and those of
+ * protobuf_c_text_from_file_ex() for anything else.
+ *
+ * \param[in] descriptor The descriptor from the generated code.
+ * \param[in] fd The open file descriptor to read the text format
+ *               protobuf from.
+ * \param[in] options The limits, or \c NULL for none.
+ * \param[out] result This structure contains information on any error
+ *                    that halted processing.
+ * \param[in] allocator This is the same \c ProtobufCAllocator type used
+ *                      by the \c libprotobuf-c library.  You can set it
+ *                      to \c NULL to accept \c protobuf_c_default_allocator -
+ *                      the default allocator.
+ * \return See protobuf_c_text_from_fd().
+ */
+extern ProtobufCMessage *protobuf_c_text_from_fd_ex(
+    const ProtobufCMessageDescriptor *descriptor,
+    int fd,
+    const ProtobufCTextParseOptions *options,
+    ProtobufCTextError *result,
+    ProtobufCAllocator *allocator);
+
+/** Import a text format protobuf into a message you already have.
+ *
+ * The message is cleared and then filled in from \c buf , giving the
+ * same message protobuf_c_text_from_buffer() would.  What it held
+ * before - strings, bytes, sub-messages and repeated field arrays - is
+ * reused where it fits rather than freed, so parsing text of much the
+ * same shape into it again allocates little.  Anything not reused is
+ * freed.  On error the message is left cleared.
+ *
+ * \param[in,out] msg The message, already initialised.  Everything it
+ *                    points to must have been allocated with
+ *                    \c allocator , as by an earlier parse; \c msg
+ *                    itself can live anywhere.
+ * \param[in] buf The text format protobuf.  It does not need to be
+ *                \c NUL terminated.
+ * \param[in] len The length of \c buf .
+ * \param[out] result This structure contains information on any error
+ *                    that halted processing.
+ * \param[in] allocator This is the same \c ProtobufCAllocator type used
+ *                      by the \c libprotobuf-c library.  You can set it
+ *                      to \c NULL to accept \c protobuf_c_default_allocator -
+ *                      the default allocator.
+ * \return Success (1) or failure (0).  Check \c result->complete to
+ *         make sure the message is valid.
+ */
+extern int protobuf_c_text_parse_into(ProtobufCMessage *msg,
+    const void *buf,
+    size_t len,
+    ProtobufCTextError *result,
+    ProtobufCAllocator *allocator);
+
+/** Import a text format protobuf into a message you already have,
+ * within limits.
+ *
+ * As protobuf_c_text_parse_into() with the limits of
+ * protobuf_c_text_from_buffer_ex().  Memory reused from \c msg doesn't
+ * count towards \c max_alloc .
+ *
+ * \param[in,out] msg See protobuf_c_text_parse_into().
+ * \param[in] buf The text format protobuf.
+ * \param[in] len The length of \c buf .
+ * \param[in] options The limits, or \c NULL for none.
+ * \param[out] result This structure contains information on any error
+ *                    that halted processing.
+ * \param[in] allocator See protobuf_c_text_parse_into().
+ * \return See protobuf_c_text_parse_into().
+ */
+extern int protobuf_c_text_parse_into_ex(ProtobufCMessage *msg,
+    const void *buf,
+    size_t len,
+    const ProtobufCTextParseOptions *options,
+    ProtobufCTextError *result,
+    ProtobufCAllocator *allocator);
+
+/** What a merge does with values for a repeated field. */
+typedef enum {
+  PROTOBUF_C_TEXT_MERGE_APPEND,   /**< Add them after the elements the
+                                       field has. */
+  PROTOBUF_C_TEXT_MERGE_REPLACE   /**< Replace the elements the field
+                                       has with them. */
+} ProtobufCTextMergePolicy;
+
+/** Apply a text format protobuf to a message you already have.
+ *
+ * The text is merged into \c msg the way protobuf merges messages:
+ * values for fields that aren't repeated overwrite what the field had,
+ * even if they are given more than once, and a message field that is
+ * already set is merged into recursively.  Values for a repeated field
+ * are added to it or replace its elements, as \c policy says; a
+ * repeated field the text doesn't mention is left alone.  The work done
+ * is in proportion to the text, not to \c msg , so a small override can
+ * be applied to a large message cheaply.
+ *
+ * \param[in,out] msg The message to merge into.  Everything it points
+ *                    to must have been allocated with \c allocator .
+ *                    On error some of the text may have been applied;
+ *                    \c msg is still valid.
+ * \param[in] buf The text format protobuf.  It does not need to be
+ *                \c NUL terminated.
+ * \param[in] len The length of \c buf .
+ * \param[in] policy What to do with values for repeated fields.
+ * \param[out] result This structure contains information on any error
+ *                    that halted processing.
+ * \param[in] allocator This is the same \c ProtobufCAllocator type used
+ *                      by the \c libprotobuf-c library.  You can set it
+ *                      to \c NULL to accept \c protobuf_c_default_allocator -
+ *                      the default allocator.
+ * \return Success (1) or failure (0).  Check \c result->complete to
+ *         make sure the message is valid.
+ */
+extern int protobuf_c_text_merge(ProtobufCMessage *msg,
+    const void *buf,
+    size_t len,
+    ProtobufCTextMergePolicy policy,
+    ProtobufCTextError *result,
+    ProtobufCAllocator *allocator);
+
+/** Apply a text format protobuf to a message you already have, within
+ * limits.
+ *
+ * As protobuf_c_text_merge() with the limits of
+ * protobuf_c_text_from_buffer_ex().  \c max_repeated applies to the
+ * elements a repeated field ends up with, not just those in the text.
+ *
+ * \param[in,out] msg See protobuf_c_text_merge().
+ * \param[in] buf The text format protobuf.
+ * \param[in] len The length of \c buf .
+ * \param[in] policy What to do with values for repeated fields.
+ * \param[in] options The limits, or \c NULL for none.
+ * \param[out] result This structure contains information on any error
+ *                    that halted processing.
+ * \param[in] allocator See protobuf_c_text_merge().
+ * \return See protobuf_c_text_merge().
+ */
+extern int protobuf_c_text_merge_ex(ProtobufCMessage *msg,
+    const void *buf,
+    size_t len,
+    ProtobufCTextMergePolicy policy,
+    const ProtobufCTextParseOptions *options,
+    ProtobufCTextError *result,
+    ProtobufCAllocator *allocator);
+
+/** Import a text format protobuf from a memory buffer using several
+ * threads.
+ *
+ * Meant for a message that is mostly a large repeated message field,
+ * like an address book holding a long list of \c person entries.  A
+ * quick scan splits the input between fields of the top-level message,
+ * the pieces are parsed on a pool of threads and the results are merged.
+ * The message returned is the same as protobuf_c_text_from_buffer()
+ * would return, and so are any errors - when a piece fails the whole
+ * input is parsed again on the calling thread to report it.  Input that
+ * is small or can't be split is just parsed on the calling thread.
+ *
+ * \c allocator is called from all the threads at once, so it must be
+ * thread safe.  The default allocator is; an arena is not.
+ *
+ * \param[in] descriptor The descriptor from the generated code.
+ * \param[in] buf The text format protobuf.  It does not need to be
+ *                \c NUL terminated.
+ * \param[in] len The length of \c buf .
+ * \param[in] n_threads The most threads to use, counting the calling
+ *                      thread, or 0 for one per online CPU.
+ * \param[out] result This structure contains information on any error
+ *                    that halted processing.
+ * \param[in] allocator This is the same \c ProtobufCAllocator type used
+ *                      by the \c libprotobuf-c library.  You can set it
+ *                      to \c NULL to accept \c protobuf_c_default_allocator -
+ *                      the default allocator.
+ * \return The resulting \c ProtobufCMessage . It returns \c NULL on error.
+ *         Check \c result->complete to make sure the message is valid.
+ */
+extern ProtobufCMessage *protobuf_c_text_from_buffer_parallel(
+    const ProtobufCMessageDescriptor *descriptor,
+    const void *buf,
+    size_t len,
+    unsigned n_threads,
+    ProtobufCTextError *result,
+    ProtobufCAllocator *allocator);
+
+/** Import a text format protobuf from a file descriptor using several
+ * threads.
+ *
+ * A regular file is \c mmap()ed and handed to
+ * protobuf_c_text_from_buffer_parallel().  Anything else is read by
+ * protobuf_c_text_from_fd() on the calling thread.  The descriptor is
+ * not closed.
+ *
+ * \param[in] descriptor The descriptor from the generated code.
+ * \param[in] fd The open file descriptor to read the text format
+ *               protobuf from.
+ * \param[in] n_threads The most threads to use, counting the calling
+ *                      thread, or 0 for one per online CPU.
+ * \param[out] result This structure contains information on any error
+ *                    that halted processing.
+ * \param[in] allocator A thread safe \c ProtobufCAllocator , or \c NULL
+ *                      for the default allocator.
+ * \return The resulting \c ProtobufCMessage . It returns \c NULL on error.
+ *         Check \c result->complete to make sure the message is valid.
+ */
+extern ProtobufCMessage *protobuf_c_text_from_fd_parallel(
+    const ProtobufCMessageDescriptor *descriptor,
+    int fd,
+    unsigned n_threads,
+    ProtobufCTextError *result,
+    ProtobufCAllocator *allocator);
+
+/** Convert a text format protobuf in a memory buffer straight to the
+ * binary wire format.
+ *
+ * The result is what packing the message protobuf_c_text_from_buffer()
+ * returns would give, but no message is built: each value is written
+ * to \c out as it is parsed.  Fields come out in the order they appear
+ * in the text, which any decoder accepts; the bytes match
+ * \c protobuf_c_message_pack() when the text lists fields in the order
+ * the \c .proto does, as protobuf_c_text_to_string() writes them.
+ *
+ * Required fields missing from the text are simply left out and
+ * \c result->complete is set to 0.  Output is passed to \c out a
+ * piece at a time, so on error some of it may already have been.
+ *
+ * \param[in] descriptor The descriptor from the generated code.
+ * \param[in] buf The text format protobuf.  It does not need to be
+ *                \c NUL terminated.
+ * \param[in] len The length of \c buf .
+ * \param[in] out Where the binary protobuf is written.
+ * \param[out] result This structure contains information on any error
+ *                    that halted processing.
+ * \param[in] allocator This is the same \c ProtobufCAllocator type used
+ *                      by the \c libprotobuf-c library.  You can set it
+ *                      to \c NULL to accept \c protobuf_c_default_allocator -
+ *                      the default allocator.  It is only used for
+ *                      scratch space.
+ * \return Success (1) or failure (0).  Check \c result->complete to make
+ *         sure the message is valid.
+ */
+extern int protobuf_c_text_to_packed(
+    const ProtobufCMessageDescriptor *descriptor,
+    const void *buf,
+    size_t len,
+    ProtobufCBuffer *out,
+    ProtobufCTextError *result,
+    ProtobufCAllocator *allocator);
+
+/** Convert a text format protobuf straight to the binary wire format,
+ * within limits.
+ *
+ * As protobuf_c_text_to_packed() with the limits of
+ * protobuf_c_text_from_buffer_ex().  \c max_alloc counts the scratch
+ * space, not what is written to \c out .
+ *
+ * \param[in] descriptor The descriptor from the generated code.
+ * \param[in] buf The text format protobuf.
+ * \param[in] len The length of \c buf .
+ * \param[in] out Where the binary protobuf is written.
+ * \param[in] options The limits, or \c NULL for none.
+ * \param[out] result This structure contains information on any error
+ *                    that halted processing.
+ * \param[in] allocator See protobuf_c_text_to_packed().
+ * \return See protobuf_c_text_to_packed().
+ */
+extern int protobuf_c_text_to_packed_ex(
+    const ProtobufCMessageDescriptor *descriptor,
+    const void *buf,
+    size_t len,
+    ProtobufCBuffer *out,
+    const ProtobufCTextParseOptions *options,
+    ProtobufCTextError *result,
+    ProtobufCAllocator *allocator);
+
+/** A reader for a stream of text format protobufs.
+ *
+ * Opaque.  Create one with one of the protobuf_c_text_reader_open
+ * functions, get each message with protobuf_c_text_reader_next() and
+ * release it with protobuf_c_text_reader_close().
+ *
+ * Records are either separated by a separator string or, if no
+ * separator is given, each is preceded by its length in bytes as a
+ * decimal number on a line of its own.  A separator inside a quoted
+ * string doesn't end a record.
+ *
+ * The reader keeps its input buffer and parser state from one record
+ * to the next so each record costs no more setup than the message it
+ * returns.
+ */
+typedef struct _ProtobufCTextReader ProtobufCTextReader;
+
+/** Open a reader on a \c FILE.
+ *
+ * \param[in] descriptor The descriptor from the generated code for the
+ *                       message in each record.
+ * \param[in] msg_file The \c FILE to read.  It is not closed.
+ * \param[in] separator The string between records, for instance
+ *                      \c "\n---\n" , or \c NULL for length prefixed
+ *                      records.
+ * \param[in] allocator This is the same \c ProtobufCAllocator type used
+ *                      by the \c libprotobuf-c library.  You can set it
+ *                      to \c NULL to accept \c protobuf_c_default_allocator -
+ *                      the default allocator.  It is used for the reader
+ *                      and the messages it returns.
+ * \return The reader, or \c NULL on allocation failure.
+ */
+extern ProtobufCTextReader *protobuf_c_text_reader_open_file(
+    const ProtobufCMessageDescriptor *descriptor,
+    FILE *msg_file,
+    const char *separator,
+    ProtobufCAllocator *allocator);
+
+/** Open a reader on a file descriptor.
+ *
+ * See protobuf_c_text_reader_open_file().  Reads are retried on
+ * \c EINTR .  The descriptor is not closed.
+ */
+extern ProtobufCTextReader *protobuf_c_text_reader_open_fd(
+    const ProtobufCMessageDescriptor *descriptor,
+    int fd,
+    const char *separator,
+    ProtobufCAllocator *allocator);
+
+/** Open a reader on a memory buffer.
+ *
+ * See protobuf_c_text_reader_open_file().  The buffer is not written to,
+ * need not be \c NUL terminated and must stay valid until the reader is
+ * closed.
+ */
+extern ProtobufCTextReader *protobuf_c_text_reader_open_buffer(
+    const ProtobufCMessageDescriptor *descriptor,
+    const void *buf,
+    size_t len,
+    const char *separator,
+    ProtobufCAllocator *allocator);
+
+/** Read the next message from a reader.
+ *
+ * The message is freed as one from protobuf_c_text_from_file() would
+ * be.  If a record fails to parse the reader moves on to the next one
+ * on the following call.  A read error or a bad length prefix ends the
+ * stream.  Line numbers in errors count from the start of the record.
+ *
+ * \param[in,out] reader The reader.
+ * \param[in,out] result A \c ProtobufCTextError instance to record any
+ *                       errors.  It is not an option to pass \c NULL for
+ *                       this and it must be checked for errors.
+ * \return The next message, or \c NULL at the end of the stream (with
+ *         \c result->error_txt set to \c NULL ) or on error.  Trailing
+ *         white space after the last separator is not a record.
+ */
+extern ProtobufCMessage *protobuf_c_text_reader_next(
+    ProtobufCTextReader *reader,
+    ProtobufCTextError *result);
+
+/** Limit each record a reader parses.
+ *
+ * The limits are those of protobuf_c_text_from_buffer_ex() and apply
+ * to each record on its own from the next one read.  A record longer
+ * than \c max_bytes ends the stream, as it can't be skipped without
+ * reading all of it.  \c read_size is how much input is read at a
+ * time, whatever the source.
+ *
+ * \param[in,out] reader The reader.
+ * \param[in] options The limits, or \c NULL for none.  They are copied.
+ */
+extern void protobuf_c_text_reader_set_options(ProtobufCTextReader *reader,
+    const ProtobufCTextParseOptions *options);
+
+/** Close a reader.
+ *
+ * Messages already returned are not affected.
+ *
+ * \param[in] reader The reader. \c NULL is ignored.
+ */
+extern void protobuf_c_text_reader_close(ProtobufCTextReader *reader);
+
+/** A parser fed its input a piece at a time.
+ *
+ * Opaque.  Create one with protobuf_c_text_parser_new(), pass it input
+ * as it arrives with protobuf_c_text_parser_feed() and get the message
+ * with protobuf_c_text_parser_finish().  Nothing blocks: each call
+ * parses as far as the input fed so far allows and keeps the rest,
+ * from the start of a token that may not be complete yet, for the next.
+ */
+typedef struct _ProtobufCTextParser ProtobufCTextParser;
+
+/** Where a protobuf_c_text_parser_feed() parse is. */
+typedef enum {
+  PROTOBUF_C_TEXT_PARSER_NEED_MORE,  /**< Waiting for more input. */
+  PROTOBUF_C_TEXT_PARSER_DONE,       /**< The input has ended and the
+                                          message is ready. */
+  PROTOBUF_C_TEXT_PARSER_ERROR       /**< The input is bad; more won't
+                                          help. */
+} ProtobufCTextParserStatus;
+
+/** Create a push parser.
+ *
+ * \param[in] descriptor The descriptor from the generated code for the
+ *                       message to parse.
+ * \param[in] allocator This is the same \c ProtobufCAllocator type used
+ *                      by the \c libprotobuf-c library.  You can set it
+ *                      to \c NULL to accept \c protobuf_c_default_allocator -
+ *                      the default allocator.  It is used for the parser
+ *                      and the message it returns.
+ * \return The parser, or \c NULL on allocation failure.
+ */
+extern ProtobufCTextParser *protobuf_c_text_parser_new(
+    const ProtobufCMessageDescriptor *descriptor,
+    ProtobufCAllocator *allocator);
+
+/** Limit what a push parser accepts.
+ *
+ * The limits are those of protobuf_c_text_from_buffer_ex(), with
+ * \c max_bytes counting all the input fed.  Set them before the first
+ * call to protobuf_c_text_parser_feed().
+ *
+ * \param[in,out] parser The parser.
+ * \param[in] options The limits, or \c NULL for none.  They are copied.
+ */
+extern void protobuf_c_text_parser_set_options(ProtobufCTextParser *parser,
+    const ProtobufCTextParseOptions *options);
+
+/** Feed a push parser the next piece of its input.
+ *
+ * The piece is copied, so \c chunk can be reused once this returns.
+ * Pieces can split the input anywhere, even inside a token.  The text
+ * format has no end marker, so a \c len of 0 tells the parser the
+ * input has ended; only then can it be done.  Once it is done or has
+ * failed further input is ignored.
+ *
+ * \param[in] parser The parser.
+ * \param[in] chunk The next bytes of the text format protobuf.
+ * \param[in] len The length of \c chunk , or 0 at the end of the input.
+ * \return \c PROTOBUF_C_TEXT_PARSER_NEED_MORE until the end of the input
+ *         has been fed, then \c PROTOBUF_C_TEXT_PARSER_DONE .  Either way
+ *         it can be \c PROTOBUF_C_TEXT_PARSER_ERROR instead, after which
+ *         protobuf_c_text_parser_finish() reports the error.
+ */
+extern ProtobufCTextParserStatus protobuf_c_text_parser_feed(
+    ProtobufCTextParser *parser,
+    const void *chunk,
+    size_t len);
+
+/** Get the message from a push parser and free the parser.
+ *
+ * Ends the input first if protobuf_c_text_parser_feed() hasn't been
+ * told it has ended.  Call it to abandon a parse too.
+ *
+ * \param[in] parser The parser, which is freed.
+ * \param[out] result This structure contains information on any error
+ *                    that halted processing.
+ * \return The resulting \c ProtobufCMessage . It returns \c NULL on error.
+ *         Check \c result->complete to make sure the message is valid.
+ */
+extern ProtobufCMessage *protobuf_c_text_parser_finish(
+    ProtobufCTextParser *parser,
+    ProtobufCTextError *result);
+
+/** A parser kept for many parses.
+ *
+ * Opaque.  Create one with protobuf_c_text_context_new() and parse with
+ * protobuf_c_text_context_from_buffer() or
+ * protobuf_c_text_context_from_file() as often as needed.  Its message
+ * stack, error buffer and input buffer are kept from one parse to the
+ * next rather than set up and torn down each time, which is most of
+ * the cost of parsing a small message.  A context is not thread safe;
+ * use one per thread.
+ */
+typedef struct _ProtobufCTextContext ProtobufCTextContext;
+
+/** Create a parser context.
+ *
+ * \param[in] allocator This is the same \c ProtobufCAllocator type used
+ *                      by the \c libprotobuf-c library.  You can set it
+ *                      to \c NULL to accept \c protobuf_c_default_allocator -
+ *                      the default allocator.  It is used for the context
+ *                      and the messages parsed with it.
+ * \return The context, or \c NULL on allocation failure.
+ */
+extern ProtobufCTextContext *protobuf_c_text_context_new(
+    ProtobufCAllocator *allocator);
+
+/** Limit each parse done with a context.
+ *
+ * The limits are those of protobuf_c_text_from_buffer_ex() for a
+ * buffer and protobuf_c_text_from_file_ex() for a \c FILE , and apply
+ * to each parse on its own until they are set again.  That includes
+ * \c read_size for a \c FILE .
+ *
+ * \param[in,out] ctx The context.
+ * \param[in] options The limits, or \c NULL for none.  They are copied.
+ */
+extern void protobuf_c_text_context_set_options(ProtobufCTextContext *ctx,
+    const ProtobufCTextParseOptions *options);
+
+/** Convert a text format protobuf in a buffer using a context.
+ *
+ * As protobuf_c_text_from_buffer() with the context's allocator.  Any
+ * type of message can be parsed with a context.
+ *
+ * \param[in] ctx The context.
+ * \param[in] descriptor The descriptor from the generated code for the
+ *                       message to parse.
+ * \param[in] buf The text format protobuf.  It need not be \c NUL
+ *                terminated.
+ * \param[in] len The length of \c buf .
+ * \param[out] result This structure contains information on any error
+ *                    that halted processing.
+ * \return The resulting \c ProtobufCMessage . It returns \c NULL on error.
+ *         Check \c result->complete to make sure the message is valid.
+ */
+extern ProtobufCMessage *protobuf_c_text_context_from_buffer(
+    ProtobufCTextContext *ctx,
+    const ProtobufCMessageDescriptor *descriptor,
+    const void *buf,
+    size_t len,
+    ProtobufCTextError *result);
+
+/** Convert a text format protobuf in a \c FILE using a context.
+ *
+ * As protobuf_c_text_from_file() with the context's allocator.
+ *
+ * \param[in] ctx The context.
+ * \param[in] descriptor The descriptor from the generated code for the
+ *                       message to parse.
+ * \param[in] msg_file A \c FILE containing the text format protobuf.
+ * \param[out] result This structure contains information on any error
+ *                    that halted processing.
+ * \return The resulting \c ProtobufCMessage . It returns \c NULL on error.
+ *         Check \c result->complete to make sure the message is valid.
+ */
+extern ProtobufCMessage *protobuf_c_text_context_from_file(
+    ProtobufCTextContext *ctx,
+    const ProtobufCMessageDescriptor *descriptor,
+    FILE *msg_file,
+    ProtobufCTextError *result);
+
+/** Free a parser context.
+ *
+ * Messages parsed with it are not affected.
+ *
+ * \param[in] ctx The context. \c NULL is ignored.
+ */
+extern void protobuf_c_text_context_free(ProtobufCTextContext *ctx);
+
+/** An arena for bulk allocation.
+ *
+ * Opaque. Create one with protobuf_c_text_arena_new() and pass the
+ * allocator from protobuf_c_text_arena_allocator() to the functions
+ * above.  Everything they allocate is then bump-allocated from large
+ * blocks and released in one go by protobuf_c_text_arena_free().
+ */
+typedef struct _ProtobufCTextArena ProtobufCTextArena;
+
+/** Create an arena.
+ *
+ * An arena is not thread safe; use one per thread (or per parse).
+ *
+ * \param[in] block_size Size of the blocks to carve allocations out of.
+ *                       Pass \c 0 for the default of 64 KiB.
+ * \param[in] allocator Where the blocks themselves come from.  You can
+ *                      set it to \c NULL to use \c malloc().
+ * \return The new arena, or \c NULL on allocation failure.
+ */
+extern ProtobufCTextArena *protobuf_c_text_arena_new(size_t block_size,
+    ProtobufCAllocator *allocator);
+
+/** Get an arena's allocator.
+ *
+ * Pass this as the \c allocator argument to any of the functions
+ * above.  The message tree, the \c error_txt in \c ProtobufCTextError
+ * and any generated string all end up in the arena.  They must not be
+ * freed individually (doing so with the allocator is harmless but
+ * reclaims nothing) and are invalid once the arena is freed.
+ *
+ * \param[in] arena The arena.
+ * \return A \c ProtobufCAllocator that allocates from \c arena .
+ */
+extern ProtobufCAllocator *protobuf_c_text_arena_allocator(
+    ProtobufCTextArena *arena);
+
+/** Free an arena and everything allocated from it.
+ *
+ * \param[in] arena The arena. \c NULL is ignored.
+ */
+extern void protobuf_c_text_arena_free(ProtobufCTextArena *arena);
+
 /** @} */   /* End of API group. */
 
 #endif /* PROTOBUF_C_TEXT_H */
@@ -3,7 +3,8 @@
 
 /** \file
  * Internal utility header file.
- * Macros used by the generator and parser parts of the library.
+ * Macros and internal declarations used by the generator and parser
+ * parts of the library.
  *
  * \author Kevin Lyda <kevin@ie.suberic.net>
  * \date   March 2014
@@ -50,4 +51,45 @@
                                                    allocator_data, size): \
                            malloc(size))
 
+/* Statistics gathering; see stats.c.  The functions are shared between
+ * files so can't be static; the protobuf_c_text__ prefix keeps them out
+ * of the way of application symbols and marks them as not part of the
+ * API. */
+
+/** An allocator that counts requests for a \c ProtobufCTextStats and
+ * passes them on to another allocator. */
+typedef struct _StatsAllocator {
+  ProtobufCAllocator base;        /**< What the library is given. */
+  ProtobufCAllocator *allocator;  /**< Where requests go; \c NULL for
+                                       \c malloc() and \c free(). */
+  ProtobufCTextStats *stats;      /**< Where to count them. */
+} StatsAllocator;
+
+/** Zero \c stats and set up \c sa to count allocations for it.
+ *
+ * \param[out] sa The counting allocator.
+ * \param[in] allocator Allocator functions to pass requests on to.
+ * \param[out] stats The statistics to fill in.
+ * \return The allocator to use in place of \c allocator .
+ */
+ProtobufCAllocator *protobuf_c_text__stats_start(StatsAllocator *sa,
+    ProtobufCAllocator *allocator, ProtobufCTextStats *stats);
+
+/** Seconds on a monotonic clock, for timing. */
+double protobuf_c_text__stats_now(void);
+
+/* Wire format constants. */
+
+/** Wire type of varints. */
+#define WIRE_VARINT 0
+/** Wire type of 64 bit values. */
+#define WIRE_64BIT 1
+/** Wire type of length delimited values. */
+#define WIRE_LENGTH 2
+/** Wire type of 32 bit values. */
+#define WIRE_32BIT 5
+
+/** Most bytes a varint takes. */
+#define VARINT_MAX 10
+
 #endif /* PROTOBUF_C_UTIL_H */
@@ -0,0 +1,66 @@
+/** \file
+ * Statistics gathering for text format protobufs.
+ *
+ * This file contains the allocator wrapper that counts allocations for
+ * a \c ProtobufCTextStats and the clock used to time parsing and
+ * generating.  They are only used by the \c _stats entry points.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <protobuf-c/protobuf-c.h>
+#include "protobuf-c-text.h"
+#include "protobuf-c-util.h"
+#include "config.h"
+
+/** \defgroup stats Statistics gathering
+ * \ingroup internal
+ * @{
+ */
+
+/** \c alloc function of a \c StatsAllocator . */
+static void *
+stats_alloc(void *allocator_data, size_t size)
+{
+  StatsAllocator *sa = allocator_data;
+  ProtobufCAllocator *allocator = sa->allocator;
+
+  sa->stats->allocs++;
+  sa->stats->alloc_bytes += size;
+  return PBC_ALLOC(size);
+}
+
+/** \c free function of a \c StatsAllocator . */
+static void
+stats_free(void *allocator_data, void *ptr)
+{
+  StatsAllocator *sa = allocator_data;
+  ProtobufCAllocator *allocator = sa->allocator;
+
+  PBC_FREE(ptr);
+}
+
+ProtobufCAllocator *
+protobuf_c_text__stats_start(StatsAllocator *sa, ProtobufCAllocator *allocator,
+    ProtobufCTextStats *stats)
+{
+  memset(stats, 0, sizeof(*stats));
+  sa->base.alloc = stats_alloc;
+  sa->base.free = stats_free;
+  sa->base.allocator_data = sa;
+  sa->allocator = allocator;
+  sa->stats = stats;
+  return &sa->base;
+}
+
+double
+protobuf_c_text__stats_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/** @} */  /* End of stats group. */
@@ -0,0 +1,1256 @@
+/** \file
+ * A protoc plugin that generates text format code for messages.
+ *
+ * For each message in a \c .proto file this writes a
+ * \c foo__to_text() function that prints the message with the field
+ * names, types and enum value names fixed at compile time.  The text
+ * produced is the same as protobuf_c_text_to_string() produces.  Only
+ * printing is specialised; parse with protobuf_c_text_from_string().
+ *
+ * The plugin reads a \c CodeGeneratorRequest on \c stdin and writes a
+ * \c CodeGeneratorResponse on \c stdout.  Only the handful of descriptor
+ * fields needed are decoded, straight from the wire format, so the plugin
+ * needs nothing beyond libc to build.
+ *
+ * Usage:
+ * \verbatim
+protoc-c --plugin=protoc-gen-c-text --c-text_out=. foo.proto
+\endverbatim
+ */
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** \defgroup plugin protoc plugin
+ * \ingroup internal
+ * @{
+ */
+
+/** Field types from \c FieldDescriptorProto.Type . */
+enum {
+  TYPE_DOUBLE = 1,
+  TYPE_FLOAT = 2,
+  TYPE_INT64 = 3,
+  TYPE_UINT64 = 4,
+  TYPE_INT32 = 5,
+  TYPE_FIXED64 = 6,
+  TYPE_FIXED32 = 7,
+  TYPE_BOOL = 8,
+  TYPE_STRING = 9,
+  TYPE_GROUP = 10,
+  TYPE_MESSAGE = 11,
+  TYPE_BYTES = 12,
+  TYPE_UINT32 = 13,
+  TYPE_ENUM = 14,
+  TYPE_SFIXED32 = 15,
+  TYPE_SFIXED64 = 16,
+  TYPE_SINT32 = 17,
+  TYPE_SINT64 = 18
+};
+
+/** Field labels from \c FieldDescriptorProto.Label . */
+enum {
+  LABEL_OPTIONAL = 1,
+  LABEL_REQUIRED = 2,
+  LABEL_REPEATED = 3
+};
+
+/** A growable string. */
+typedef struct _Str {
+  char *s;       /**< The string - always NUL terminated. */
+  size_t len;    /**< Length of the string. */
+  size_t size;   /**< Allocated size. */
+} Str;
+
+/** A piece of the request being decoded. */
+typedef struct _Reader {
+  const uint8_t *p;    /**< Next byte to decode. */
+  const uint8_t *end;  /**< End of the data. */
+} Reader;
+
+/** A field of a message. */
+typedef struct _Field {
+  char *name;            /**< Name as written in the \c .proto file. */
+  int number;            /**< Field number. */
+  int label;             /**< \c LABEL_* value. */
+  int type;              /**< \c TYPE_* value. */
+  char *type_name;       /**< Message or enum type, e.g. \c ".pkg.Msg" . */
+  int oneof_index;       /**< Index of the oneof or -1. */
+  int proto3_optional;   /**< Set for proto3 \c optional fields. */
+  int index;             /**< Index in the protoc-c descriptor. */
+} Field;
+
+/** An enum value. */
+typedef struct _EnumValue {
+  char *name;  /**< Value name. */
+  int number;  /**< Value number. */
+} EnumValue;
+
+struct _File;
+
+/** An enum type. */
+typedef struct _Enum {
+  char *full_name;      /**< Fully qualified name without leading dot. */
+  EnumValue *values;    /**< The values. */
+  size_t n_values;      /**< Number of values. */
+  int used;             /**< Referenced by a generated printer. */
+} Enum;
+
+/** A message type. */
+typedef struct _Message {
+  char *full_name;      /**< Fully qualified name without leading dot. */
+  struct _File *file;   /**< File the message is defined in. */
+  Field *fields;        /**< The fields, sorted by number. */
+  size_t n_fields;      /**< Number of fields. */
+  char **oneofs;        /**< Names of the oneofs. */
+  size_t n_oneofs;      /**< Number of oneofs. */
+  int used;             /**< Needs a printer in the current file. */
+} Message;
+
+/** A \c .proto file. */
+typedef struct _File {
+  char *name;           /**< File name, e.g. \c "foo/bar.proto" . */
+  char *package;        /**< Package or \c NULL . */
+  int proto3;           /**< Set for \c syntax = "proto3" . */
+} File;
+
+/** Everything known about the request. */
+typedef struct _Request {
+  char **to_generate;       /**< Names of files to generate code for. */
+  size_t n_to_generate;     /**< Number of files to generate. */
+  char *parameter;          /**< The \c --c-text_out parameter or \c NULL . */
+  File **files;             /**< All files, dependencies included. */
+  size_t n_files;           /**< Number of files. */
+  Message **messages;       /**< All messages in all files. */
+  size_t n_messages;        /**< Number of messages. */
+  Enum **enums;             /**< All enums in all files. */
+  size_t n_enums;           /**< Number of enums. */
+} Request;
+
+/*
+ * The plugin runs once per protoc invocation, so nothing is freed;
+ * memory is released on exit.
+ */
+
+/** malloc or die. */
+static void *
+xmalloc(size_t size)
+{
+  void *p = malloc(size? size: 1);
+
+  if (!p) {
+    fprintf(stderr, "protoc-gen-c-text: out of memory\n");
+    exit(1);
+  }
+  return p;
+}
+
+/** realloc or die. */
+static void *
+xrealloc(void *ptr, size_t size)
+{
+  void *p = realloc(ptr, size? size: 1);
+
+  if (!p) {
+    fprintf(stderr, "protoc-gen-c-text: out of memory\n");
+    exit(1);
+  }
+  return p;
+}
+
+/** Append an element to an array, growing it geometrically. */
+#define APPEND(array, n) \
+  (((n) & ((n) - 1)) == 0? \
+     ((array) = xrealloc((array), ((n)? (n) * 2: 1) * sizeof(*(array)))): \
+     (array), \
+   &(array)[(n)++])
+
+/** Copy \c len bytes into a new NUL terminated string. */
+static char *
+xstrndup(const char *s, size_t len)
+{
+  char *p = xmalloc(len + 1);
+
+  memcpy(p, s, len);
+  p[len] = '\0';
+  return p;
+}
+
+/** Append printf style output to a \c Str . */
+static void str_printf(Str *str, const char *format, ...)
+  __attribute__((format(printf, 2, 3)));
+static void
+str_printf(Str *str, const char *format, ...)
+{
+  va_list args;
+  int added;
+
+  for (;;) {
+    va_start(args, format);
+    added = vsnprintf(str->s + str->len, str->size - str->len, format, args);
+    va_end(args);
+    if (added >= 0 && str->len + added < str->size) {
+      str->len += added;
+      return;
+    }
+    str->size = (str->size + (added > 0? added: 0) + 1) * 2;
+    str->s = xrealloc(str->s, str->size);
+  }
+}
+
+/** Read a varint.
+ *
+ * \return Success (1) or failure (0).
+ */
+static int
+read_varint(Reader *r, uint64_t *val)
+{
+  uint64_t v = 0;
+  int shift;
+
+  for (shift = 0; shift < 64 && r->p < r->end; shift += 7) {
+    uint8_t b = *r->p++;
+
+    v |= (uint64_t)(b & 0x7f) << shift;
+    if (!(b & 0x80)) {
+      *val = v;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/** Read the next field of a message.
+ *
+ * Fields other than varints and length delimited ones are skipped.
+ *
+ * \param[in,out] r The message being read.
+ * \param[out] number The field number.
+ * \param[out] val The value of a varint field.
+ * \param[out] sub The contents of a length delimited field (\c sub->p is
+ *                 \c NULL for varints).
+ * \return Field read (1), end of message (0) or corrupt message (-1).
+ */
+static int
+read_field(Reader *r, uint32_t *number, uint64_t *val, Reader *sub)
+{
+  uint64_t tag, len;
+
+  while (r->p < r->end) {
+    if (!read_varint(r, &tag)) {
+      return -1;
+    }
+    *number = tag >> 3;
+    sub->p = sub->end = NULL;
+    switch (tag & 7) {
+      case 0:
+        if (!read_varint(r, val)) {
+          return -1;
+        }
+        return 1;
+      case 1:
+        if (r->end - r->p < 8) {
+          return -1;
+        }
+        r->p += 8;
+        break;
+      case 2:
+        if (!read_varint(r, &len) || (uint64_t)(r->end - r->p) < len) {
+          return -1;
+        }
+        sub->p = r->p;
+        sub->end = r->p + len;
+        r->p += len;
+        return 1;
+      case 5:
+        if (r->end - r->p < 4) {
+          return -1;
+        }
+        r->p += 4;
+        break;
+      default:
+        return -1;
+    }
+  }
+  return 0;
+}
+
+/** Return a length delimited field as a new string. */
+static char *
+reader_str(const Reader *r)
+{
+  return xstrndup((const char *)r->p, r->end - r->p);
+}
+
+/** Build a fully qualified name without a leading dot. */
+static char *
+qualify(const char *scope, const char *name)
+{
+  Str str = { NULL, 0, 0 };
+
+  if (scope && *scope) {
+    str_printf(&str, "%s.%s", scope, name);
+  } else {
+    str_printf(&str, "%s", name);
+  }
+  return str.s;
+}
+
+/** Decode an \c EnumDescriptorProto . */
+static int
+decode_enum(Request *req, Reader r, const char *scope)
+{
+  Enum *e = xmalloc(sizeof(Enum));
+  char *name = NULL;
+  uint32_t number;
+  uint64_t val;
+  Reader sub;
+  int rv;
+
+  memset(e, 0, sizeof(Enum));
+  while ((rv = read_field(&r, &number, &val, &sub)) > 0) {
+    if (number == 1 && sub.p) {
+      name = reader_str(&sub);
+    } else if (number == 2 && sub.p) {
+      EnumValue *v = APPEND(e->values, e->n_values);
+      uint32_t vnumber;
+      Reader vsub;
+
+      memset(v, 0, sizeof(EnumValue));
+      while ((rv = read_field(&sub, &vnumber, &val, &vsub)) > 0) {
+        if (vnumber == 1 && vsub.p) {
+          v->name = reader_str(&vsub);
+        } else if (vnumber == 2 && !vsub.p) {
+          v->number = (int32_t)val;
+        }
+      }
+      if (rv < 0 || !v->name) {
+        return 0;
+      }
+    }
+  }
+  if (rv < 0 || !name) {
+    return 0;
+  }
+  e->full_name = qualify(scope, name);
+  *APPEND(req->enums, req->n_enums) = e;
+  return 1;
+}
+
+/** Decode a \c FieldDescriptorProto . */
+static int
+decode_field(Field *f, Reader r)
+{
+  uint32_t number;
+  uint64_t val;
+  Reader sub;
+  int rv;
+
+  memset(f, 0, sizeof(Field));
+  f->oneof_index = -1;
+  while ((rv = read_field(&r, &number, &val, &sub)) > 0) {
+    if (sub.p) {
+      if (number == 1) {
+        f->name = reader_str(&sub);
+      } else if (number == 6) {
+        f->type_name = reader_str(&sub);
+      }
+    } else {
+      if (number == 3) {
+        f->number = val;
+      } else if (number == 4) {
+        f->label = val;
+      } else if (number == 5) {
+        f->type = val;
+      } else if (number == 9) {
+        f->oneof_index = val;
+      } else if (number == 17) {
+        f->proto3_optional = val;
+      }
+    }
+  }
+  return rv == 0 && f->name;
+}
+
+/** Order fields by number, as protoc-c does. */
+static int
+field_cmp(const void *a, const void *b)
+{
+  return ((const Field *)a)->number - ((const Field *)b)->number;
+}
+
+/** Decode a \c DescriptorProto and its nested types. */
+static int
+decode_message(Request *req, File *file, Reader r, const char *scope)
+{
+  Message *m = xmalloc(sizeof(Message));
+  Reader fields = r, sub;
+  char *name = NULL;
+  uint32_t number;
+  uint64_t val;
+  size_t i;
+  int rv;
+
+  memset(m, 0, sizeof(Message));
+  m->file = file;
+  while ((rv = read_field(&r, &number, &val, &sub)) > 0) {
+    if (number == 1 && sub.p) {
+      name = reader_str(&sub);
+    }
+  }
+  if (rv < 0 || !name) {
+    return 0;
+  }
+  m->full_name = qualify(scope, name);
+
+  r = fields;
+  while ((rv = read_field(&r, &number, &val, &sub)) > 0) {
+    if (!sub.p) {
+      continue;
+    }
+    switch (number) {
+      case 2:
+        if (!decode_field(APPEND(m->fields, m->n_fields), sub)) {
+          return 0;
+        }
+        break;
+      case 3:
+        if (!decode_message(req, file, sub, m->full_name)) {
+          return 0;
+        }
+        break;
+      case 4:
+        if (!decode_enum(req, sub, m->full_name)) {
+          return 0;
+        }
+        break;
+      case 8:
+        {
+          char **oneof = APPEND(m->oneofs, m->n_oneofs);
+          uint32_t onumber;
+          Reader osub;
+
+          *oneof = NULL;
+          while ((rv = read_field(&sub, &onumber, &val, &osub)) > 0) {
+            if (onumber == 1 && osub.p) {
+              *oneof = reader_str(&osub);
+            }
+          }
+          if (rv < 0 || !*oneof) {
+            return 0;
+          }
+        }
+        break;
+    }
+  }
+  if (rv < 0) {
+    return 0;
+  }
+
+  qsort(m->fields, m->n_fields, sizeof(Field), field_cmp);
+  for (i = 0; i < m->n_fields; i++) {
+    m->fields[i].index = i;
+  }
+  *APPEND(req->messages, req->n_messages) = m;
+  return 1;
+}
+
+/** Decode a \c FileDescriptorProto . */
+static int
+decode_file(Request *req, Reader r)
+{
+  File *file = xmalloc(sizeof(File));
+  Reader types = r, sub;
+  uint32_t number;
+  uint64_t val;
+  int rv;
+
+  memset(file, 0, sizeof(File));
+  while ((rv = read_field(&r, &number, &val, &sub)) > 0) {
+    if (!sub.p) {
+      continue;
+    }
+    if (number == 1) {
+      file->name = reader_str(&sub);
+    } else if (number == 2) {
+      file->package = reader_str(&sub);
+    } else if (number == 12) {
+      file->proto3 = sub.end - sub.p == 6 && !memcmp(sub.p, "proto3", 6);
+    }
+  }
+  if (rv < 0 || !file->name) {
+    return 0;
+  }
+
+  r = types;
+  while ((rv = read_field(&r, &number, &val, &sub)) > 0) {
+    if (number == 4 && sub.p) {
+      if (!decode_message(req, file, sub, file->package)) {
+        return 0;
+      }
+    } else if (number == 5 && sub.p) {
+      if (!decode_enum(req, sub, file->package)) {
+        return 0;
+      }
+    }
+  }
+  if (rv < 0) {
+    return 0;
+  }
+  *APPEND(req->files, req->n_files) = file;
+  return 1;
+}
+
+/** Decode a \c CodeGeneratorRequest . */
+static int
+decode_request(Request *req, Reader r)
+{
+  uint32_t number;
+  uint64_t val;
+  Reader sub;
+  int rv;
+
+  memset(req, 0, sizeof(Request));
+  while ((rv = read_field(&r, &number, &val, &sub)) > 0) {
+    if (!sub.p) {
+      continue;
+    }
+    if (number == 1) {
+      *APPEND(req->to_generate, req->n_to_generate) = reader_str(&sub);
+    } else if (number == 2) {
+      req->parameter = reader_str(&sub);
+    } else if (number == 15) {
+      if (!decode_file(req, sub)) {
+        return 0;
+      }
+    }
+  }
+  return rv == 0;
+}
+
+/** Find a message by its \c type_name . */
+static Message *
+find_message(Request *req, const char *type_name)
+{
+  size_t i;
+
+  for (i = 0; i < req->n_messages; i++) {
+    if (!strcmp(req->messages[i]->full_name, type_name + 1)) {
+      return req->messages[i];
+    }
+  }
+  return NULL;
+}
+
+/** Find an enum by its \c type_name . */
+static Enum *
+find_enum(Request *req, const char *type_name)
+{
+  size_t i;
+
+  for (i = 0; i < req->n_enums; i++) {
+    if (!strcmp(req->enums[i]->full_name, type_name + 1)) {
+      return req->enums[i];
+    }
+  }
+  return NULL;
+}
+
+/** Convert a name to protoc-c's C type form (\c foo.bar_baz to
+ * \c Foo__BarBaz ). */
+static char *
+name_to_c(const char *full_name)
+{
+  Str str = { NULL, 0, 0 };
+  int upper = 1;
+
+  str_printf(&str, "%s", "");
+  for (; *full_name; full_name++) {
+    if (*full_name == '.') {
+      str_printf(&str, "__");
+      upper = 1;
+    } else if (*full_name == '_') {
+      upper = 1;
+    } else {
+      str_printf(&str, "%c",
+          upper? toupper((unsigned char)*full_name): *full_name);
+      upper = 0;
+    }
+  }
+  return str.s;
+}
+
+/** Convert a name to protoc-c's function form (\c foo.BarBaz to
+ * \c foo__bar_baz ). */
+static char *
+name_to_lower(const char *full_name)
+{
+  Str str = { NULL, 0, 0 };
+  int first = 1;
+
+  str_printf(&str, "%s", "");
+  for (; *full_name; full_name++) {
+    if (*full_name == '.') {
+      str_printf(&str, "__");
+      first = 1;
+      continue;
+    }
+    if (isupper((unsigned char)*full_name) && !first) {
+      str_printf(&str, "_");
+    }
+    str_printf(&str, "%c", tolower((unsigned char)*full_name));
+    first = 0;
+  }
+  return str.s;
+}
+
+/** Names protoc-c appends an underscore to. */
+static const char *keywords[] = {
+  "and", "and_eq", "asm", "auto", "bitand", "bitor", "bool", "break",
+  "case", "catch", "char", "class", "compl", "const", "const_cast",
+  "continue", "default", "delete", "do", "double", "dynamic_cast", "else",
+  "enum", "explicit", "extern", "false", "float", "for", "friend", "goto",
+  "if", "inline", "int", "long", "mutable", "namespace", "new", "not",
+  "not_eq", "operator", "or", "or_eq", "private", "protected", "public",
+  "register", "reinterpret_cast", "return", "short", "signed", "sizeof",
+  "static", "static_cast", "struct", "switch", "template", "this", "throw",
+  "true", "try", "typedef", "typeid", "typename", "union", "unsigned",
+  "using", "virtual", "void", "volatile", "wchar_t", "while", "xor",
+  "xor_eq", NULL
+};
+
+/** The struct member protoc-c uses for a field. */
+static char *
+member_name(const char *name)
+{
+  char *member = xmalloc(strlen(name) + 2);
+  size_t i;
+
+  for (i = 0; name[i]; i++) {
+    member[i] = tolower((unsigned char)name[i]);
+  }
+  member[i] = '\0';
+  for (i = 0; keywords[i]; i++) {
+    if (!strcmp(member, keywords[i])) {
+      strcat(member, "_");
+      break;
+    }
+  }
+  return member;
+}
+
+/** File name without \c .proto on the end. */
+static char *
+strip_proto(const char *name)
+{
+  size_t len = strlen(name);
+
+  if (len > 6 && !strcmp(name + len - 6, ".proto")) {
+    len -= 6;
+  }
+  return xstrndup(name, len);
+}
+
+/** A file name turned into an identifier, as protoc-c does for header
+ * guards. */
+static char *
+file_identifier(const char *name)
+{
+  Str str = { NULL, 0, 0 };
+
+  str_printf(&str, "%s", "");
+  for (; *name; name++) {
+    if (isalnum((unsigned char)*name)) {
+      str_printf(&str, "%c", *name);
+    } else {
+      str_printf(&str, "_%02x", (unsigned char)*name);
+    }
+  }
+  return str.s;
+}
+
+/** Mark a message and everything it contains as needing a printer. */
+static int
+mark_used(Request *req, Message *m, Str *error)
+{
+  size_t i;
+
+  if (m->used) {
+    return 1;
+  }
+  m->used = 1;
+  for (i = 0; i < m->n_fields; i++) {
+    Field *f = &m->fields[i];
+
+    if (f->type == TYPE_GROUP) {
+      str_printf(error, "%s: groups are not supported (%s.%s).",
+          m->file->name, m->full_name, f->name);
+      return 0;
+    } else if (f->type == TYPE_MESSAGE) {
+      Message *sub = f->type_name? find_message(req, f->type_name): NULL;
+
+      if (!sub) {
+        str_printf(error, "%s: unknown type for %s.%s.",
+            m->file->name, m->full_name, f->name);
+        return 0;
+      }
+      if (!mark_used(req, sub, error)) {
+        return 0;
+      }
+    } else if (f->type == TYPE_ENUM) {
+      Enum *e = f->type_name? find_enum(req, f->type_name): NULL;
+
+      if (!e) {
+        str_printf(error, "%s: unknown type for %s.%s.",
+            m->file->name, m->full_name, f->name);
+        return 0;
+      }
+      e->used = 1;
+    }
+  }
+  return 1;
+}
+
+/** Write the function that names the values of an enum. */
+static void
+write_enum_name(Str *c, Enum *e)
+{
+  char *lower = name_to_lower(e->full_name);
+  size_t i, j;
+
+  str_printf(c,
+      "static const char *\n"
+      "%s__text_name(int value)\n"
+      "{\n"
+      "  switch (value) {\n", lower);
+  for (i = 0; i < e->n_values; i++) {
+    /* Aliases share a number; the first name wins. */
+    for (j = 0; j < i; j++) {
+      if (e->values[j].number == e->values[i].number) {
+        break;
+      }
+    }
+    if (j == i) {
+      str_printf(c, "    case %d: return \"%s\";\n",
+          e->values[i].number, e->values[i].name);
+    }
+  }
+  str_printf(c,
+      "    default: return \"unknown\";\n"
+      "  }\n"
+      "}\n\n");
+}
+
+/** Write the statement that prints one value of a field.
+ *
+ * The \c "name: " or \c "name {" prefix is passed to the runtime as a
+ * literal with its length so it is copied with a single \c memcpy .
+ *
+ * \param[in] c Where to write the code.
+ * \param[in] req The request.
+ * \param[in] f The field.
+ * \param[in] value C expression for the value.
+ * \param[in] indent Indent for the statement.
+ */
+static void
+write_field_value(Str *c, Request *req, Field *f, const char *value,
+    const char *indent)
+{
+  size_t plen = strlen(f->name) + 2;
+
+  switch (f->type) {
+    case TYPE_INT32:
+    case TYPE_UINT32:
+    case TYPE_FIXED32:
+      /* protobuf_c_text_to_string() prints int32 as unsigned too. */
+      str_printf(c, "%stext_uint(rs, level, \"%s: \", %zu, (uint32_t)%s);\n",
+          indent, f->name, plen, value);
+      break;
+    case TYPE_INT64:
+    case TYPE_UINT64:
+    case TYPE_FIXED64:
+      str_printf(c, "%stext_uint(rs, level, \"%s: \", %zu, %s);\n",
+          indent, f->name, plen, value);
+      break;
+    case TYPE_SINT32:
+    case TYPE_SFIXED32:
+    case TYPE_SINT64:
+    case TYPE_SFIXED64:
+      str_printf(c, "%stext_int(rs, level, \"%s: \", %zu, %s);\n",
+          indent, f->name, plen, value);
+      break;
+    case TYPE_FLOAT:
+      str_printf(c, "%stext_float(rs, level, \"%s: \", %zu, %s);\n",
+          indent, f->name, plen, value);
+      break;
+    case TYPE_DOUBLE:
+      str_printf(c, "%stext_double(rs, level, \"%s: \", %zu, %s);\n",
+          indent, f->name, plen, value);
+      break;
+    case TYPE_BOOL:
+      str_printf(c, "%stext_line(rs, level, \"%s: \", %zu,\n"
+          "%s    %s? \"true\": \"false\", %s? 4: 5);\n",
+          indent, f->name, plen, indent, value, value);
+      break;
+    case TYPE_ENUM:
+      {
+        char *lower = name_to_lower(find_enum(req, f->type_name)->full_name);
+
+        str_printf(c, "%stext_word(rs, level, \"%s: \", %zu,\n"
+            "%s    %s__text_name(%s));\n",
+            indent, f->name, plen, indent, lower, value);
+      }
+      break;
+    case TYPE_STRING:
+      str_printf(c, "%stext_quoted(rs, level, \"%s: \", %zu,\n"
+          "%s    %s, strlen(%s));\n",
+          indent, f->name, plen, indent, value, value);
+      break;
+    case TYPE_BYTES:
+      str_printf(c, "%stext_quoted(rs, level, \"%s: \", %zu,\n"
+          "%s    %s.data, %s.len);\n",
+          indent, f->name, plen, indent, value, value);
+      break;
+    case TYPE_MESSAGE:
+      {
+        char *lower = name_to_lower(find_message(req, f->type_name)->full_name);
+
+        str_printf(c,
+            "%stext_line(rs, level, \"%s {\", %zu, \"\", 0);\n"
+            "%s%s__print_text(rs, level + 2, %s);\n"
+            "%stext_line(rs, level, \"}\", 1, \"\", 0);\n",
+            indent, f->name, plen, indent, lower, value, indent);
+      }
+      break;
+  }
+}
+
+/** Write the printer for a message. */
+static void
+write_printer(Str *c, Request *req, Message *m)
+{
+  char *type = name_to_c(m->full_name);
+  char *lower = name_to_lower(m->full_name);
+  size_t i;
+  int repeated = 0;
+
+  for (i = 0; i < m->n_fields; i++) {
+    repeated |= m->fields[i].label == LABEL_REPEATED;
+  }
+  str_printf(c,
+      "static void\n"
+      "%s__print_text(TextString *rs, int level, const %s *msg)\n"
+      "{\n", lower, type);
+  if (repeated) {
+    str_printf(c, "  size_t j;\n\n");
+  }
+
+  for (i = 0; i < m->n_fields; i++) {
+    Field *f = &m->fields[i];
+    char *member = member_name(f->name);
+    Str value = { NULL, 0, 0 };
+
+    if (f->label == LABEL_REPEATED) {
+      str_printf(&value, "msg->%s[j]", member);
+      str_printf(c, "  for (j = 0; j < msg->n_%s; j++) {\n", member);
+      write_field_value(c, req, f, value.s, "    ");
+      str_printf(c, "  }\n");
+      continue;
+    }
+
+    str_printf(&value, "msg->%s", member);
+    if (f->oneof_index >= 0 && !f->proto3_optional) {
+      char *oneof = name_to_lower(m->oneofs[f->oneof_index]);
+
+      str_printf(c, "  if (msg->%s_case == %d) {\n", oneof, f->number);
+    } else if (f->label == LABEL_OPTIONAL
+        && (!m->file->proto3 || f->proto3_optional)) {
+      if (f->type == TYPE_STRING) {
+        str_printf(c, "  if (msg->%s\n"
+            "      && msg->%s != (char *)%s__descriptor.fields[%d]"
+            ".default_value) {\n", member, member, lower, f->index);
+      } else if (f->type == TYPE_MESSAGE) {
+        str_printf(c, "  if (msg->%s) {\n", member);
+      } else {
+        str_printf(c, "  if (msg->has_%s) {\n", member);
+      }
+    } else if (f->type == TYPE_MESSAGE && f->label != LABEL_REQUIRED) {
+      /* proto3 message fields are optional by nature. */
+      str_printf(c, "  if (msg->%s) {\n", member);
+    } else {
+      write_field_value(c, req, f, value.s, "  ");
+      continue;
+    }
+    write_field_value(c, req, f, value.s, "    ");
+    str_printf(c, "  }\n");
+  }
+  str_printf(c, "}\n\n");
+}
+
+/** Support functions copied in to each generated \c .c file.
+ *
+ * These build up the text in the same way protobuf_c_text_to_string()
+ * does: each line is reserved once, the constant \c "name: " prefix is
+ * copied in and the value is written with the library's integer, real
+ * and escape functions.  Once a malloc fails every call does nothing and
+ * the result is \c NULL .
+ */
+static const char runtime[] =
+"typedef struct {\n"
+"  ProtobufCAllocator *allocator;\n"
+"  int malloc_err;\n"
+"  size_t allocated;\n"
+"  size_t pos;\n"
+"  char *s;\n"
+"} TextString;\n"
+"\n"
+"static char *\n"
+"text_reserve(TextString *rs, size_t len)\n"
+"{\n"
+"  ProtobufCAllocator *allocator = rs->allocator;\n"
+"  size_t allocated;\n"
+"  char *tmp;\n"
+"\n"
+"  if (rs->malloc_err) {\n"
+"    return NULL;\n"
+"  }\n"
+"  if (rs->allocated - rs->pos > len) {\n"
+"    return rs->s + rs->pos;\n"
+"  }\n"
+"  allocated = rs->allocated * 2;\n"
+"  if (allocated < rs->pos + len + 1) {\n"
+"    allocated = rs->pos + len + 1;\n"
+"  }\n"
+"  tmp = allocator? allocator->alloc(allocator->allocator_data, allocated):\n"
+"    malloc(allocated);\n"
+"  if (tmp && rs->s) {\n"
+"    memcpy(tmp, rs->s, rs->pos);\n"
+"  }\n"
+"  if (rs->s) {\n"
+"    allocator? allocator->free(allocator->allocator_data, rs->s): free(rs->s);\n"
+"  }\n"
+"  rs->s = tmp;\n"
+"  if (!tmp) {\n"
+"    rs->malloc_err = 1;\n"
+"    return NULL;\n"
+"  }\n"
+"  rs->allocated = allocated;\n"
+"  return rs->s + rs->pos;\n"
+"}\n"
+"\n"
+"static void\n"
+"text_line(TextString *rs, int level, const char *prefix, size_t plen,\n"
+"    const char *value, size_t len)\n"
+"{\n"
+"  char *p = text_reserve(rs, level + plen + len + 1);\n"
+"\n"
+"  if (!p) {\n"
+"    return;\n"
+"  }\n"
+"  memset(p, ' ', level);\n"
+"  p += level;\n"
+"  memcpy(p, prefix, plen);\n"
+"  p += plen;\n"
+"  memcpy(p, value, len);\n"
+"  p += len;\n"
+"  *p++ = '\\n';\n"
+"  *p = '\\0';\n"
+"  rs->pos = p - rs->s;\n"
+"}\n"
+"\n"
+"static void\n"
+"text_uint(TextString *rs, int level, const char *prefix, size_t plen,\n"
+"    uint64_t value)\n"
+"{\n"
+"  char buf[PROTOBUF_C_TEXT_INT_MAX];\n"
+"\n"
+"  text_line(rs, level, prefix, plen, buf,\n"
+"      protobuf_c_text_format_uint64(value, buf));\n"
+"}\n"
+"\n"
+"static void\n"
+"text_int(TextString *rs, int level, const char *prefix, size_t plen,\n"
+"    int64_t value)\n"
+"{\n"
+"  char buf[PROTOBUF_C_TEXT_INT_MAX];\n"
+"\n"
+"  text_line(rs, level, prefix, plen, buf,\n"
+"      protobuf_c_text_format_int64(value, buf));\n"
+"}\n"
+"\n"
+"static void\n"
+"text_float(TextString *rs, int level, const char *prefix, size_t plen,\n"
+"    float value)\n"
+"{\n"
+"  char buf[PROTOBUF_C_TEXT_REAL_MAX];\n"
+"\n"
+"  text_line(rs, level, prefix, plen, buf,\n"
+"      protobuf_c_text_format_float(value, buf));\n"
+"}\n"
+"\n"
+"static void\n"
+"text_double(TextString *rs, int level, const char *prefix, size_t plen,\n"
+"    double value)\n"
+"{\n"
+"  char buf[PROTOBUF_C_TEXT_REAL_MAX];\n"
+"\n"
+"  text_line(rs, level, prefix, plen, buf,\n"
+"      protobuf_c_text_format_double(value, buf));\n"
+"}\n"
+"\n"
+"static void\n"
+"text_word(TextString *rs, int level, const char *prefix, size_t plen,\n"
+"    const char *word)\n"
+"{\n"
+"  text_line(rs, level, prefix, plen, word, strlen(word));\n"
+"}\n"
+"\n"
+"static void\n"
+"text_quoted(TextString *rs, int level, const char *prefix, size_t plen,\n"
+"    const void *src, size_t len)\n"
+"{\n"
+"  size_t size = protobuf_c_text_escaped_size(src, len);\n"
+"  char *p = text_reserve(rs, level + plen + size + 3);\n"
+"\n"
+"  if (!p) {\n"
+"    return;\n"
+"  }\n"
+"  memset(p, ' ', level);\n"
+"  p += level;\n"
+"  memcpy(p, prefix, plen);\n"
+"  p += plen;\n"
+"  *p++ = '\"';\n"
+"  p += protobuf_c_text_escape(src, len, p);\n"
+"  *p++ = '\"';\n"
+"  *p++ = '\\n';\n"
+"  *p = '\\0';\n"
+"  rs->pos = p - rs->s;\n"
+"}\n"
+"\n";
+
+/** Generate the \c .pb-c-text.h and \c .pb-c-text.c files for a file. */
+static int
+generate(Request *req, File *file, const char *text_header, Str *h, Str *c,
+    Str *error)
+{
+  char *base = strip_proto(file->name);
+  char *guard = file_identifier(file->name);
+  size_t i;
+
+  for (i = 0; i < req->n_messages; i++) {
+    req->messages[i]->used = 0;
+  }
+  for (i = 0; i < req->n_enums; i++) {
+    req->enums[i]->used = 0;
+  }
+  for (i = 0; i < req->n_messages; i++) {
+    if (req->messages[i]->file == file
+        && !mark_used(req, req->messages[i], error)) {
+      return 0;
+    }
+  }
+
+  /* Header. */
+  str_printf(h,
+      "/* Generated by protoc-gen-c-text.  DO NOT EDIT! */\n"
+      "/* Generated from: %s */\n"
+      "\n"
+      "#ifndef PROTOBUF_C_TEXT_%s__INCLUDED\n"
+      "#define PROTOBUF_C_TEXT_%s__INCLUDED\n"
+      "\n"
+      "#include %s\n"
+      "#include \"%s.pb-c.h\"\n"
+      "\n"
+      "PROTOBUF_C__BEGIN_DECLS\n"
+      "\n", file->name, guard, guard, text_header, base);
+  for (i = 0; i < req->n_messages; i++) {
+    Message *m = req->messages[i];
+    char *type, *lower;
+
+    if (m->file != file) {
+      continue;
+    }
+    type = name_to_c(m->full_name);
+    lower = name_to_lower(m->full_name);
+    str_printf(h,
+        "char *%s__to_text(const %s *message,\n"
+        "    ProtobufCAllocator *allocator);\n",
+        lower, type);
+  }
+  str_printf(h,
+      "\n"
+      "PROTOBUF_C__END_DECLS\n"
+      "\n"
+      "#endif  /* PROTOBUF_C_TEXT_%s__INCLUDED */\n", guard);
+
+  /* Source. */
+  str_printf(c,
+      "/* Generated by protoc-gen-c-text.  DO NOT EDIT! */\n"
+      "/* Generated from: %s */\n"
+      "\n"
+      "#include <stdint.h>\n"
+      "#include <stdlib.h>\n"
+      "#include <string.h>\n"
+      "#include \"%s.pb-c-text.h\"\n"
+      "\n"
+      "%s", file->name, base, runtime);
+  for (i = 0; i < req->n_enums; i++) {
+    if (req->enums[i]->used) {
+      write_enum_name(c, req->enums[i]);
+    }
+  }
+  for (i = 0; i < req->n_messages; i++) {
+    Message *m = req->messages[i];
+
+    if (m->used) {
+      str_printf(c, "static void %s__print_text(TextString *rs, int level,\n"
+          "    const %s *msg);\n",
+          name_to_lower(m->full_name), name_to_c(m->full_name));
+    }
+  }
+  str_printf(c, "\n");
+  for (i = 0; i < req->n_messages; i++) {
+    if (req->messages[i]->used) {
+      write_printer(c, req, req->messages[i]);
+    }
+  }
+  for (i = 0; i < req->n_messages; i++) {
+    Message *m = req->messages[i];
+    char *type, *lower;
+
+    if (m->file != file) {
+      continue;
+    }
+    type = name_to_c(m->full_name);
+    lower = name_to_lower(m->full_name);
+    str_printf(c,
+        "char *\n"
+        "%s__to_text(const %s *message,\n"
+        "    ProtobufCAllocator *allocator)\n"
+        "{\n"
+        "  TextString rs = { allocator, 0, 0, 0, NULL };\n"
+        "\n"
+        "  %s__print_text(&rs, 0, message);\n"
+        "  return rs.s;\n"
+        "}\n"
+        "\n",
+        lower, type, lower);
+  }
+  return 1;
+}
+
+/** Write a varint to a \c Str . */
+static void
+write_varint(Str *out, uint64_t v)
+{
+  do {
+    str_printf(out, "%c", 0);  /* Make room, then overwrite. */
+    out->s[out->len - 1] = (v & 0x7f) | (v > 0x7f? 0x80: 0);
+    v >>= 7;
+  } while (v);
+}
+
+/** Write a length delimited field to a \c Str . */
+static void
+write_bytes(Str *out, uint32_t number, const char *data, size_t len)
+{
+  write_varint(out, ((uint64_t)number << 3) | 2);
+  write_varint(out, len);
+  while (out->size - out->len <= len) {
+    out->size = (out->size + len + 1) * 2;
+    out->s = xrealloc(out->s, out->size);
+  }
+  memcpy(out->s + out->len, data, len);
+  out->len += len;
+}
+
+/** Add a \c CodeGeneratorResponse.File to the response. */
+static void
+write_file(Str *out, const char *name, const Str *content)
+{
+  Str file = { NULL, 0, 0 };
+
+  write_bytes(&file, 1, name, strlen(name));
+  write_bytes(&file, 15, content->s, content->len);
+  write_bytes(out, 15, file.s, file.len);
+}
+
+/** @} */  /* End of plugin group. */
+
+int
+main(int argc, char *argv[])
+{
+  Str in = { NULL, 0, 0 }, out = { NULL, 0, 0 }, error = { NULL, 0, 0 };
+  const char *text_header = "<protobuf-c/protobuf-c-text.h>";
+  Request req;
+  Reader r;
+  size_t i, j, nmemb;
+
+  if (argc > 1) {
+    fprintf(stderr, "Usage: protoc-c --plugin=%s --c-text_out=DIR FILE.proto\n",
+        argv[0]);
+    return 1;
+  }
+
+  do {
+    in.size = in.size? in.size * 2: 64 * 1024;
+    in.s = xrealloc(in.s, in.size);
+    nmemb = fread(in.s + in.len, 1, in.size - in.len, stdin);
+    in.len += nmemb;
+  } while (in.len == in.size);
+  r.p = (const uint8_t *)in.s;
+  r.end = r.p + in.len;
+  if (ferror(stdin) || !decode_request(&req, r)) {
+    fprintf(stderr, "protoc-gen-c-text: can't decode the request.\n");
+    return 1;
+  }
+
+  /* The only parameter is text_header=FILE, the header to include for
+   * the protobuf_c_text API. */
+  if (req.parameter && *req.parameter) {
+    if (strncmp(req.parameter, "text_header=", 12)) {
+      str_printf(&error, "Unknown parameter '%s'.", req.parameter);
+    } else {
+      Str header = { NULL, 0, 0 };
+
+      str_printf(&header, "\"%s\"", req.parameter + 12);
+      text_header = header.s;
+    }
+  }
+
+  for (i = 0; !error.len && i < req.n_to_generate; i++) {
+    for (j = 0; j < req.n_files; j++) {
+      if (!strcmp(req.files[j]->name, req.to_generate[i])) {
+        Str h = { NULL, 0, 0 }, c = { NULL, 0, 0 }, name = { NULL, 0, 0 };
+        char *base = strip_proto(req.files[j]->name);
+
+        if (!generate(&req, req.files[j], text_header, &h, &c, &error)) {
+          break;
+        }
+        str_printf(&name, "%s.pb-c-text.h", base);
+        write_file(&out, name.s, &h);
+        name.len = 0;
+        str_printf(&name, "%s.pb-c-text.c", base);
+        write_file(&out, name.s, &c);
+        break;
+      }
+    }
+  }
+
+  if (error.len) {
+    out.len = 0;
+    write_bytes(&out, 1, error.s, error.len);
+  }
+  /* supported_features: FEATURE_PROTO3_OPTIONAL. */
+  write_varint(&out, (2 << 3) | 0);
+  write_varint(&out, 1);
+  if (out.len && fwrite(out.s, 1, out.len, stdout) != out.len) {
+    fprintf(stderr, "protoc-gen-c-text: can't write the response.\n");
+    return 1;
+  }
+  return 0;
+}
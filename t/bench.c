@@ -0,0 +1,414 @@
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <protobuf-c/protobuf-c.h>
+#include "protobuf-c-text/protobuf-c-text.h"
+#include "addressbook.pb-c.h"
+#include "count-alloc.h"
+
+/** Text being built up for a corpus. */
+typedef struct {
+  char *s;
+  size_t len;
+  size_t size;
+} Text;
+
+/** A shape of input to measure. */
+typedef struct {
+  const char *name;
+  const ProtobufCMessageDescriptor *descriptor;
+  void (*make)(Text *text, size_t n, size_t s);
+  size_t n;  /**< Default element count. */
+  size_t s;  /**< Default string length. */
+  size_t records;  /**< Records in a document for each of the n. */
+  const char *help;
+} Corpus;
+
+/** An operation to measure. */
+typedef enum {
+  OP_FROM_STRING,
+  OP_FROM_FILE,
+  OP_FROM_CONTEXT,
+  OP_TO_STRING
+} Op;
+
+static const char *op_names[] = { "from_string", "from_file", "from_context",
+  "to_string" };
+
+static void
+text_printf(Text *text, const char *fmt, ...)
+{
+  va_list args;
+  int len;
+
+  for (;;) {
+    va_start(args, fmt);
+    len = vsnprintf(text->s + text->len, text->size - text->len, fmt, args);
+    va_end(args);
+    if (len < 0) {
+      perror("vsnprintf");
+      exit(1);
+    }
+    if ((size_t)len < text->size - text->len) {
+      text->len += len;
+      return;
+    }
+    text->size = text->size * 2 + len + 1;
+    text->s = realloc(text->s, text->size);
+    if (!text->s) {
+      perror("realloc");
+      exit(1);
+    }
+  }
+}
+
+/* A quoted string of \c len random bytes, escaped as needed. */
+static void
+text_random(Text *text, size_t len, int binary)
+{
+  unsigned char *raw;
+  char *escaped;
+  size_t i;
+
+  raw = malloc(len + 1);
+  escaped = malloc(len * 4 + 1);
+  if (!raw || !escaped) {
+    perror("malloc");
+    exit(1);
+  }
+  for (i = 0; i < len; i++) {
+    raw[i] = binary? rand() % 256: ' ' + rand() % 95;
+  }
+  escaped[protobuf_c_text_escape(raw, len, escaped)] = '\0';
+  text_printf(text, "\"%s\"", escaped);
+  free(raw);
+  free(escaped);
+}
+
+/* Address book entries with every field set. */
+static void
+make_wide(Text *text, size_t n, size_t s)
+{
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    text_printf(text, "person {\n  name: \"Person %zu\"\n  id: %zu\n"
+        "  email: \"p%zu@example.com\"\n", i, i, i);
+    text_printf(text, "  double_var: %g\n  float_var: %g\n"
+        "  int64_var: %lld\n  uint32_var: %zu\n  uint64_var: %zu\n",
+        i * 1.25, i * 0.5, -(long long)i * 1000003, i, i << 20);
+    text_printf(text, "  sint32_var: -%zu\n  sint64_var: -%zu\n"
+        "  fixed32_var: %zu\n  fixed64_var: %zu\n  sfixed32_var: -%zu\n"
+        "  sfixed64_var: -%zu\n  bool_var: %s\n", i, i, i, i, i, i,
+        i % 2? "true": "false");
+    text_printf(text, "  string_var: ");
+    text_random(text, s, 0);
+    text_printf(text, "\n  bytes_var: ");
+    text_random(text, s, 1);
+    text_printf(text, "\n  phone {\n    number: \"555-%04zu\"\n"
+        "    type: WORK\n  }\n}\n", i % 10000);
+  }
+}
+
+/* One message nested \c n deep. */
+static void
+make_deep(Text *text, size_t n, size_t s)
+{
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    text_printf(text, "id: %zu m {\n", i);
+  }
+  text_printf(text, "id: %zu\n", n);
+  for (i = 0; i < n; i++) {
+    text_printf(text, "}\n");
+  }
+}
+
+/* Long repeated fields of numbers. */
+static void
+make_repeated(Text *text, size_t n, size_t s)
+{
+  size_t i;
+
+  text_printf(text, "rq_str_var: \"s\"\nrq_double_var: 1\nrq_float_var: 1\n"
+      "rq_int64_var: 1\nrq_uint32_var: 1\nrq_uint64_var: 1\n"
+      "rq_sint32_var: 1\nrq_sint64_var: 1\nrq_fixed32_var: 1\n"
+      "rq_fixed64_var: 1\nrq_sfixed32_var: 1\nrq_sfixed64_var: 1\n"
+      "rq_bool_var: true\nrq_bytes_var: \"b\"\n");
+  for (i = 0; i < n; i++) {
+    text_printf(text, "rp_double_var: %g\n", i / 7.0);
+  }
+  for (i = 0; i < n; i++) {
+    text_printf(text, "rp_int64_var: %lld\n", (long long)i * -7919);
+  }
+  for (i = 0; i < n; i++) {
+    text_printf(text, "rp_uint32_var: %zu\n", i);
+  }
+  for (i = 0; i < n; i++) {
+    text_printf(text, "rp_bool_var: %s\n", i % 3? "true": "false");
+  }
+  text_printf(text, "rq_msg {\n  rq_enum_var: BAR\n}\n");
+}
+
+/* Address book entries that are mostly binary data. */
+static void
+make_bytes(Text *text, size_t n, size_t s)
+{
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    text_printf(text, "person {\n  name: \"b%zu\"\n  id: %zu\n"
+        "  bytes_var: ", i, i);
+    text_random(text, s, 1);
+    text_printf(text, "\n}\n");
+  }
+}
+
+/* Address book entries that are mostly printable strings. */
+static void
+make_strings(Text *text, size_t n, size_t s)
+{
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    text_printf(text, "person {\n  name: ");
+    text_random(text, s, 0);
+    text_printf(text, "\n  id: %zu\n  email: ", i);
+    text_random(text, s, 0);
+    text_printf(text, "\n  string_var: ");
+    text_random(text, s, 0);
+    text_printf(text, "\n}\n");
+  }
+}
+
+static const Corpus corpora[] = {
+  { "wide", &tutorial__address_book__descriptor, make_wide, 2000, 16, 1,
+    "n people with every field set, s byte strings" },
+  { "deep", &tutorial__recurse__descriptor, make_deep, 1000, 0, 1,
+    "a Recurse message nested n deep" },
+  { "repeated", &tutorial__test__descriptor, make_repeated, 20000, 0, 4,
+    "four repeated fields of n numbers each" },
+  { "bytes", &tutorial__address_book__descriptor, make_bytes, 200, 4096, 1,
+    "n people with s bytes of binary data" },
+  { "strings", &tutorial__address_book__descriptor, make_strings, 2000, 256,
+    1, "n people with three s byte strings" },
+};
+
+#define N_CORPORA (sizeof(corpora) / sizeof(*corpora))
+
+static double
+now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static ProtobufCMessage *
+parse_or_die(const Corpus *corpus, ProtobufCMessage *msg,
+    ProtobufCTextError *res)
+{
+  if (!msg) {
+    fprintf(stderr, "%s: %s\n", corpus->name,
+        res->error_txt? res->error_txt: "malloc failure");
+    exit(1);
+  }
+  return msg;
+}
+
+/* Measure one operation in a child process so peak RSS is its own.
+ * The child starts out with the parent's pages, corpus included, so
+ * what it had then is taken off the peak.  Rates are per record: each
+ * person, level of nesting or repeated element. */
+static void
+run(const Corpus *corpus, const Text *text, size_t records, Op op,
+    double min_time)
+{
+  ProtobufCTextError res;
+  ProtobufCTextContext *ctx = NULL;
+  ProtobufCMessage *msg = NULL;
+  struct rusage usage;
+  double start, elapsed;
+  size_t iters = 0, bytes = 0, allocs;
+  long base_rss;
+  FILE *f = NULL;
+  char *s;
+  pid_t pid;
+  int status;
+
+  fflush(stdout);
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(1);
+  }
+  if (pid) {
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)
+        || WEXITSTATUS(status)) {
+      fprintf(stderr, "%s %s failed\n", corpus->name, op_names[op]);
+      exit(1);
+    }
+    return;
+  }
+
+  getrusage(RUSAGE_SELF, &usage);
+  base_rss = usage.ru_maxrss;
+  if (op == OP_FROM_FILE) {
+    f = tmpfile();
+    if (!f || fwrite(text->s, 1, text->len, f) != text->len
+        || fflush(f)) {
+      perror("tmpfile");
+      exit(1);
+    }
+  } else if (op == OP_FROM_CONTEXT) {
+    ctx = protobuf_c_text_context_new(&count_allocator);
+    if (!ctx) {
+      fprintf(stderr, "%s: malloc failure\n", corpus->name);
+      exit(1);
+    }
+  } else if (op == OP_TO_STRING) {
+    msg = parse_or_die(corpus, protobuf_c_text_from_string(
+          corpus->descriptor, text->s, &res, NULL), &res);
+  }
+
+  count_alloc_calls = 0;
+  start = now();
+  do {
+    switch (op) {
+      case OP_FROM_STRING:
+        msg = parse_or_die(corpus, protobuf_c_text_from_string(
+              corpus->descriptor, text->s, &res, &count_allocator), &res);
+        protobuf_c_message_free_unpacked(msg, &count_allocator);
+        bytes += text->len;
+        break;
+      case OP_FROM_FILE:
+        rewind(f);
+        msg = parse_or_die(corpus, protobuf_c_text_from_file(
+              corpus->descriptor, f, &res, &count_allocator), &res);
+        protobuf_c_message_free_unpacked(msg, &count_allocator);
+        bytes += text->len;
+        break;
+      case OP_FROM_CONTEXT:
+        msg = parse_or_die(corpus, protobuf_c_text_context_from_buffer(ctx,
+              corpus->descriptor, text->s, text->len, &res), &res);
+        protobuf_c_message_free_unpacked(msg, &count_allocator);
+        bytes += text->len;
+        break;
+      case OP_TO_STRING:
+        s = protobuf_c_text_to_string(msg, &count_allocator);
+        if (!s) {
+          fprintf(stderr, "%s: malloc failure\n", corpus->name);
+          exit(1);
+        }
+        bytes += strlen(s);
+        count_allocator.free(count_allocator.allocator_data, s);
+        break;
+    }
+    iters++;
+    elapsed = now() - start;
+  } while (elapsed < min_time);
+  allocs = count_alloc_calls;
+
+  getrusage(RUSAGE_SELF, &usage);
+  printf("%-10s %-12s %10.1f %12.1f %12.3f %12ld\n", corpus->name,
+      op_names[op], bytes / elapsed / 1e6, iters * records / elapsed,
+      (double)allocs / (iters * records), (long)usage.ru_maxrss - base_rss);
+  exit(0);
+}
+
+/* Whether \c name is one of the comma separated names in \c list. */
+static int
+selected(const char *list, const char *name)
+{
+  size_t len = strlen(name);
+  const char *end;
+
+  for (;;) {
+    end = strchr(list, ',');
+    if (!end) {
+      end = list + strlen(list);
+    }
+    if ((size_t)(end - list) == len && !strncmp(list, name, len)) {
+      return 1;
+    }
+    if (!*end) {
+      return 0;
+    }
+    list = end + 1;
+  }
+}
+
+static void
+usage(const char *prog)
+{
+  size_t i;
+
+  fprintf(stderr, "Usage: %s [-c corpus[,corpus...]] [-n count]"
+      " [-s length] [-t seconds]\n\nCorpora:\n", prog);
+  for (i = 0; i < N_CORPORA; i++) {
+    fprintf(stderr, "  %-10s %s (n=%zu s=%zu)\n", corpora[i].name,
+        corpora[i].help, corpora[i].n, corpora[i].s);
+  }
+  fprintf(stderr, "\nEach operation is repeated for at least -t seconds"
+      " (default 1).\nRates are per record (person, level or repeated"
+      " element); RSS is the\npeak above what the measuring process"
+      " started with.\n");
+  exit(2);
+}
+
+int
+main(int argc, char *argv[])
+{
+  const char *only = NULL;
+  size_t i, n = 0, s = 0, records;
+  double min_time = 1.0;
+  Text text;
+  int opt;
+  Op op;
+
+  while ((opt = getopt(argc, argv, "c:hn:s:t:")) != -1) {
+    switch (opt) {
+      case 'c':
+        only = optarg;
+        break;
+      case 'n':
+        n = strtoul(optarg, NULL, 10);
+        break;
+      case 's':
+        s = strtoul(optarg, NULL, 10);
+        break;
+      case 't':
+        min_time = strtod(optarg, NULL);
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+
+  printf("%-10s %-12s %10s %12s %12s %12s\n", "corpus", "operation",
+      "MB/s", "records/s", "allocs/rec", "RSS KiB");
+  for (i = 0; i < N_CORPORA; i++) {
+    if (only && !selected(only, corpora[i].name)) {
+      continue;
+    }
+    srand(1);
+    memset(&text, 0, sizeof(text));
+    records = (n? n: corpora[i].n) * corpora[i].records;
+    corpora[i].make(&text, n? n: corpora[i].n, s? s: corpora[i].s);
+    for (op = OP_FROM_STRING; op <= OP_TO_STRING; op++) {
+      run(&corpora[i], &text, records, op, min_time);
+    }
+    free(text.s);
+  }
+
+  return 0;
+}
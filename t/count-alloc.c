@@ -0,0 +1,24 @@
+#include <sys/types.h>
+#include <stdlib.h>
+#include <protobuf-c/protobuf-c.h>
+
+size_t count_alloc_calls;
+
+static void *
+count_alloc(void *allocator_data, size_t size)
+{
+  count_alloc_calls++;
+  return malloc(size);
+}
+
+static void
+count_free(void *allocator_data, void *data)
+{
+  free(data);
+}
+
+ProtobufCAllocator count_allocator = {
+        .alloc = &count_alloc,
+        .free = &count_free,
+        .allocator_data = NULL,
+};
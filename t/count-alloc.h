@@ -0,0 +1,7 @@
+#ifndef COUNT_ALLOC_H
+#define COUNT_ALLOC_H
+
+extern ProtobufCAllocator count_allocator;
+extern size_t count_alloc_calls;
+
+#endif /* COUNT_ALLOC_H */
@@ -1,12 +1,18 @@
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <protobuf-c/protobuf-c.h>
 #include "protobuf-c-text/protobuf-c-text.h"
 #include "addressbook.pb-c.h"
+#include "addressbook.pb-c-text.h"
 #include "broken-alloc.h"
 
 #include <check.h>
@@ -62,16 +68,2461 @@ START_TEST(test_deep_nesting)
 }
 END_TEST
 
+START_TEST(test_number_limits)
+{
+  ProtobufCTextError tf_res;
+  Tutorial__Test *msg;
+  Tutorial__Short *short_msg;
+  char buf[PROTOBUF_C_TEXT_INT_MAX];
+
+  msg = (Tutorial__Test *)protobuf_c_text_from_string(
+      &tutorial__test__descriptor,
+      "rp_int64_var: -9223372036854775808\n"
+      "rp_int64_var: 9223372036854775807\n"
+      "rp_uint64_var: 18446744073709551615\n"
+      "rp_sint32_var: -2147483648\n"
+      "rp_uint32_var: 4294967295\n"
+      "rp_double_var: -0.5\n"
+      "rq_msg { rq_enum_var: KITTEN }\n",
+      &tf_res, NULL);
+  ck_assert_msg(tf_res.error_txt == NULL,
+      "There was an unexpected error: \"%s\"", tf_res.error_txt);
+  ck_assert_msg(msg != NULL, "Unexpected malloc failure.");
+  ck_assert_msg(msg->rp_int64_var[0] == INT64_MIN, "Bad INT64_MIN.");
+  ck_assert_msg(msg->rp_int64_var[1] == INT64_MAX, "Bad INT64_MAX.");
+  ck_assert_msg(msg->rp_uint64_var[0] == UINT64_MAX, "Bad UINT64_MAX.");
+  ck_assert_msg(msg->rp_sint32_var[0] == INT32_MIN, "Bad INT32_MIN.");
+  ck_assert_msg(msg->rp_uint32_var[0] == UINT32_MAX, "Bad UINT32_MAX.");
+  ck_assert_msg(msg->rp_double_var[0] == -0.5, "Bad double.");
+  ck_assert_int_eq(msg->rq_msg->rq_enum_var,
+      TUTORIAL__TEST__TEST_ENUM__KITTEN);
+  tutorial__test__free_unpacked(msg, NULL);
+
+  /* The integer formatters the generated code shares. */
+  ck_assert_int_eq(protobuf_c_text_format_uint64(0, buf), 1);
+  ck_assert_msg(!memcmp(buf, "0", 1), "Bad 0.");
+  ck_assert_int_eq(protobuf_c_text_format_uint64(UINT64_MAX, buf),
+      PROTOBUF_C_TEXT_INT_MAX);
+  ck_assert_msg(!memcmp(buf, "18446744073709551615", 20),
+      "Bad UINT64_MAX.");
+  ck_assert_int_eq(protobuf_c_text_format_int64(INT64_MIN, buf), 20);
+  ck_assert_msg(!memcmp(buf, "-9223372036854775808", 20),
+      "Bad INT64_MIN.");
+  ck_assert_int_eq(protobuf_c_text_format_int64(-7, buf), 2);
+  ck_assert_msg(!memcmp(buf, "-7", 2), "Bad -7.");
+
+  /* Out of range. */
+  short_msg = (Tutorial__Short *)protobuf_c_text_from_string(
+      &tutorial__short__descriptor, "id: 4294967296\n", &tf_res, NULL);
+  ck_assert_msg(short_msg == NULL, "Out of range value was accepted.");
+  ck_assert_msg(strstr(tf_res.error_txt, "'4294967296'") != NULL,
+      "Unexpected error: \"%s\"", tf_res.error_txt);
+  free(tf_res.error_txt);
+
+  /* A prefix of a field name isn't a field name. */
+  short_msg = (Tutorial__Short *)protobuf_c_text_from_string(
+      &tutorial__short__descriptor, "i: 1\n", &tf_res, NULL);
+  ck_assert_msg(short_msg == NULL, "Unknown field was accepted.");
+  ck_assert_msg(strstr(tf_res.error_txt, "Can't find field 'i'") != NULL,
+      "Unexpected error: \"%s\"", tf_res.error_txt);
+  free(tf_res.error_txt);
+}
+END_TEST
+
+START_TEST(test_real_round_trip)
+{
+  ProtobufCTextError tf_res;
+  Tutorial__Test *msg, *msg2;
+  char *text;
+  size_t i;
+
+  msg = (Tutorial__Test *)protobuf_c_text_from_string(
+      &tutorial__test__descriptor,
+      "rq_str_var: \"\" rq_double_var: 0 rq_float_var: 0 rq_int64_var: 0\n"
+      "rq_uint32_var: 0 rq_uint64_var: 0 rq_sint32_var: 0\n"
+      "rq_sint64_var: -9223372036854775808 rq_fixed32_var: 0\n"
+      "rq_fixed64_var: 0 rq_sfixed32_var: 0 rq_sfixed64_var: 0\n"
+      "rq_bool_var: false rq_bytes_var: \"\" rq_msg { rq_enum_var: FOO }\n"
+      "rp_double_var: 0.1 rp_double_var: 0.30000000000000004\n"
+      "rp_double_var: 5e-324 rp_double_var: 1.7976931348623157e+308\n"
+      "rp_double_var: 1e21 rp_double_var: -1.5E-7 rp_double_var: 123456.789\n"
+      "rp_double_var: inf rp_double_var: -inf rp_double_var: nan\n"
+      "rp_float_var: 7.8 rp_float_var: 1e-45 rp_float_var: 3.4028235e+38\n"
+      "rp_float_var: 16777216 rp_float_var: 1e+06\n",
+      &tf_res, NULL);
+  ck_assert_msg(tf_res.error_txt == NULL,
+      "There was an unexpected error: \"%s\"", tf_res.error_txt);
+  ck_assert_msg(msg != NULL, "Unexpected malloc failure.");
+
+  text = protobuf_c_text_to_string((ProtobufCMessage *)msg, NULL);
+  ck_assert_msg(text != NULL, "Unexpected malloc failure.");
+  ck_assert_msg(strstr(text,
+        "rq_sint64_var: -9223372036854775808\n") != NULL, "%s", text);
+  ck_assert_msg(strstr(text,
+        "rp_double_var: 0.1\n"
+        "rp_double_var: 0.30000000000000004\n"
+        "rp_double_var: 5e-324\n"
+        "rp_double_var: 1.7976931348623157e+308\n"
+        "rp_double_var: 1e+21\n"
+        "rp_double_var: -1.5e-07\n"
+        "rp_double_var: 123456.789\n"
+        "rp_double_var: inf\n"
+        "rp_double_var: -inf\n"
+        "rp_double_var: nan\n"
+        "rp_float_var: 7.8\n"
+        "rp_float_var: 1e-45\n"
+        "rp_float_var: 3.4028235e+38\n"
+        "rp_float_var: 16777216\n"
+        "rp_float_var: 1e+06\n") != NULL, "%s", text);
+
+  /* Every value reads back exactly. */
+  msg2 = (Tutorial__Test *)protobuf_c_text_from_string(
+      &tutorial__test__descriptor, text, &tf_res, NULL);
+  free(text);
+  ck_assert_msg(tf_res.error_txt == NULL,
+      "There was an unexpected error: \"%s\"", tf_res.error_txt);
+  ck_assert_msg(msg2 != NULL, "Unexpected malloc failure.");
+  ck_assert_int_eq(msg2->n_rp_double_var, msg->n_rp_double_var);
+  ck_assert_int_eq(msg2->n_rp_float_var, msg->n_rp_float_var);
+  for (i = 0; i < msg->n_rp_double_var; i++) {
+    ck_assert_msg(!memcmp(&msg->rp_double_var[i], &msg2->rp_double_var[i],
+          sizeof(double)), "Double %zu changed.", i);
+  }
+  for (i = 0; i < msg->n_rp_float_var; i++) {
+    ck_assert_msg(!memcmp(&msg->rp_float_var[i], &msg2->rp_float_var[i],
+          sizeof(float)), "Float %zu changed.", i);
+  }
+  tutorial__test__free_unpacked(msg, NULL);
+  tutorial__test__free_unpacked(msg2, NULL);
+}
+END_TEST
+
+START_TEST(test_from_buffer)
+{
+  ProtobufCTextError tf_res;
+  Tutorial__Short *msg;
+  /* Parse only the middle of this; there's no nul after the slice. */
+  const char buf[] = { 'i', 'd', ':', ' ', '4', '2', ' ', 't', 'r', 'u', 'e',
+                       'r', ':', ' ', '7', 'x', 'x', 'x' };
+
+  msg = (Tutorial__Short *)protobuf_c_text_from_buffer(
+      &tutorial__short__descriptor, buf, 15, &tf_res, NULL);
+
+  ck_assert_msg(tf_res.error_txt == NULL,
+      "There was an unexpected error: \"%s\"", tf_res.error_txt);
+  ck_assert_msg(msg != NULL, "Unexpected malloc failure.");
+  ck_assert_int_eq(msg->id, 42);
+  ck_assert_int_eq(msg->has_truer, 1);
+  ck_assert_int_eq(msg->truer, 7);
+  tutorial__short__free_unpacked(msg, NULL);
+}
+END_TEST
+
+START_TEST(test_from_fd)
+{
+  ProtobufCTextError tf_res;
+  Tutorial__Short *msg;
+  FILE *f;
+
+  f = tmpfile();
+  ck_assert_msg(f != NULL, "Can't create temp file.");
+  fputs("id: 42\nfalser: \"moo\"\n", f);
+  fflush(f);
+
+  msg = (Tutorial__Short *)protobuf_c_text_from_fd(
+      &tutorial__short__descriptor, fileno(f), &tf_res, NULL);
+  fclose(f);
+
+  ck_assert_msg(tf_res.error_txt == NULL,
+      "There was an unexpected error: \"%s\"", tf_res.error_txt);
+  ck_assert_msg(msg != NULL, "Unexpected malloc failure.");
+  ck_assert_int_eq(msg->id, 42);
+  ck_assert_str_eq(msg->falser, "moo");
+  tutorial__short__free_unpacked(msg, NULL);
+}
+END_TEST
+
+START_TEST(test_long_token_from_file)
+{
+  ProtobufCTextParseOptions options;
+  ProtobufCTextError tf_res;
+  Tutorial__Short *msg;
+  FILE *f;
+  size_t i, len = 300 * 1024, round;
+  /* The default, the smallest and largest, and two brought within
+   * them. */
+  size_t read_sizes[] = { 0, PROTOBUF_C_TEXT_READ_SIZE_MIN,
+    PROTOBUF_C_TEXT_READ_SIZE_MAX, 1, SIZE_MAX };
+
+  /* A string much longer than a read chunk must survive refills. */
+  f = tmpfile();
+  ck_assert_msg(f != NULL, "Can't create temp file.");
+  fputs("id: 42\nfalser: \"", f);
+  for (i = 0; i < len; i++) {
+    fputc('a' + i % 26, f);
+  }
+  fputs("\"\ntruer: 7\n", f);
+
+  memset(&options, 0, sizeof(options));
+  for (round = 0; round < sizeof(read_sizes) / sizeof(read_sizes[0]);
+      round++) {
+    rewind(f);
+    options.read_size = read_sizes[round];
+    msg = (Tutorial__Short *)protobuf_c_text_from_file_ex(
+        &tutorial__short__descriptor, f, &options, &tf_res, NULL);
+
+    ck_assert_msg(tf_res.error_txt == NULL,
+        "There was an unexpected error: \"%s\"", tf_res.error_txt);
+    ck_assert_msg(msg != NULL, "Unexpected malloc failure.");
+    ck_assert_int_eq(strlen(msg->falser), len);
+    for (i = 0; i < len; i++) {
+      ck_assert_int_eq(msg->falser[i], 'a' + i % 26);
+    }
+    ck_assert_int_eq(msg->truer, 7);
+    tutorial__short__free_unpacked(msg, NULL);
+  }
+  fclose(f);
+}
+END_TEST
+
+START_TEST(test_reader)
+{
+  ProtobufCTextParseOptions options;
+  ProtobufCTextError tf_res;
+  ProtobufCTextReader *reader;
+  Tutorial__Short *msg;
+  char *text, *p, *big;
+  size_t i, n = 1000, big_len = 100 * 1024;
+  FILE *f;
+
+  /* Separated records: a separator in a string, a bad record in the
+   * middle and white space at the end. */
+  text = malloc(n * 40 + 100);
+  ck_assert_msg(text != NULL, "Unexpected malloc failure.");
+  p = text;
+  for (i = 0; i < n; i++) {
+    if (i == 10) {
+      p += sprintf(p, "id: 10 falser: \"a\\n---\\nb\\\"\n---\n\"\n---\n");
+    } else if (i == 20) {
+      p += sprintf(p, "id: 20 nope: 1\n---\n");
+    } else {
+      p += sprintf(p, "id: %zu truer: %zu\n---\n", i, i * 2);
+    }
+  }
+  sprintf(p, "  \n");
+  reader = protobuf_c_text_reader_open_buffer(&tutorial__short__descriptor,
+      text, strlen(text), "\n---\n", NULL);
+  ck_assert_msg(reader != NULL, "Unexpected malloc failure.");
+  for (i = 0; i < n; i++) {
+    msg = (Tutorial__Short *)protobuf_c_text_reader_next(reader, &tf_res);
+    if (i == 20) {
+      ck_assert_msg(msg == NULL, "Parsed a bad record.");
+      ck_assert_msg(strstr(tf_res.error_txt, "nope") != NULL,
+          "Wrong error: \"%s\"", tf_res.error_txt);
+      free(tf_res.error_txt);
+      continue;
+    }
+    ck_assert_msg(tf_res.error_txt == NULL,
+        "There was an unexpected error: \"%s\"", tf_res.error_txt);
+    ck_assert_msg(msg != NULL, "Record %zu missing.", i);
+    ck_assert_int_eq(msg->id, i);
+    if (i == 10) {
+      ck_assert_str_eq(msg->falser, "a\n---\nb\"\n---\n");
+    } else {
+      ck_assert_int_eq(msg->truer, i * 2);
+    }
+    tutorial__short__free_unpacked(msg, NULL);
+  }
+  msg = (Tutorial__Short *)protobuf_c_text_reader_next(reader, &tf_res);
+  ck_assert_msg(msg == NULL && tf_res.error_txt == NULL,
+      "Expected the end of the stream.");
+  protobuf_c_text_reader_close(reader);
+  free(text);
+
+  /* Length prefixed records bigger than a read, from a FILE and fd. */
+  big = malloc(big_len + 1);
+  ck_assert_msg(big != NULL, "Unexpected malloc failure.");
+  for (i = 0; i < big_len; i++) {
+    big[i] = 'a' + i % 26;
+  }
+  big[big_len] = '\0';
+  f = tmpfile();
+  ck_assert_msg(f != NULL, "Can't create temp file.");
+  text = malloc(big_len + 100);
+  ck_assert_msg(text != NULL, "Unexpected malloc failure.");
+  for (i = 0; i < 3; i++) {
+    sprintf(text, "id: %zu falser: \"%s\"\n", i, big);
+    fprintf(f, "%zu\n%s", strlen(text), text);
+  }
+  free(text);
+  fprintf(f, "9\nid:");
+  rewind(f);
+  reader = protobuf_c_text_reader_open_file(&tutorial__short__descriptor,
+      f, NULL, NULL);
+  ck_assert_msg(reader != NULL, "Unexpected malloc failure.");
+  for (i = 0; i < 3; i++) {
+    msg = (Tutorial__Short *)protobuf_c_text_reader_next(reader, &tf_res);
+    ck_assert_msg(tf_res.error_txt == NULL,
+        "There was an unexpected error: \"%s\"", tf_res.error_txt);
+    ck_assert_int_eq(msg->id, i);
+    ck_assert_str_eq(msg->falser, big);
+    tutorial__short__free_unpacked(msg, NULL);
+  }
+  msg = (Tutorial__Short *)protobuf_c_text_reader_next(reader, &tf_res);
+  ck_assert_msg(msg == NULL, "Parsed a truncated record.");
+  ck_assert_msg(strstr(tf_res.error_txt, "truncated") != NULL,
+      "Wrong error: \"%s\"", tf_res.error_txt);
+  free(tf_res.error_txt);
+  msg = (Tutorial__Short *)protobuf_c_text_reader_next(reader, &tf_res);
+  ck_assert_msg(msg == NULL && tf_res.error_txt == NULL,
+      "Expected the end of the stream.");
+  protobuf_c_text_reader_close(reader);
+
+  /* All of it in one read. */
+  rewind(f);
+  reader = protobuf_c_text_reader_open_fd(&tutorial__short__descriptor,
+      fileno(f), NULL, NULL);
+  ck_assert_msg(reader != NULL, "Unexpected malloc failure.");
+  memset(&options, 0, sizeof(options));
+  options.read_size = PROTOBUF_C_TEXT_READ_SIZE_MAX;
+  protobuf_c_text_reader_set_options(reader, &options);
+  for (i = 0; i < 3; i++) {
+    msg = (Tutorial__Short *)protobuf_c_text_reader_next(reader, &tf_res);
+    ck_assert_msg(tf_res.error_txt == NULL,
+        "There was an unexpected error: \"%s\"", tf_res.error_txt);
+    ck_assert_int_eq(msg->id, i);
+    tutorial__short__free_unpacked(msg, NULL);
+  }
+  protobuf_c_text_reader_close(reader);
+  fclose(f);
+  free(big);
+}
+END_TEST
+
+/* Parse text serially and on 4 threads; the results must match. */
+static void
+check_parallel(const ProtobufCMessageDescriptor *descriptor,
+    const char *text, int expect_error)
+{
+  ProtobufCTextError serial_res, parallel_res;
+  ProtobufCMessage *serial, *parallel;
+  char *serial_txt, *parallel_txt;
+
+  serial = protobuf_c_text_from_buffer(descriptor, text, strlen(text),
+      &serial_res, NULL);
+  parallel = protobuf_c_text_from_buffer_parallel(descriptor, text,
+      strlen(text), 4, &parallel_res, NULL);
+  if (expect_error) {
+    ck_assert_msg(serial == NULL && parallel == NULL,
+        "Parsed a bad message.");
+    ck_assert_str_eq(serial_res.error_txt, parallel_res.error_txt);
+    free(serial_res.error_txt);
+    free(parallel_res.error_txt);
+    return;
+  }
+  ck_assert_msg(parallel_res.error_txt == NULL,
+      "There was an unexpected error: \"%s\"", parallel_res.error_txt);
+  ck_assert_msg(serial != NULL && parallel != NULL,
+      "Unexpected malloc failure.");
+  ck_assert_int_eq(serial_res.complete, parallel_res.complete);
+  serial_txt = protobuf_c_text_to_string(serial, NULL);
+  parallel_txt = protobuf_c_text_to_string(parallel, NULL);
+  ck_assert_msg(strcmp(serial_txt, parallel_txt) == 0,
+      "Parallel parse differs from serial parse.");
+  free(serial_txt);
+  free(parallel_txt);
+  protobuf_c_message_free_unpacked(serial, NULL);
+  protobuf_c_message_free_unpacked(parallel, NULL);
+}
+
+/** Number of fields in the wide messages built by test_lookup_cache. */
+#define WIDE_FIELDS 200
+/** Number of wide message descriptors. */
+#define WIDE_DESCRIPTORS 64
+
+/** A message with \c WIDE_FIELDS required \c int32 fields. */
+typedef struct {
+  ProtobufCMessage base;
+  int32_t v[WIDE_FIELDS];
+} Wide;
+
+/** Descriptor \c wide_init() gives new messages, one per thread. */
+static __thread const ProtobufCMessageDescriptor *wide_current;
+
+static void
+wide_init(ProtobufCMessage *msg)
+{
+  memset(msg, 0, sizeof(Wide));
+  msg->descriptor = wide_current;
+}
+
+/** Field names, fields and field order for the two wide message types.
+ * Type 0 names its fields a0..a199 and type 1 b0..b199. */
+static char wide_names[2][WIDE_FIELDS][8];
+static ProtobufCFieldDescriptor wide_fields[2][WIDE_FIELDS];
+static unsigned wide_sorted[2][WIDE_FIELDS];
+static const ProtobufCIntRange wide_ranges[] = {
+  { 1, 0 }, { 0, WIDE_FIELDS }
+};
+static ProtobufCMessageDescriptor wide_desc[WIDE_DESCRIPTORS];
+/** Text of a message of each type with field i set to i. */
+static char *wide_text[2];
+
+static int
+wide_name_cmp(const void *a, const void *b)
+{
+  const ProtobufCFieldDescriptor *fields = wide_fields[0];
+
+  return strcmp(fields[*(const unsigned *)a].name,
+      fields[*(const unsigned *)b].name);
+}
+
+/** Make \c desc a wide message of type \c type . */
+static void
+wide_make(ProtobufCMessageDescriptor *desc, int type)
+{
+  memset(desc, 0, sizeof(*desc));
+  desc->magic = PROTOBUF_C__MESSAGE_DESCRIPTOR_MAGIC;
+  desc->name = desc->short_name = desc->c_name = "Wide";
+  desc->package_name = "";
+  desc->sizeof_message = sizeof(Wide);
+  desc->n_fields = WIDE_FIELDS;
+  desc->fields = wide_fields[type];
+  desc->fields_sorted_by_name = wide_sorted[type];
+  desc->n_field_ranges = 1;
+  desc->field_ranges = wide_ranges;
+  desc->message_init = wide_init;
+}
+
+/** Parse \c wide_text[type] as \c desc and check every field.
+ *
+ * \return Non-zero if it parsed correctly.
+ */
+static int
+wide_parse(const ProtobufCMessageDescriptor *desc, int type)
+{
+  ProtobufCTextError tf_res;
+  Wide *msg;
+  int i, ok;
+
+  wide_current = desc;
+  msg = (Wide *)protobuf_c_text_from_string(desc, wide_text[type],
+      &tf_res, NULL);
+  ok = msg && !tf_res.error_txt;
+  for (i = 0; ok && i < WIDE_FIELDS; i++) {
+    ok = msg->v[i] == i;
+  }
+  if (msg) {
+    protobuf_c_message_free_unpacked(&msg->base, NULL);
+  }
+  free(tf_res.error_txt);
+  return ok;
+}
+
+static void *
+wide_thread(void *arg)
+{
+  size_t fails = 0;
+  int round, i;
+
+  for (round = 0; round < 20; round++) {
+    for (i = 0; i < WIDE_DESCRIPTORS; i++) {
+      int d = (i + (int)(intptr_t)arg * 7) % WIDE_DESCRIPTORS;
+
+      fails += !wide_parse(&wide_desc[d], d & 1);
+    }
+  }
+  return (void *)fails;
+}
+
+START_TEST(test_lookup_cache)
+{
+  pthread_t threads[4];
+  int type, i;
+  char *p;
+
+  for (type = 0; type < 2; type++) {
+    wide_text[type] = p = malloc(WIDE_FIELDS * 16);
+    ck_assert_msg(p != NULL, "Unexpected malloc failure.");
+    for (i = 0; i < WIDE_FIELDS; i++) {
+      ProtobufCFieldDescriptor *field = &wide_fields[type][i];
+
+      sprintf(wide_names[type][i], "%c%d", 'a' + type, i);
+      field->name = wide_names[type][i];
+      field->id = i + 1;
+      field->label = PROTOBUF_C_LABEL_REQUIRED;
+      field->type = PROTOBUF_C_TYPE_INT32;
+      field->offset = offsetof(Wide, v) + i * sizeof(int32_t);
+      wide_sorted[type][i] = i;
+      p += sprintf(p, "%s: %d\n", field->name, i);
+    }
+  }
+  qsort(wide_sorted[0], WIDE_FIELDS, sizeof(unsigned), wide_name_cmp);
+  memcpy(wide_sorted[1], wide_sorted[0], sizeof(wide_sorted[0]));
+  for (i = 0; i < WIDE_DESCRIPTORS; i++) {
+    wide_make(&wide_desc[i], i & 1);
+  }
+
+  /* Many descriptors, each looked up by several parsers at once. */
+  for (i = 0; i < 4; i++) {
+    ck_assert_int_eq(pthread_create(&threads[i], NULL, wide_thread,
+          (void *)(intptr_t)i), 0);
+  }
+  for (i = 0; i < 4; i++) {
+    void *fails;
+
+    ck_assert_int_eq(pthread_join(threads[i], &fails), 0);
+    ck_assert_msg(fails == NULL, "%zu wide parses failed.", (size_t)fails);
+  }
+
+  /* A new descriptor at an old one's address mustn't use its table. */
+  for (i = 0; i < WIDE_DESCRIPTORS; i++) {
+    wide_make(&wide_desc[i], !(i & 1));
+  }
+  for (i = 0; i < WIDE_DESCRIPTORS; i++) {
+    ck_assert_msg(wide_parse(&wide_desc[i], !(i & 1)),
+        "Parse with reused descriptor %d failed.", i);
+  }
+  free(wide_text[0]);
+  free(wide_text[1]);
+}
+END_TEST
+
+START_TEST(test_parallel_parse)
+{
+  ProtobufCTextError tf_res;
+  Tutorial__AddressBook *book;
+  char *text, *p;
+  size_t i, n = 50000;
+  FILE *f;
+
+  /* Braces and quotes in strings mustn't fool the split. */
+  text = malloc(n * 100 + 1000);
+  ck_assert_msg(text != NULL, "Unexpected malloc failure.");
+  p = text;
+  for (i = 0; i < n; i++) {
+    p += sprintf(p, "person {\n  name: \"}{ \\\"%zu\"\n  id: %zu\n"
+        "  phone {\n    number: \"%zu\"\n  }\n}\n", i, i, i * 7);
+  }
+  check_parallel(&tutorial__address_book__descriptor, text, 0);
+
+  f = tmpfile();
+  ck_assert_msg(f != NULL, "Can't create temp file.");
+  fputs(text, f);
+  fflush(f);
+  book = (Tutorial__AddressBook *)protobuf_c_text_from_fd_parallel(
+      &tutorial__address_book__descriptor, fileno(f), 0, &tf_res, NULL);
+  fclose(f);
+  ck_assert_msg(tf_res.error_txt == NULL,
+      "There was an unexpected error: \"%s\"", tf_res.error_txt);
+  ck_assert_int_eq(book->n_person, n);
+  for (i = 0; i < n; i++) {
+    ck_assert_int_eq(book->person[i]->id, i);
+  }
+  tutorial__address_book__free_unpacked(book, NULL);
+
+  /* An error in the middle is reported as a serial parse would. */
+  memcpy(strstr(text + strlen(text) / 2, "id:"), "xx", 2);
+  check_parallel(&tutorial__address_book__descriptor, text, 1);
+
+  /* Required fields take the last value; repeated fields concatenate. */
+  p = text;
+  p += sprintf(p, "rq_str_var: \"first\"\nrq_double_var: 1.5\n");
+  for (i = 0; i < n; i++) {
+    p += sprintf(p, "rp_str_var: \"%zu\"\nrp_uint32_var: %zu\n", i, i);
+  }
+  p += sprintf(p, "rq_msg {\n  rq_enum_var: FOO\n}\n");
+  for (i = 0; i < n / 2; i++) {
+    p += sprintf(p, "rp_str_var: \"{%zu\"\nrp_uint32_var: %zu\n", i, i);
+  }
+  p += sprintf(p, "rq_double_var: 2.5\nopt_msg {\n  rq_enum_var: BAR\n}\n");
+  for (i = 0; i < n / 2; i++) {
+    p += sprintf(p, "rp_bool_var: true\nrp_double_var: %zu.5\n", i);
+  }
+  p += sprintf(p, "rq_bytes_var: \"\\001\"\n");
+  check_parallel(&tutorial__test__descriptor, text, 0);
+
+  /* An optional message assigned twice is an error either way, even
+   * when the two are parsed on different threads. */
+  memmove(text + 31, text, p - text + 1);
+  memcpy(text, "opt_msg {\n  rq_enum_var: FOO\n}\n", 31);
+  check_parallel(&tutorial__test__descriptor, text, 1);
+
+  free(text);
+}
+END_TEST
+
+/* Feed text to a push parser in pieces of \c step bytes; the result
+ * must match parsing it in one go. */
+static void
+check_push(const ProtobufCMessageDescriptor *descriptor,
+    const char *text, size_t step)
+{
+  ProtobufCTextError whole_res, push_res;
+  ProtobufCTextParser *parser;
+  ProtobufCTextParserStatus status = PROTOBUF_C_TEXT_PARSER_NEED_MORE;
+  ProtobufCMessage *whole, *pushed;
+  char *whole_txt, *pushed_txt;
+  size_t i, len = strlen(text), n;
+
+  whole = protobuf_c_text_from_buffer(descriptor, text, len, &whole_res,
+      NULL);
+  parser = protobuf_c_text_parser_new(descriptor, NULL);
+  ck_assert_msg(parser != NULL, "Unexpected malloc failure.");
+  for (i = 0; i < len && status == PROTOBUF_C_TEXT_PARSER_NEED_MORE;
+      i += n) {
+    n = len - i < step? len - i: step;
+    status = protobuf_c_text_parser_feed(parser, text + i, n);
+  }
+  if (status == PROTOBUF_C_TEXT_PARSER_NEED_MORE) {
+    status = protobuf_c_text_parser_feed(parser, NULL, 0);
+  }
+  pushed = protobuf_c_text_parser_finish(parser, &push_res);
+
+  if (!whole) {
+    ck_assert_int_eq(status, PROTOBUF_C_TEXT_PARSER_ERROR);
+    ck_assert_msg(pushed == NULL, "Parsed a bad message.");
+    ck_assert_str_eq(push_res.error_txt, whole_res.error_txt);
+    free(whole_res.error_txt);
+    free(push_res.error_txt);
+    return;
+  }
+  ck_assert_int_eq(status, PROTOBUF_C_TEXT_PARSER_DONE);
+  ck_assert_msg(push_res.error_txt == NULL,
+      "There was an unexpected error: \"%s\"", push_res.error_txt);
+  ck_assert_msg(pushed != NULL, "Unexpected malloc failure.");
+  ck_assert_int_eq(push_res.complete, whole_res.complete);
+  whole_txt = protobuf_c_text_to_string(whole, NULL);
+  pushed_txt = protobuf_c_text_to_string(pushed, NULL);
+  ck_assert_str_eq(pushed_txt, whole_txt);
+  free(whole_txt);
+  free(pushed_txt);
+  protobuf_c_message_free_unpacked(whole, NULL);
+  protobuf_c_message_free_unpacked(pushed, NULL);
+}
+
+START_TEST(test_push_parser)
+{
+  static const size_t steps[] = { 1, 2, 3, 7, 64, 4096 };
+  ProtobufCTextError tf_res;
+  ProtobufCTextParser *parser;
+  Tutorial__Short *msg;
+  char *text, *p;
+  size_t i, n = 200;
+
+  text = malloc(n * 120 + 5000);
+  ck_assert_msg(text != NULL, "Unexpected malloc failure.");
+  p = text;
+  for (i = 0; i < n; i++) {
+    p += sprintf(p, "person {\n  name: \"p\\\"%zu\\\\\"\n  id: %zu\n"
+        "  double_var: -1.5e%zu\n  bool_var: %s\n"
+        "  phone { number: \"%zu\" type: WORK }\n}\n",
+        i, i, i % 30, i % 2? "true": "false", i * 3);
+  }
+  p += sprintf(p, "person { name: \"");
+  for (i = 0; i < 3000; i++) {
+    *p++ = i % 100? 'a' + i % 26: '\\';
+    if (i % 100 == 0) {
+      *p++ = 'n';
+    }
+  }
+  sprintf(p, "\" id: 0 }");
+  for (i = 0; i < sizeof(steps) / sizeof(*steps); i++) {
+    check_push(&tutorial__address_book__descriptor, text, steps[i]);
+  }
+
+  /* Errors, and text that ends in the middle of things. */
+  for (i = 0; i < sizeof(steps) / sizeof(*steps); i++) {
+    check_push(&tutorial__address_book__descriptor,
+        "person { name: \"a\" id: 1 nope: 2 }", steps[i]);
+    check_push(&tutorial__address_book__descriptor,
+        "person { name: \"a\" id: 1 }\nperson { name: \"unterminated",
+        steps[i]);
+    check_push(&tutorial__address_book__descriptor,
+        "person { name: \"a\" id: 1", steps[i]);
+    check_push(&tutorial__short__descriptor, "id: 12345", steps[i]);
+    check_push(&tutorial__short__descriptor, "id: 1 truer: 2", steps[i]);
+    check_push(&tutorial__short__descriptor, "", steps[i]);
+  }
+  free(text);
+
+  /* An error is reported as soon as it is seen, and finish ends the
+   * input itself. */
+  parser = protobuf_c_text_parser_new(&tutorial__short__descriptor, NULL);
+  ck_assert_msg(parser != NULL, "Unexpected malloc failure.");
+  ck_assert_int_eq(protobuf_c_text_parser_feed(parser, "id: 4", 5),
+      PROTOBUF_C_TEXT_PARSER_NEED_MORE);
+  ck_assert_int_eq(protobuf_c_text_parser_feed(parser, "2 truer", 7),
+      PROTOBUF_C_TEXT_PARSER_NEED_MORE);
+  msg = (Tutorial__Short *)protobuf_c_text_parser_finish(parser, &tf_res);
+  ck_assert_msg(msg == NULL, "Parsed a bad message.");
+  ck_assert_str_eq(tf_res.error_txt, "Error found on line 1.\n"
+      "Expected ':' or '{'; found '[EOF]' instead.");
+  free(tf_res.error_txt);
+
+  parser = protobuf_c_text_parser_new(&tutorial__short__descriptor, NULL);
+  ck_assert_msg(parser != NULL, "Unexpected malloc failure.");
+  ck_assert_int_eq(protobuf_c_text_parser_feed(parser, "id: 4\n} ", 8),
+      PROTOBUF_C_TEXT_PARSER_ERROR);
+  ck_assert_int_eq(protobuf_c_text_parser_feed(parser, "id: 5", 5),
+      PROTOBUF_C_TEXT_PARSER_ERROR);
+  msg = (Tutorial__Short *)protobuf_c_text_parser_finish(parser, &tf_res);
+  ck_assert_msg(msg == NULL, "Parsed a bad message.");
+  ck_assert_str_eq(tf_res.error_txt, "Error found on line 2.\n"
+      "Extra closing brace found.");
+  free(tf_res.error_txt);
+
+  parser = protobuf_c_text_parser_new(&tutorial__short__descriptor, NULL);
+  ck_assert_msg(parser != NULL, "Unexpected malloc failure.");
+  ck_assert_int_eq(protobuf_c_text_parser_feed(parser, "truer: 1 ", 9),
+      PROTOBUF_C_TEXT_PARSER_NEED_MORE);
+  ck_assert_int_eq(protobuf_c_text_parser_feed(parser,
+        "truer: 2          ", 18), PROTOBUF_C_TEXT_PARSER_ERROR);
+  msg = (Tutorial__Short *)protobuf_c_text_parser_finish(parser, &tf_res);
+  ck_assert_msg(msg == NULL, "Parsed a bad message.");
+  ck_assert_msg(strstr(tf_res.error_txt, "already been assigned") != NULL,
+      "Wrong error: \"%s\"", tf_res.error_txt);
+  free(tf_res.error_txt);
+
+  parser = protobuf_c_text_parser_new(&tutorial__short__descriptor, NULL);
+  ck_assert_msg(parser != NULL, "Unexpected malloc failure.");
+  ck_assert_int_eq(protobuf_c_text_parser_feed(parser, "id: 42", 6),
+      PROTOBUF_C_TEXT_PARSER_NEED_MORE);
+  msg = (Tutorial__Short *)protobuf_c_text_parser_finish(parser, &tf_res);
+  ck_assert_msg(msg != NULL, "Unexpected malloc failure.");
+  ck_assert_int_eq(msg->id, 42);
+  tutorial__short__free_unpacked(msg, NULL);
+}
+END_TEST
+
+/** Parse \c text within \c options and check it fails with \c error , or
+ * succeeds if \c error is \c NULL . */
+static void
+check_limit(const ProtobufCMessageDescriptor *descriptor, const char *text,
+    const ProtobufCTextParseOptions *options, const char *error)
+{
+  ProtobufCTextError tf_res;
+  ProtobufCMessage *msg;
+
+  msg = protobuf_c_text_from_buffer_ex(descriptor, text, strlen(text),
+      options, &tf_res, NULL);
+  if (!error) {
+    ck_assert_msg(tf_res.error_txt == NULL,
+        "There was an unexpected error: \"%s\"", tf_res.error_txt);
+    ck_assert_msg(msg != NULL, "Unexpected malloc failure.");
+    protobuf_c_message_free_unpacked(msg, NULL);
+    return;
+  }
+  ck_assert_msg(msg == NULL, "Parsed past a limit.");
+  ck_assert_msg(tf_res.error_txt != NULL, "Expected an error message.");
+  ck_assert_msg(strstr(tf_res.error_txt, error) != NULL,
+      "Expected \"%s\" but got \"%s\"", error, tf_res.error_txt);
+  free(tf_res.error_txt);
+}
+
+START_TEST(test_parse_limits)
+{
+  ProtobufCTextParseOptions options;
+  ProtobufCTextError tf_res;
+  ProtobufCMessage *msg;
+  char book[] = "person { name: \"abcdef\" id: 1 }\n"
+    "person { name: \"\\x41\\x42\" id: 2 }\n"
+    "person { name: \"c\" id: 3 phone { number: \"1\" } }\n";
+  char *big, *p;
+  size_t i;
+  FILE *f;
+
+  /* No options, or all zero, is no limit. */
+  check_limit(&tutorial__address_book__descriptor, book, NULL, NULL);
+  memset(&options, 0, sizeof(options));
+  check_limit(&tutorial__address_book__descriptor, book, &options, NULL);
+
+  options.max_bytes = strlen(book);
+  check_limit(&tutorial__address_book__descriptor, book, &options, NULL);
+  options.max_bytes = 10;
+  check_limit(&tutorial__address_book__descriptor, book, &options,
+      "Input is longer than the 10 byte limit.");
+  f = tmpfile();
+  ck_assert_msg(f != NULL, "Can't create temp file.");
+  fputs(book, f);
+  rewind(f);
+  msg = protobuf_c_text_from_file_ex(&tutorial__address_book__descriptor,
+      f, &options, &tf_res, NULL);
+  fclose(f);
+  ck_assert_msg(msg == NULL, "Parsed past a limit.");
+  ck_assert_str_eq(tf_res.error_txt, "Error found on line 1.\n"
+      "Input is longer than the 10 byte limit.");
+  free(tf_res.error_txt);
+
+  memset(&options, 0, sizeof(options));
+  options.max_depth = 3;
+  check_limit(&tutorial__address_book__descriptor, book, &options, NULL);
+  options.max_depth = 2;
+  check_limit(&tutorial__address_book__descriptor, book, &options,
+      "Error found on line 3.\nMessages nested more than 2 deep.");
+
+  memset(&options, 0, sizeof(options));
+  options.max_repeated = 3;
+  check_limit(&tutorial__address_book__descriptor, book, &options, NULL);
+  options.max_repeated = 2;
+  check_limit(&tutorial__address_book__descriptor, book, &options,
+      "More than 2 elements in 'person'.");
+
+  /* Strings are measured once unescaped. */
+  memset(&options, 0, sizeof(options));
+  options.max_string = 6;
+  check_limit(&tutorial__address_book__descriptor, book, &options, NULL);
+  options.max_string = 2;
+  check_limit(&tutorial__address_book__descriptor, book, &options,
+      "Value for 'name' is longer than 2 bytes.");
+  check_limit(&tutorial__address_book__descriptor,
+      "person { name: \"\\x41\\x42\" id: 2 bytes_var: \"abc\" }",
+      &options, "Value for 'bytes_var' is longer than 2 bytes.");
+
+  /* A big parse runs out of allocation. */
+  big = malloc(1000 * 40 + 1);
+  ck_assert_msg(big != NULL, "Unexpected malloc failure.");
+  p = big;
+  for (i = 0; i < 1000; i++) {
+    p += sprintf(p, "person { name: \"p%zu\" id: %zu }\n", i, i);
+  }
+  memset(&options, 0, sizeof(options));
+  options.max_alloc = 1024 * 1024;
+  check_limit(&tutorial__address_book__descriptor, big, &options, NULL);
+  options.max_alloc = 4096;
+  check_limit(&tutorial__address_book__descriptor, big, &options,
+      "Parse needs more than the 4096 byte allocation limit.");
+  free(big);
+  options.max_alloc = 1;
+  msg = protobuf_c_text_from_buffer_ex(&tutorial__address_book__descriptor,
+      book, strlen(book), &options, &tf_res, NULL);
+  ck_assert_msg(msg == NULL, "Parsed past a limit.");
+  ck_assert_msg(tf_res.error_txt == NULL, "Unexpected error text.");
+}
+END_TEST
+
+START_TEST(test_context)
+{
+  ProtobufCTextContext *ctx;
+  ProtobufCTextError tf_res;
+  ProtobufCMessage *msg, *want;
+  char book[] = "person { name: \"a\" id: 1 }\n"
+    "person { name: \"b\" id: 2 phone { number: \"1\" } }";
+  char recurse[] = "id: 1 m { id: 2 m { id: 3 } }";
+  char *big, *p, *text, *want_text;
+  size_t i;
+  int round;
+  FILE *f;
+
+  ctx = protobuf_c_text_context_new(NULL);
+  ck_assert_msg(ctx != NULL, "Unexpected malloc failure.");
+  want = protobuf_c_text_from_string(&tutorial__address_book__descriptor,
+      book, &tf_res, NULL);
+  ck_assert_msg(want != NULL, "Unexpected malloc failure.");
+  want_text = protobuf_c_text_to_string(want, NULL);
+  protobuf_c_message_free_unpacked(want, NULL);
+
+  /* Different types, errors and both sources, over and over. */
+  for (round = 0; round < 3; round++) {
+    msg = protobuf_c_text_context_from_buffer(ctx,
+        &tutorial__address_book__descriptor, book, strlen(book), &tf_res);
+    ck_assert_msg(tf_res.error_txt == NULL,
+        "There was an unexpected error: \"%s\"", tf_res.error_txt);
+    text = protobuf_c_text_to_string(msg, NULL);
+    ck_assert_str_eq(text, want_text);
+    free(text);
+    protobuf_c_message_free_unpacked(msg, NULL);
+
+    msg = protobuf_c_text_context_from_buffer(ctx,
+        &tutorial__recurse__descriptor, recurse, strlen(recurse), &tf_res);
+    ck_assert_msg(tf_res.error_txt == NULL,
+        "There was an unexpected error: \"%s\"", tf_res.error_txt);
+    ck_assert_int_eq(((Tutorial__Recurse *)msg)->m->m->id, 3);
+    protobuf_c_message_free_unpacked(msg, NULL);
+
+    msg = protobuf_c_text_context_from_buffer(ctx,
+        &tutorial__recurse__descriptor, book, strlen(book), &tf_res);
+    ck_assert_msg(msg == NULL, "Parsed a bad message.");
+    ck_assert_str_eq(tf_res.error_txt, "Error found on line 1.\n"
+        "Can't find field 'person' in message 'tutorial.Recurse'.");
+    free(tf_res.error_txt);
+
+    f = tmpfile();
+    ck_assert_msg(f != NULL, "Can't create temp file.");
+    fputs(book, f);
+    rewind(f);
+    msg = protobuf_c_text_context_from_file(ctx,
+        &tutorial__address_book__descriptor, f, &tf_res);
+    fclose(f);
+    ck_assert_msg(tf_res.error_txt == NULL,
+        "There was an unexpected error: \"%s\"", tf_res.error_txt);
+    text = protobuf_c_text_to_string(msg, NULL);
+    ck_assert_str_eq(text, want_text);
+    free(text);
+    protobuf_c_message_free_unpacked(msg, NULL);
+  }
+  free(want_text);
+
+  /* A token at the end longer than any buffer kept so far. */
+  big = malloc(20000 + 20);
+  ck_assert_msg(big != NULL, "Unexpected malloc failure.");
+  p = big + sprintf(big, "id: 1 name: \"");
+  for (i = 0; i < 20000; i++) {
+    *p++ = 'a' + i % 26;
+  }
+  strcpy(p, "\"");
+  msg = protobuf_c_text_context_from_buffer(ctx,
+      &tutorial__person__descriptor, big, strlen(big), &tf_res);
+  ck_assert_msg(tf_res.error_txt == NULL,
+      "There was an unexpected error: \"%s\"", tf_res.error_txt);
+  ck_assert_int_eq(strlen(((Tutorial__Person *)msg)->name), 20000);
+  protobuf_c_message_free_unpacked(msg, NULL);
+  free(big);
+
+  protobuf_c_text_context_free(ctx);
+  protobuf_c_text_context_free(NULL);
+}
+END_TEST
+
+/* Merge \c delta into \c base and check it gives \c want . */
+static void
+check_merge(const ProtobufCMessageDescriptor *descriptor, char *base,
+    char *delta, ProtobufCTextMergePolicy policy, char *want)
+{
+  ProtobufCTextError tf_res;
+  ProtobufCMessage *msg, *want_msg;
+  char *text, *want_text;
+
+  msg = protobuf_c_text_from_string(descriptor, base, &tf_res, NULL);
+  ck_assert_msg(msg != NULL, "Unexpected malloc failure.");
+  ck_assert_int_eq(protobuf_c_text_merge(msg, delta, strlen(delta), policy,
+        &tf_res, NULL), 1);
+  ck_assert_msg(tf_res.error_txt == NULL,
+      "There was an unexpected error: \"%s\"", tf_res.error_txt);
+  want_msg = protobuf_c_text_from_string(descriptor, want, &tf_res, NULL);
+  ck_assert_msg(want_msg != NULL, "Unexpected malloc failure.");
+  text = protobuf_c_text_to_string(msg, NULL);
+  want_text = protobuf_c_text_to_string(want_msg, NULL);
+  ck_assert_str_eq(text, want_text);
+  free(text);
+  free(want_text);
+  protobuf_c_message_free_unpacked(want_msg, NULL);
+  protobuf_c_message_free_unpacked(msg, NULL);
+}
+
+/** The required scalars of a \c tutorial.Test message. */
+#define TEST_REQUIRED \
+  "rq_str_var: \"s\" rq_double_var: 1 rq_float_var: 1 rq_int64_var: 1" \
+  " rq_uint32_var: 1 rq_uint64_var: 1 rq_sint32_var: 1 rq_sint64_var: 1" \
+  " rq_fixed32_var: 1 rq_fixed64_var: 1 rq_sfixed32_var: 1" \
+  " rq_sfixed64_var: 1 rq_bool_var: true rq_bytes_var: \"b\" "
+
+START_TEST(test_merge)
+{
+  ProtobufCTextError tf_res;
+  ProtobufCMessage *msg;
+  char person[] = "name: \"a\" id: 1 email: \"e\" bytes_var: \"b\"\n"
+    "phone { number: \"1\" } phone { number: \"2\" type: WORK }";
+  char bad[] = "name: \"c\" nosuch: 1";
+
+  /* Scalars, strings and bytes overwrite, even twice over. */
+  check_merge(&tutorial__person__descriptor, person,
+      "id: 2 name: \"bb\" name: \"ccc\" bytes_var: \"x\"",
+      PROTOBUF_C_TEXT_MERGE_APPEND,
+      "name: \"ccc\" id: 2 email: \"e\" bytes_var: \"x\"\n"
+      "phone { number: \"1\" } phone { number: \"2\" type: WORK }");
+
+  /* Repeated fields are appended to or replaced. */
+  check_merge(&tutorial__person__descriptor, person,
+      "phone { number: \"3\" }", PROTOBUF_C_TEXT_MERGE_APPEND,
+      "name: \"a\" id: 1 email: \"e\" bytes_var: \"b\"\n"
+      "phone { number: \"1\" } phone { number: \"2\" type: WORK }\n"
+      "phone { number: \"3\" }");
+  check_merge(&tutorial__person__descriptor, person,
+      "phone { number: \"3\" } id: 4 phone { number: \"4\" }",
+      PROTOBUF_C_TEXT_MERGE_REPLACE,
+      "name: \"a\" id: 4 email: \"e\" bytes_var: \"b\"\n"
+      "phone { number: \"3\" } phone { number: \"4\" }");
+  check_merge(&tutorial__person__descriptor, person, "",
+      PROTOBUF_C_TEXT_MERGE_REPLACE, person);
+
+  /* Messages that are set are merged into. */
+  check_merge(&tutorial__recurse__descriptor,
+      "id: 1 m { id: 2 m { id: 3 } }", "m { m { id: 4 m { id: 5 } } }",
+      PROTOBUF_C_TEXT_MERGE_APPEND,
+      "id: 1 m { id: 2 m { id: 4 m { id: 5 } } }");
+  check_merge(&tutorial__address_book__descriptor,
+      "person { name: \"a\" id: 1 phone { number: \"1\" } }",
+      "person { name: \"b\" id: 2 }", PROTOBUF_C_TEXT_MERGE_REPLACE,
+      "person { name: \"b\" id: 2 }");
+
+  /* A field replaced once keeps what the merge added, however often
+   * its message is opened. */
+  check_merge(&tutorial__test__descriptor,
+      TEST_REQUIRED "rq_msg { rq_enum_var: BAR rp_enum_var: FOO"
+      " rp_enum_var: FOO rp_enum_var: FOO }",
+      "rq_msg { rp_enum_var: BAR } rq_msg { rp_enum_var: BAR }",
+      PROTOBUF_C_TEXT_MERGE_REPLACE,
+      TEST_REQUIRED "rq_msg { rq_enum_var: BAR rp_enum_var: BAR"
+      " rp_enum_var: BAR }");
+  check_merge(&tutorial__test__descriptor, TEST_REQUIRED,
+      "rq_msg { rq_enum_var: BAR rp_enum_var: BAR }"
+      " rq_msg { rp_enum_var: KITTEN }",
+      PROTOBUF_C_TEXT_MERGE_REPLACE,
+      TEST_REQUIRED "rq_msg { rq_enum_var: BAR rp_enum_var: BAR"
+      " rp_enum_var: KITTEN }");
+
+  /* An error leaves a valid message behind. */
+  msg = protobuf_c_text_from_string(&tutorial__person__descriptor, person,
+      &tf_res, NULL);
+  ck_assert_msg(msg != NULL, "Unexpected malloc failure.");
+  ck_assert_int_eq(protobuf_c_text_merge(msg, bad, strlen(bad),
+        PROTOBUF_C_TEXT_MERGE_APPEND, &tf_res, NULL), 0);
+  ck_assert_str_eq(tf_res.error_txt, "Error found on line 1.\n"
+      "Can't find field 'nosuch' in message 'tutorial.Person'.");
+  free(tf_res.error_txt);
+  ck_assert_str_eq(((Tutorial__Person *)msg)->name, "c");
+  protobuf_c_message_free_unpacked(msg, NULL);
+}
+END_TEST
+
+START_TEST(test_quoted_strings)
+{
+  ProtobufCTextError tf_res;
+  Tutorial__Short *msg;
+  Tutorial__Person *person, *person2;
+  unsigned char bytes[256];
+  char *text;
+  FILE *f;
+  size_t i, n = 40000;
+
+  /* Every escape, a string ending in an escaped backslash and escapes
+   * either side of a vector boundary. */
+  msg = (Tutorial__Short *)protobuf_c_text_from_string(
+      &tutorial__short__descriptor,
+      "id: 1 falser: \"0123456789abcdefghijklmnopqrstu\\\"v"
+      "\\n\\r\\t\\a\\b\\f\\v\\?\\'\\\\\\101\\7\\x41\\X4a\\x7z\\\\\" truer: 2\n",
+      &tf_res, NULL);
+  ck_assert_msg(tf_res.error_txt == NULL,
+      "There was an unexpected error: \"%s\"", tf_res.error_txt);
+  ck_assert_msg(msg != NULL, "Unexpected malloc failure.");
+  ck_assert_str_eq(msg->falser, "0123456789abcdefghijklmnopqrstu\"v"
+      "\n\r\t\a\b\f\v?'\\A\007AJ\007z\\");
+  ck_assert_int_eq(msg->truer, 2);
+  tutorial__short__free_unpacked(msg, NULL);
+
+  /* A required string given twice keeps the last value; the first
+   * mustn't leak. */
+  person = (Tutorial__Person *)protobuf_c_text_from_string(
+      &tutorial__person__descriptor, "name: \"a\" id: 1 name: \"b\"",
+      &tf_res, NULL);
+  ck_assert_msg(person != NULL, "Unexpected malloc failure.");
+  ck_assert_str_eq(person->name, "b");
+  tutorial__person__free_unpacked(person, NULL);
+
+  /* Bytes with every value round trip. */
+  for (i = 0; i < sizeof(bytes); i++) {
+    bytes[i] = i;
+  }
+  person = (Tutorial__Person *)protobuf_c_text_from_string(
+      &tutorial__person__descriptor, "name: \"\" id: 1", &tf_res, NULL);
+  ck_assert_msg(person != NULL, "Unexpected malloc failure.");
+  person->bytes_var.data = bytes;
+  person->bytes_var.len = sizeof(bytes);
+  person->has_bytes_var = 1;
+  text = protobuf_c_text_to_string((ProtobufCMessage *)person, NULL);
+  person->has_bytes_var = 0;
+  person->bytes_var.data = NULL;
+  tutorial__person__free_unpacked(person, NULL);
+  ck_assert_msg(text != NULL, "Unexpected malloc failure.");
+  person2 = (Tutorial__Person *)protobuf_c_text_from_string(
+      &tutorial__person__descriptor, text, &tf_res, NULL);
+  free(text);
+  ck_assert_msg(tf_res.error_txt == NULL,
+      "There was an unexpected error: \"%s\"", tf_res.error_txt);
+  ck_assert_int_eq(person2->bytes_var.len, sizeof(bytes));
+  ck_assert_msg(!memcmp(person2->bytes_var.data, bytes, sizeof(bytes)),
+      "bytes_var didn't round trip.");
+  tutorial__person__free_unpacked(person2, NULL);
+
+  /* Escapes straddling the read chunks of a file. */
+  f = tmpfile();
+  ck_assert_msg(f != NULL, "Can't create temp file.");
+  fputs("id: 42\nfalser: \"", f);
+  for (i = 0; i < n; i++) {
+    fputs("ab\\\"\\\\", f);
+  }
+  fputs("\"\ntruer: 7\n", f);
+  rewind(f);
+  msg = (Tutorial__Short *)protobuf_c_text_from_file(
+      &tutorial__short__descriptor, f, &tf_res, NULL);
+  fclose(f);
+  ck_assert_msg(tf_res.error_txt == NULL,
+      "There was an unexpected error: \"%s\"", tf_res.error_txt);
+  ck_assert_msg(msg != NULL, "Unexpected malloc failure.");
+  ck_assert_int_eq(strlen(msg->falser), n * 4);
+  for (i = 0; i < n; i++) {
+    ck_assert_msg(!memcmp(msg->falser + i * 4, "ab\"\\", 4),
+        "Bad unescape at %zu.", i);
+  }
+  ck_assert_int_eq(msg->truer, 7);
+  tutorial__short__free_unpacked(msg, NULL);
+
+  /* Bad escapes and unterminated strings fail. */
+  msg = (Tutorial__Short *)protobuf_c_text_from_string(
+      &tutorial__short__descriptor, "id: 1 falser: \"\\400\"", &tf_res, NULL);
+  ck_assert_msg(msg == NULL, "Parsed a bad octal escape.");
+  ck_assert_msg(strstr(tf_res.error_txt, "Bad escape") != NULL,
+      "Wrong error: \"%s\"", tf_res.error_txt);
+  free(tf_res.error_txt);
+  msg = (Tutorial__Short *)protobuf_c_text_from_string(
+      &tutorial__short__descriptor, "id: 1 falser: \"\\xg\"", &tf_res, NULL);
+  ck_assert_msg(msg == NULL, "Parsed a bad hex escape.");
+  free(tf_res.error_txt);
+  msg = (Tutorial__Short *)protobuf_c_text_from_string(
+      &tutorial__short__descriptor, "id: 1 falser: \"abc\\\"", &tf_res, NULL);
+  ck_assert_msg(msg == NULL, "Parsed an unterminated string.");
+  free(tf_res.error_txt);
+}
+END_TEST
+
+START_TEST(test_arena)
+{
+  ProtobufCTextError tf_res;
+  ProtobufCTextArena *arena;
+  Tutorial__AddressBook *ab;
+  char *text;
+
+  arena = protobuf_c_text_arena_new(256, NULL);
+  ck_assert_msg(arena != NULL, "Unexpected malloc failure.");
+
+  ab = (Tutorial__AddressBook *)protobuf_c_text_from_string(
+      &tutorial__address_book__descriptor,
+      "person {\n"
+      "  name: \"Ann\"\n"
+      "  id: 1\n"
+      "  phone { number: \"555-1212\" }\n"
+      "  phone { number: \"555-1213\" type: WORK }\n"
+      "  bytes_var: \"a long enough value to need a block of its own, \"\n"
+      "}\n"
+      "person { name: \"Bob\" id: 2 }\n",
+      &tf_res, protobuf_c_text_arena_allocator(arena));
+
+  ck_assert_msg(tf_res.error_txt == NULL,
+      "There was an unexpected error: \"%s\"", tf_res.error_txt);
+  ck_assert_msg(ab != NULL, "Unexpected malloc failure.");
+  ck_assert_int_eq(ab->n_person, 2);
+  ck_assert_str_eq(ab->person[0]->name, "Ann");
+  ck_assert_int_eq(ab->person[0]->n_phone, 2);
+  ck_assert_str_eq(ab->person[0]->phone[1]->number, "555-1213");
+  ck_assert_int_eq(ab->person[0]->phone[1]->type,
+      TUTORIAL__PERSON__PHONE_TYPE__WORK);
+  ck_assert_str_eq(ab->person[1]->name, "Bob");
+
+  text = protobuf_c_text_to_string((ProtobufCMessage *)ab,
+      protobuf_c_text_arena_allocator(arena));
+  ck_assert_msg(text != NULL, "Unexpected malloc failure.");
+  ck_assert_msg(strstr(text, "name: \"Bob\"") != NULL,
+      "Generated text is wrong: \"%s\"", text);
+
+  /* Freeing via the allocator is allowed, it just does nothing. */
+  tutorial__address_book__free_unpacked(ab,
+      protobuf_c_text_arena_allocator(arena));
+  protobuf_c_text_arena_free(arena);
+}
+END_TEST
+
+START_TEST(test_repeated_growth)
+{
+  ProtobufCTextError tf_res;
+  Tutorial__Test *msg;
+  char *text, *p;
+  size_t i;
+
+  /* Interleave two repeated fields so they grow independently. */
+  text = malloc(1000 * 40 + 100);
+  ck_assert_msg(text != NULL, "Unexpected malloc failure.");
+  p = text;
+  for (i = 0; i < 1000; i++) {
+    p += sprintf(p, "rp_uint32_var: %zu rp_str_var: \"s%zu\"\n", i, i);
+  }
+  sprintf(p, "rq_msg { rp_enum_var: BAR rp_enum_var: KITTEN"
+      " rp_enum_var: FOO }\n");
+
+  msg = (Tutorial__Test *)protobuf_c_text_from_string(
+      &tutorial__test__descriptor, text, &tf_res, NULL);
+  free(text);
+
+  ck_assert_msg(tf_res.error_txt == NULL,
+      "There was an unexpected error: \"%s\"", tf_res.error_txt);
+  ck_assert_msg(msg != NULL, "Unexpected malloc failure.");
+  ck_assert_int_eq(msg->n_rp_uint32_var, 1000);
+  ck_assert_int_eq(msg->n_rp_str_var, 1000);
+  for (i = 0; i < 1000; i++) {
+    char s[16];
+
+    ck_assert_int_eq(msg->rp_uint32_var[i], i);
+    sprintf(s, "s%zu", i);
+    ck_assert_str_eq(msg->rp_str_var[i], s);
+  }
+  ck_assert_int_eq(msg->rq_msg->n_rp_enum_var, 3);
+  ck_assert_int_eq(msg->rq_msg->rp_enum_var[1],
+      TUTORIAL__TEST__TEST_ENUM__KITTEN);
+  tutorial__test__free_unpacked(msg, NULL);
+}
+END_TEST
+
+/** Count allocations, and those of at least 256 bytes - the output
+ * string but not the escaped copies of short string fields. */
+static size_t all_allocs, big_allocs;
+
+static void *
+counting_alloc(void *allocator_data, size_t size)
+{
+  all_allocs++;
+  if (size >= 256) {
+    big_allocs++;
+  }
+  return malloc(size);
+}
+
+static void
+counting_free(void *allocator_data, void *data)
+{
+  free(data);
+}
+
+static ProtobufCAllocator counting_allocator = {
+  .alloc = counting_alloc,
+  .free = counting_free,
+  .allocator_data = NULL
+};
+
+START_TEST(test_sized_string)
+{
+  ProtobufCTextError tf_res;
+  Tutorial__AddressBook *msg;
+  char *text, *sized, *p;
+  size_t i, size;
+
+  text = malloc(1000 * 40 + 100);
+  ck_assert_msg(text != NULL, "Unexpected malloc failure.");
+  p = text;
+  for (i = 0; i < 1000; i++) {
+    p += sprintf(p, "person { name: \"p%zu\" id: %zu }\n", i, i);
+  }
+  msg = (Tutorial__AddressBook *)protobuf_c_text_from_string(
+      &tutorial__address_book__descriptor, text, &tf_res, NULL);
+  free(text);
+  ck_assert_msg(tf_res.error_txt == NULL,
+      "There was an unexpected error: \"%s\"", tf_res.error_txt);
+  ck_assert_msg(msg != NULL, "Unexpected malloc failure.");
+
+  /* Without a size the string doubles as it grows. */
+  big_allocs = 0;
+  text = protobuf_c_text_to_string((ProtobufCMessage *)msg,
+      &counting_allocator);
+  ck_assert_msg(text != NULL, "Unexpected malloc failure.");
+  ck_assert_msg(big_allocs > 1 && big_allocs < 12,
+      "Unexpected number of allocations: %zu", big_allocs);
+
+  size = protobuf_c_text_get_string_size((ProtobufCMessage *)msg,
+      &counting_allocator);
+  ck_assert_int_eq(size, strlen(text));
+
+  /* With the size it is allocated once. */
+  big_allocs = 0;
+  sized = protobuf_c_text_to_string_sized((ProtobufCMessage *)msg, size,
+      &counting_allocator);
+  ck_assert_msg(sized != NULL, "Unexpected malloc failure.");
+  ck_assert_int_eq(big_allocs, 1);
+  ck_assert_str_eq(sized, text);
+  free(sized);
+
+  /* Too small a size still works. */
+  sized = protobuf_c_text_to_string_sized((ProtobufCMessage *)msg, 10,
+      &counting_allocator);
+  ck_assert_msg(sized != NULL, "Unexpected malloc failure.");
+  ck_assert_str_eq(sized, text);
+  free(sized);
+
+  /* A string can't be that long. */
+  ck_assert_msg(protobuf_c_text_to_string_sized((ProtobufCMessage *)msg,
+        (size_t)INT_MAX, &counting_allocator) == NULL,
+      "An impossible size was accepted.");
+
+  free(text);
+  tutorial__address_book__free_unpacked(msg, NULL);
+}
+END_TEST
+
+START_TEST(test_stats)
+{
+  ProtobufCTextError tf_res;
+  ProtobufCTextStats stats;
+  Tutorial__AddressBook *msg;
+  char text[] = "person { name: \"a\" id: 1 phone { number: \"1\" }\n"
+    "  phone { number: \"2\" type: HOME } }\n";
+  char bad[] = "person { name: \"a\" id: 1 } bogus: 3 trailing";
+  char *s, *plain;
+  FILE *f;
+
+  msg = (Tutorial__AddressBook *)protobuf_c_text_from_buffer_stats(
+      &tutorial__address_book__descriptor, text, strlen(text), &tf_res,
+      &counting_allocator, &stats);
+  ck_assert_msg(tf_res.error_txt == NULL,
+      "There was an unexpected error: \"%s\"", tf_res.error_txt);
+  ck_assert_msg(msg != NULL, "Unexpected malloc failure.");
+  ck_assert_int_eq(stats.bytes, strlen(text));
+  ck_assert_int_eq(stats.tokens[PROTOBUF_C_TEXT_TOKEN_BAREWORD], 9);
+  ck_assert_int_eq(stats.tokens[PROTOBUF_C_TEXT_TOKEN_OBRACE], 3);
+  ck_assert_int_eq(stats.tokens[PROTOBUF_C_TEXT_TOKEN_CBRACE], 3);
+  ck_assert_int_eq(stats.tokens[PROTOBUF_C_TEXT_TOKEN_COLON], 5);
+  ck_assert_int_eq(stats.tokens[PROTOBUF_C_TEXT_TOKEN_QUOTED], 3);
+  ck_assert_int_eq(stats.tokens[PROTOBUF_C_TEXT_TOKEN_NUMBER], 1);
+  ck_assert_int_eq(stats.tokens[PROTOBUF_C_TEXT_TOKEN_BOOLEAN], 0);
+  ck_assert_int_ge(stats.fills, 1);
+  ck_assert_int_gt(stats.allocs, 3);
+  ck_assert_int_gt(stats.alloc_bytes, sizeof(Tutorial__AddressBook));
+  ck_assert_int_eq(stats.max_depth, 3);
+  ck_assert_int_eq(stats.max_repeated, 2);
+  ck_assert_msg(stats.lex_seconds >= 0 && stats.build_seconds >= 0,
+      "Negative time.");
+
+  /* Generating reports the same shape. */
+  plain = protobuf_c_text_to_string((ProtobufCMessage *)msg, NULL);
+  s = protobuf_c_text_to_string_stats((ProtobufCMessage *)msg, NULL,
+      &stats);
+  ck_assert_msg(s != NULL, "Unexpected malloc failure.");
+  ck_assert_str_eq(s, plain);
+  ck_assert_int_eq(stats.bytes, strlen(s));
+  ck_assert_int_eq(stats.tokens[PROTOBUF_C_TEXT_TOKEN_BAREWORD], 0);
+  ck_assert_int_ge(stats.allocs, 1);
+  ck_assert_int_eq(stats.max_depth, 3);
+  ck_assert_int_eq(stats.max_repeated, 2);
+  free(s);
+  free(plain);
+  tutorial__address_book__free_unpacked(msg, NULL);
+
+  /* From a file, every byte read is consumed. */
+  f = tmpfile();
+  ck_assert_msg(f != NULL, "Can't create temp file.");
+  fputs(text, f);
+  rewind(f);
+  msg = (Tutorial__AddressBook *)protobuf_c_text_from_file_stats(
+      &tutorial__address_book__descriptor, f, &tf_res, NULL, &stats);
+  fclose(f);
+  ck_assert_msg(msg != NULL, "Unexpected error.");
+  ck_assert_int_eq(stats.bytes, strlen(text));
+  ck_assert_int_ge(stats.fills, 1);
+  ck_assert_int_eq(stats.max_depth, 3);
+  tutorial__address_book__free_unpacked(msg, NULL);
+
+  /* A failed parse reports how far it got. */
+  msg = (Tutorial__AddressBook *)protobuf_c_text_from_buffer_stats(
+      &tutorial__address_book__descriptor, bad, strlen(bad), &tf_res,
+      NULL, &stats);
+  ck_assert_msg(msg == NULL, "Expected an error.");
+  ck_assert_msg(tf_res.error_txt != NULL, "Expected an error message.");
+  ck_assert_int_eq(stats.bytes, strstr(bad, ": 3") - bad);
+  ck_assert_int_eq(stats.max_depth, 2);
+  free(tf_res.error_txt);
+}
+END_TEST
+
+/** A \c ProtobufCBuffer that collects everything appended to it. */
+typedef struct {
+  ProtobufCBuffer base;
+  char *data;
+  size_t len;
+  size_t appends;
+  size_t biggest;
+} TestSink;
+
+static void
+test_sink_append(ProtobufCBuffer *buffer, size_t len, const uint8_t *data)
+{
+  TestSink *sink = (TestSink *)buffer;
+
+  sink->data = realloc(sink->data, sink->len + len + 1);
+  ck_assert_msg(sink->data != NULL, "Unexpected malloc failure.");
+  memcpy(sink->data + sink->len, data, len);
+  sink->len += len;
+  sink->data[sink->len] = '\0';
+  sink->appends++;
+  if (len > sink->biggest) {
+    sink->biggest = len;
+  }
+}
+
+/* Text of \c n people, from \c first on. */
+static char *
+people_text(size_t first, size_t n)
+{
+  char *text, *p;
+  size_t i;
+
+  text = malloc(n * 100 + 1);
+  ck_assert_msg(text != NULL, "Unexpected malloc failure.");
+  p = text;
+  *p = '\0';
+  for (i = first; i < first + n; i++) {
+    p += sprintf(p, "person { name: \"p%zu\" id: %zu email: \"e%zu\"\n"
+        "  phone { number: \"%zu\" } phone { number: \"x\" } }\n",
+        i, i, i, i);
+  }
+  return text;
+}
+
+/* Parse \c text into \c book and check it matches a fresh parse. */
+static void
+check_parse_into(Tutorial__AddressBook *book, char *text)
+{
+  ProtobufCTextError tf_res;
+  ProtobufCMessage *want;
+  char *got_text, *want_text;
+
+  ck_assert_int_eq(protobuf_c_text_parse_into((ProtobufCMessage *)book,
+        text, strlen(text), &tf_res, &counting_allocator), 1);
+  ck_assert_msg(tf_res.error_txt == NULL,
+      "There was an unexpected error: \"%s\"", tf_res.error_txt);
+  want = protobuf_c_text_from_string(&tutorial__address_book__descriptor,
+      text, &tf_res, NULL);
+  ck_assert_msg(want != NULL, "Unexpected malloc failure.");
+  want_text = protobuf_c_text_to_string(want, NULL);
+  got_text = protobuf_c_text_to_string((ProtobufCMessage *)book, NULL);
+  /* An empty message has no text. */
+  if (want_text || got_text) {
+    ck_assert_msg(want_text && got_text, "Only one message is empty.");
+    ck_assert_str_eq(got_text, want_text);
+  }
+  free(got_text);
+  free(want_text);
+  protobuf_c_message_free_unpacked(want, NULL);
+}
+
+START_TEST(test_parse_into)
+{
+  Tutorial__AddressBook book;
+  ProtobufCTextError tf_res;
+  Tutorial__Person **people;
+  char *text, *other;
+  size_t fresh;
+
+  tutorial__address_book__init(&book);
+  text = people_text(0, 100);
+  all_allocs = 0;
+  check_parse_into(&book, text);
+  fresh = all_allocs;
+  ck_assert_int_eq(book.n_person, 100);
+
+  /* The same shape again reuses nearly everything. */
+  people = book.person;
+  all_allocs = 0;
+  check_parse_into(&book, text);
+  ck_assert_msg(book.person == people, "The person array wasn't reused.");
+  ck_assert_msg(all_allocs * 20 < fresh, "%zu allocations reparsing, %zu"
+      " fresh.", all_allocs, fresh);
+
+  /* Longer and shorter, with different values. */
+  other = people_text(1000, 150);
+  check_parse_into(&book, other);
+  ck_assert_int_eq(book.n_person, 150);
+  free(other);
+  other = people_text(7, 3);
+  check_parse_into(&book, other);
+  free(other);
+  check_parse_into(&book, "");
+  ck_assert_int_eq(book.n_person, 0);
+  check_parse_into(&book, text);
+
+  /* An error leaves it cleared. */
+  text[strlen(text) - 3] = '{';
+  ck_assert_int_eq(protobuf_c_text_parse_into((ProtobufCMessage *)&book,
+        text, strlen(text), &tf_res, &counting_allocator), 0);
+  ck_assert_msg(tf_res.error_txt != NULL, "No error text.");
+  free(tf_res.error_txt);
+  ck_assert_int_eq(book.n_person, 0);
+  ck_assert_msg(book.person == NULL, "The message wasn't cleared.");
+  free(text);
+
+  /* Parsing nothing into it frees what it holds. */
+  other = people_text(0, 2);
+  check_parse_into(&book, other);
+  free(other);
+  check_parse_into(&book, "");
+}
+END_TEST
+
+START_TEST(test_to_sinks)
+{
+  ProtobufCTextError tf_res;
+  TestSink sink = { { test_sink_append }, NULL, 0, 0, 0 };
+  Tutorial__AddressBook *msg;
+  char *text, *p;
+  size_t i, len = 10 * 1024;
+  FILE *f;
+
+  /* Lots of small fields and one longer than the staging buffer. */
+  text = malloc(1000 * 40 + len + 100);
+  ck_assert_msg(text != NULL, "Unexpected malloc failure.");
+  p = text;
+  for (i = 0; i < 1000; i++) {
+    p += sprintf(p, "person { name: \"p%zu\" id: %zu }\n", i, i);
+  }
+  p += sprintf(p, "person { id: 0 name: \"");
+  for (i = 0; i < len; i++) {
+    *p++ = 'a' + i % 26;
+  }
+  sprintf(p, "\" }\n");
+  msg = (Tutorial__AddressBook *)protobuf_c_text_from_string(
+      &tutorial__address_book__descriptor, text, &tf_res, NULL);
+  free(text);
+  ck_assert_msg(tf_res.error_txt == NULL,
+      "There was an unexpected error: \"%s\"", tf_res.error_txt);
+  ck_assert_msg(msg != NULL, "Unexpected malloc failure.");
+
+  text = protobuf_c_text_to_string((ProtobufCMessage *)msg, NULL);
+  ck_assert_msg(text != NULL, "Unexpected malloc failure.");
+
+  ck_assert_int_eq(protobuf_c_text_to_buffer((ProtobufCMessage *)msg,
+        &sink.base, NULL), 1);
+  ck_assert_msg(sink.data != NULL, "Nothing was written.");
+  ck_assert_str_eq(sink.data, text);
+  ck_assert_msg(sink.appends > 2, "Output wasn't streamed.");
+  ck_assert_msg(sink.biggest < strlen(text) / 2, "Output wasn't streamed.");
+  free(sink.data);
+
+  f = tmpfile();
+  ck_assert_msg(f != NULL, "Can't create temp file.");
+  ck_assert_int_eq(protobuf_c_text_to_file((ProtobufCMessage *)msg, f, NULL),
+      1);
+  fflush(f);
+  ck_assert_int_eq(protobuf_c_text_to_fd((ProtobufCMessage *)msg, fileno(f),
+        NULL), 1);
+  rewind(f);
+  p = malloc(strlen(text) * 2 + 1);
+  ck_assert_msg(p != NULL, "Unexpected malloc failure.");
+  ck_assert_int_eq(fread(p, 1, strlen(text) * 2 + 1, f), strlen(text) * 2);
+  fclose(f);
+  ck_assert_msg(!memcmp(p, text, strlen(text)), "to_file output differs.");
+  ck_assert_msg(!memcmp(p + strlen(text), text, strlen(text)),
+      "to_fd output differs.");
+  free(p);
+
+  /* Write errors are reported. */
+  ck_assert_int_eq(protobuf_c_text_to_fd((ProtobufCMessage *)msg, -1, NULL),
+      0);
+
+  free(text);
+  tutorial__address_book__free_unpacked(msg, NULL);
+}
+END_TEST
+
+START_TEST(test_to_string_ex)
+{
+  ProtobufCTextGenerateOptions opts = { 0, 0 };
+  ProtobufCTextError tf_res;
+  Tutorial__AddressBook *msg, *back;
+  char *text, *plain;
+
+  msg = (Tutorial__AddressBook *)protobuf_c_text_from_string(
+      &tutorial__address_book__descriptor,
+      "person { name: \"a\" id: 1 bytes_var: \"x\\ny\"\n"
+      "  phone { number: \"5\" type: WORK } }\n"
+      "person { name: \"b\" id: 2 }\n", &tf_res, NULL);
+  ck_assert_msg(tf_res.error_txt == NULL,
+      "There was an unexpected error: \"%s\"", tf_res.error_txt);
+  ck_assert_msg(msg != NULL, "Unexpected malloc failure.");
+  plain = protobuf_c_text_to_string((ProtobufCMessage *)msg, NULL);
+  ck_assert_msg(plain != NULL, "Unexpected malloc failure.");
+
+  /* No options is the usual layout. */
+  text = protobuf_c_text_to_string_ex((ProtobufCMessage *)msg, NULL, NULL);
+  ck_assert_str_eq(text, plain);
+  free(text);
+
+  opts.indent = 2;
+  text = protobuf_c_text_to_string_ex((ProtobufCMessage *)msg, &opts, NULL);
+  ck_assert_str_eq(text, plain);
+  free(text);
+
+  opts.indent = 0;
+  text = protobuf_c_text_to_string_ex((ProtobufCMessage *)msg, &opts, NULL);
+  ck_assert_str_eq(text,
+      "person {\nname: \"a\"\nid: 1\nphone {\nnumber: \"5\"\n"
+      "type: WORK\n}\nbytes_var: \"x\\ny\"\n}\n"
+      "person {\nname: \"b\"\nid: 2\n}\n");
+  free(text);
+
+  opts.indent = 4;
+  text = protobuf_c_text_to_string_ex((ProtobufCMessage *)msg, &opts, NULL);
+  ck_assert_str_eq(text,
+      "person {\n    name: \"a\"\n    id: 1\n    phone {\n"
+      "        number: \"5\"\n        type: WORK\n    }\n"
+      "    bytes_var: \"x\\ny\"\n}\n"
+      "person {\n    name: \"b\"\n    id: 2\n}\n");
+  free(text);
+
+  /* Too big an indent is refused, UINT_MAX included. */
+  opts.indent = PROTOBUF_C_TEXT_MAX_INDENT + 1;
+  ck_assert_msg(protobuf_c_text_to_string_ex((ProtobufCMessage *)msg, &opts,
+        NULL) == NULL, "Indent over the maximum accepted.");
+  opts.indent = -1;
+  ck_assert_msg(protobuf_c_text_to_string_ex((ProtobufCMessage *)msg, &opts,
+        NULL) == NULL, "Indent of UINT_MAX accepted.");
+
+  /* Compact text is one line and parses back to the same message. */
+  opts.compact = 1;
+  text = protobuf_c_text_to_string_ex((ProtobufCMessage *)msg, &opts, NULL);
+  ck_assert_str_eq(text,
+      "person { name: \"a\" id: 1 phone { number: \"5\" type: WORK }"
+      " bytes_var: \"x\\ny\" } person { name: \"b\" id: 2 }");
+  back = (Tutorial__AddressBook *)protobuf_c_text_from_string(
+      &tutorial__address_book__descriptor, text, &tf_res, NULL);
+  ck_assert_msg(tf_res.error_txt == NULL,
+      "There was an unexpected error: \"%s\"", tf_res.error_txt);
+  free(text);
+  text = protobuf_c_text_to_string((ProtobufCMessage *)back, NULL);
+  ck_assert_str_eq(text, plain);
+  free(text);
+  tutorial__address_book__free_unpacked(back, NULL);
+
+  free(plain);
+  tutorial__address_book__free_unpacked(msg, NULL);
+}
+END_TEST
+
+START_TEST(test_parallel_generation)
+{
+  ProtobufCTextError tf_res;
+  TestSink sink = { { test_sink_append }, NULL, 0, 0, 0 };
+  Tutorial__AddressBook *msg;
+  char *text, *p;
+  size_t i, n = 5000;
+  FILE *f;
+
+  text = malloc(n * 80 + 100);
+  ck_assert_msg(text != NULL, "Unexpected malloc failure.");
+  p = text;
+  for (i = 0; i < n; i++) {
+    p += sprintf(p, "person { name: \"p%zu\" id: %zu"
+        " phone { number: \"%zu\" type: WORK } }\n", i, i, i * 3);
+  }
+  msg = (Tutorial__AddressBook *)protobuf_c_text_from_string(
+      &tutorial__address_book__descriptor, text, &tf_res, NULL);
+  free(text);
+  ck_assert_msg(tf_res.error_txt == NULL,
+      "There was an unexpected error: \"%s\"", tf_res.error_txt);
+  ck_assert_msg(msg != NULL, "Unexpected malloc failure.");
+  text = protobuf_c_text_to_string((ProtobufCMessage *)msg, NULL);
+  ck_assert_msg(text != NULL, "Unexpected malloc failure.");
+
+  p = protobuf_c_text_to_string_parallel((ProtobufCMessage *)msg, 4, NULL);
+  ck_assert_msg(p != NULL, "Unexpected malloc failure.");
+  ck_assert_str_eq(p, text);
+  free(p);
+
+  ck_assert_int_eq(protobuf_c_text_to_buffer_parallel(
+        (ProtobufCMessage *)msg, &sink.base, 3, NULL), 1);
+  ck_assert_msg(sink.data != NULL, "Nothing was written.");
+  ck_assert_str_eq(sink.data, text);
+  free(sink.data);
+
+  f = tmpfile();
+  ck_assert_msg(f != NULL, "Can't create temp file.");
+  ck_assert_int_eq(protobuf_c_text_to_fd_parallel((ProtobufCMessage *)msg,
+        fileno(f), 0, NULL), 1);
+  rewind(f);
+  p = malloc(strlen(text) + 2);
+  ck_assert_msg(p != NULL, "Unexpected malloc failure.");
+  ck_assert_int_eq(fread(p, 1, strlen(text) + 1, f), strlen(text));
+  fclose(f);
+  ck_assert_msg(!memcmp(p, text, strlen(text)), "to_fd output differs.");
+  free(p);
+  ck_assert_int_eq(protobuf_c_text_to_fd_parallel((ProtobufCMessage *)msg,
+        -1, 4, NULL), 0);
+
+  free(text);
+  tutorial__address_book__free_unpacked(msg, NULL);
+}
+END_TEST
+
+/** Check protobuf_c_text_to_packed() gives what packing a parsed
+ * message does.
+ *
+ * \param[in] descriptor Message type.
+ * \param[in] text Its text format, with fields in \c .proto order.
+ */
+static void
+check_packed(const ProtobufCMessageDescriptor *descriptor, const char *text)
+{
+  ProtobufCTextError tf_res;
+  TestSink packed = { { test_sink_append }, NULL, 0, 0, 0 };
+  TestSink transcoded = { { test_sink_append }, NULL, 0, 0, 0 };
+  ProtobufCMessage *msg;
+
+  msg = protobuf_c_text_from_string(descriptor, (char *)text, &tf_res, NULL);
+  ck_assert_msg(tf_res.error_txt == NULL,
+      "There was an unexpected error: \"%s\"", tf_res.error_txt);
+  ck_assert_msg(msg != NULL, "Unexpected malloc failure.");
+  protobuf_c_message_pack_to_buffer(msg, &packed.base);
+  protobuf_c_message_free_unpacked(msg, NULL);
+
+  ck_assert_int_eq(protobuf_c_text_to_packed(descriptor, text, strlen(text),
+        &transcoded.base, &tf_res, NULL), 1);
+  ck_assert_msg(tf_res.error_txt == NULL,
+      "There was an unexpected error: \"%s\"", tf_res.error_txt);
+  ck_assert_int_eq(tf_res.complete, 1);
+  ck_assert_int_eq(transcoded.len, packed.len);
+  ck_assert_msg(!memcmp(transcoded.data, packed.data, packed.len),
+      "Transcoded output differs from packed message.");
+  free(packed.data);
+  free(transcoded.data);
+}
+
+START_TEST(test_to_packed)
+{
+  ProtobufCTextError tf_res, tf_res2;
+  TestSink sink = { { test_sink_append }, NULL, 0, 0, 0 };
+  Tutorial__Test *test;
+  ProtobufCMessage *msg;
+  char *text, *p;
+  size_t i, n = 5000;
+
+  /* Every type, negative numbers that need ten byte varints and
+   * nested messages with lengths that need one and two bytes. */
+  check_packed(&tutorial__test__descriptor,
+      "rq_str_var: \"a\\n\\000b\\xff\"\n"
+      "rq_double_var: -1.5\n"
+      "rq_float_var: inf\n"
+      "rq_int64_var: -9223372036854775808\n"
+      "rq_uint32_var: 4294967295\n"
+      "rq_uint64_var: 18446744073709551615\n"
+      "rq_sint32_var: -2147483648\n"
+      "rq_sint64_var: -1\n"
+      "rq_fixed32_var: 305419896\n"
+      "rq_fixed64_var: 1\n"
+      "rq_sfixed32_var: -2\n"
+      "rq_sfixed64_var: -3\n"
+      "rq_bool_var: true\n"
+      "rq_bytes_var: \"\"\n"
+      "rp_str_var: \"x\"\n"
+      "rp_str_var: \"y\"\n"
+      "rp_double_var: 0.25\n"
+      "rp_float_var: -0.5\n"
+      "rp_int64_var: -7\n"
+      "rp_uint32_var: 200\n"
+      "rp_uint64_var: 300\n"
+      "rp_sint32_var: 63\n"
+      "rp_sint32_var: -64\n"
+      "rp_sint64_var: 1000000\n"
+      "rp_fixed32_var: 0\n"
+      "rp_fixed64_var: 2\n"
+      "rp_sfixed32_var: -4\n"
+      "rp_sfixed64_var: -5\n"
+      "rp_bool_var: false\n"
+      "rp_bytes_var: \"\\001\\002\"\n"
+      "rq_msg {\n  rq_enum_var: BAR\n  rp_enum_var: KITTEN\n}\n");
+
+  text = malloc(n * 200 + 100);
+  ck_assert_msg(text != NULL, "Unexpected malloc failure.");
+  p = text;
+  for (i = 0; i < n; i++) {
+    p += sprintf(p, "person {\n  name: \"p%zu\"\n  id: %zu\n", i, i);
+    if (i % 100 == 0) {
+      p += sprintf(p, "  email: \"%0150zu\"\n", i);
+    }
+    p += sprintf(p, "  phone {\n    number: \"%zu\"\n    type: WORK\n  }\n}\n",
+        i * 3);
+  }
+  check_packed(&tutorial__address_book__descriptor, text);
+
+  /* Big output is streamed, and it unpacks to the same message. */
+  ck_assert_int_eq(protobuf_c_text_to_packed(
+        &tutorial__address_book__descriptor, text, strlen(text),
+        &sink.base, &tf_res, NULL), 1);
+  ck_assert_msg(sink.appends > 1, "Output wasn't streamed.");
+  msg = protobuf_c_message_unpack(&tutorial__address_book__descriptor, NULL,
+      sink.len, (uint8_t *)sink.data);
+  ck_assert_msg(msg != NULL, "Transcoded output doesn't unpack.");
+  p = protobuf_c_text_to_string(msg, NULL);
+  ck_assert_msg(p != NULL, "Unexpected malloc failure.");
+  ck_assert_str_eq(p, text);
+  free(p);
+  protobuf_c_message_free_unpacked(msg, NULL);
+  free(sink.data);
+  free(text);
+
+  /* Fields out of order still unpack to the same message. */
+  sink.data = NULL;
+  sink.len = 0;
+  text = "rq_msg { rp_enum_var: KITTEN rq_enum_var: BAR }"
+    " rq_bytes_var: \"b\" rq_bool_var: false rq_sfixed64_var: 1"
+    " rq_sfixed32_var: 1 rq_fixed64_var: 1 rq_fixed32_var: 1"
+    " rq_sint64_var: 1 rq_sint32_var: 1 rq_uint64_var: 1 rq_uint32_var: 1"
+    " rq_int64_var: 1 rq_float_var: 1 rq_double_var: 1 rq_str_var: \"s\"";
+  ck_assert_int_eq(protobuf_c_text_to_packed(&tutorial__test__descriptor,
+        text, strlen(text), &sink.base, &tf_res, NULL), 1);
+  ck_assert_int_eq(tf_res.complete, 1);
+  test = (Tutorial__Test *)protobuf_c_message_unpack(
+      &tutorial__test__descriptor, NULL, sink.len, (uint8_t *)sink.data);
+  ck_assert_msg(test != NULL, "Transcoded output doesn't unpack.");
+  ck_assert_str_eq(test->rq_str_var, "s");
+  ck_assert_int_eq(test->rq_msg->n_rp_enum_var, 1);
+  ck_assert_int_eq(test->rq_msg->rq_enum_var, TUTORIAL__TEST__TEST_ENUM__BAR);
+  tutorial__test__free_unpacked(test, NULL);
+  free(sink.data);
+
+  /* Missing required fields, here in a nested message, are noted. */
+  sink.data = NULL;
+  sink.len = 0;
+  text = "person { name: \"n\" id: 1 } person { name: \"m\" }";
+  ck_assert_int_eq(protobuf_c_text_to_packed(
+        &tutorial__address_book__descriptor, text, strlen(text),
+        &sink.base, &tf_res, NULL), 1);
+  ck_assert_int_eq(tf_res.complete, 0);
+  free(sink.data);
+
+  /* Errors are the ones parsing reports. */
+  text = "person { name: \"n\" id: 1 }\n"
+    "person { name: \"m\" email: \"e\" email: \"f\" }";
+  msg = protobuf_c_text_from_string(&tutorial__address_book__descriptor,
+      text, &tf_res, NULL);
+  ck_assert_msg(msg == NULL, "Parse unexpectedly succeeded.");
+  sink.data = NULL;
+  ck_assert_int_eq(protobuf_c_text_to_packed(
+        &tutorial__address_book__descriptor, text, strlen(text),
+        &sink.base, &tf_res2, NULL), 0);
+  ck_assert_msg(tf_res2.error_txt != NULL, "No error reported.");
+  ck_assert_str_eq(tf_res2.error_txt, tf_res.error_txt);
+  free(tf_res.error_txt);
+  free(tf_res2.error_txt);
+  free(sink.data);
+  text = "rq_msg { rq_enum_var: BAR";
+  ck_assert_int_eq(protobuf_c_text_to_packed(&tutorial__test__descriptor,
+        text, strlen(text), &sink.base, &tf_res, NULL), 0);
+  ck_assert_str_eq(tf_res.error_txt,
+      "Error found on line 1.\nMissing '1' closing braces.");
+  free(tf_res.error_txt);
+}
+END_TEST
+
+START_TEST(test_parse_limits_everywhere)
+{
+  ProtobufCTextParseOptions options;
+  ProtobufCTextError tf_res;
+  TestSink sink = { { test_sink_append }, NULL, 0, 0, 0 };
+  ProtobufCTextReader *reader;
+  ProtobufCTextParser *parser;
+  ProtobufCTextContext *ctx;
+  Tutorial__AddressBook *ab;
+  ProtobufCMessage *msg;
+  char book[] = "person { name: \"abcdef\" id: 1 }\n"
+    "person { name: \"\\x41\\x42\" id: 2 }\n"
+    "person { name: \"c\" id: 3 phone { number: \"1\" } }\n";
+  const char *text;
+  size_t i;
+  FILE *f;
+
+  /* Transcoding, with max_string checked before unescaping. */
+  memset(&options, 0, sizeof(options));
+  options.max_depth = 2;
+  ck_assert_int_eq(protobuf_c_text_to_packed_ex(
+        &tutorial__address_book__descriptor, book, strlen(book),
+        &sink.base, &options, &tf_res, NULL), 0);
+  ck_assert_str_eq(tf_res.error_txt,
+      "Error found on line 3.\nMessages nested more than 2 deep.");
+  free(tf_res.error_txt);
+  memset(&options, 0, sizeof(options));
+  options.max_string = 2;
+  ck_assert_int_eq(protobuf_c_text_to_packed_ex(
+        &tutorial__address_book__descriptor, book, strlen(book),
+        &sink.base, &options, &tf_res, NULL), 0);
+  ck_assert_str_eq(tf_res.error_txt,
+      "Error found on line 1.\nValue for 'name' is longer than 2 bytes.");
+  free(tf_res.error_txt);
+  text = "person { name: \"\\x41\\x42\\101\" id: 1 }";
+  ck_assert_int_eq(protobuf_c_text_to_packed_ex(
+        &tutorial__address_book__descriptor, text, strlen(text),
+        &sink.base, &options, &tf_res, NULL), 0);
+  ck_assert_str_eq(tf_res.error_txt,
+      "Error found on line 1.\nValue for 'name' is longer than 2 bytes.");
+  free(tf_res.error_txt);
+  free(sink.data);
+
+  /* Parsing into and merging into a message. */
+  ab = (Tutorial__AddressBook *)protobuf_c_text_from_string(
+      &tutorial__address_book__descriptor, book, &tf_res, NULL);
+  ck_assert_msg(ab != NULL, "Unexpected malloc failure.");
+  memset(&options, 0, sizeof(options));
+  options.max_repeated = 2;
+  ck_assert_int_eq(protobuf_c_text_parse_into_ex(&ab->base, book,
+        strlen(book), &options, &tf_res, NULL), 0);
+  ck_assert_str_eq(tf_res.error_txt,
+      "Error found on line 3.\nMore than 2 elements in 'person'.");
+  free(tf_res.error_txt);
+  ck_assert_int_eq(ab->n_person, 0);
+  text = "person { name: \"a\" id: 1 } person { name: \"b\" id: 2 }";
+  ck_assert_int_eq(protobuf_c_text_parse_into_ex(&ab->base, text,
+        strlen(text), &options, &tf_res, NULL), 1);
+  ck_assert_int_eq(ab->n_person, 2);
+  text = "person { name: \"c\" id: 3 }";
+  ck_assert_int_eq(protobuf_c_text_merge_ex(&ab->base, text, strlen(text),
+        PROTOBUF_C_TEXT_MERGE_APPEND, &options, &tf_res, NULL), 0);
+  ck_assert_str_eq(tf_res.error_txt,
+      "Error found on line 1.\nMore than 2 elements in 'person'.");
+  free(tf_res.error_txt);
+  /* Elements a merge replaces don't count. */
+  text = "person { name: \"c\" id: 3 } person { name: \"d\" id: 4 }";
+  ck_assert_int_eq(protobuf_c_text_merge_ex(&ab->base, text, strlen(text),
+        PROTOBUF_C_TEXT_MERGE_REPLACE, &options, &tf_res, NULL), 1);
+  ck_assert_int_eq(ab->n_person, 2);
+  ck_assert_str_eq(ab->person[1]->name, "d");
+  tutorial__address_book__free_unpacked(ab, NULL);
+
+  /* A reader limits each record; one too long to frame ends it. */
+  memset(&options, 0, sizeof(options));
+  options.max_string = 2;
+  reader = protobuf_c_text_reader_open_buffer(
+      &tutorial__address_book__descriptor, book, strlen(book), "\n", NULL);
+  ck_assert_msg(reader != NULL, "Unexpected malloc failure.");
+  protobuf_c_text_reader_set_options(reader, &options);
+  msg = protobuf_c_text_reader_next(reader, &tf_res);
+  ck_assert_msg(msg == NULL, "Parsed past a limit.");
+  ck_assert_str_eq(tf_res.error_txt,
+      "Error found on line 1.\nValue for 'name' is longer than 2 bytes.");
+  free(tf_res.error_txt);
+  msg = protobuf_c_text_reader_next(reader, &tf_res);
+  ck_assert_msg(tf_res.error_txt == NULL,
+      "There was an unexpected error: \"%s\"", tf_res.error_txt);
+  protobuf_c_message_free_unpacked(msg, NULL);
+  protobuf_c_text_reader_set_options(reader, NULL);
+  msg = protobuf_c_text_reader_next(reader, &tf_res);
+  ck_assert_msg(tf_res.error_txt == NULL,
+      "There was an unexpected error: \"%s\"", tf_res.error_txt);
+  protobuf_c_message_free_unpacked(msg, NULL);
+  protobuf_c_text_reader_close(reader);
+  memset(&options, 0, sizeof(options));
+  options.max_bytes = 10;
+  text = "27\nperson { name: \"a\" id: 1 }\n";
+  reader = protobuf_c_text_reader_open_buffer(
+      &tutorial__address_book__descriptor, text, strlen(text), NULL, NULL);
+  ck_assert_msg(reader != NULL, "Unexpected malloc failure.");
+  protobuf_c_text_reader_set_options(reader, &options);
+  msg = protobuf_c_text_reader_next(reader, &tf_res);
+  ck_assert_msg(msg == NULL, "Parsed past a limit.");
+  ck_assert_str_eq(tf_res.error_txt,
+      "Input is longer than the 10 byte limit.");
+  free(tf_res.error_txt);
+  msg = protobuf_c_text_reader_next(reader, &tf_res);
+  ck_assert_msg(msg == NULL && tf_res.error_txt == NULL,
+      "Reader carried on past a record that was too long.");
+  protobuf_c_text_reader_close(reader);
+
+  /* A push parser counts all the input fed. */
+  parser = protobuf_c_text_parser_new(&tutorial__address_book__descriptor,
+      NULL);
+  ck_assert_msg(parser != NULL, "Unexpected malloc failure.");
+  protobuf_c_text_parser_set_options(parser, &options);
+  ck_assert_int_eq(protobuf_c_text_parser_feed(parser, book, 8),
+      PROTOBUF_C_TEXT_PARSER_NEED_MORE);
+  ck_assert_int_eq(protobuf_c_text_parser_feed(parser, book + 8, 8),
+      PROTOBUF_C_TEXT_PARSER_ERROR);
+  msg = protobuf_c_text_parser_finish(parser, &tf_res);
+  ck_assert_msg(msg == NULL, "Parsed past a limit.");
+  ck_assert_str_eq(tf_res.error_txt, "Error found on line 1.\n"
+      "Input is longer than the 10 byte limit.");
+  free(tf_res.error_txt);
+
+  /* A context applies them to each parse until they are changed. */
+  ctx = protobuf_c_text_context_new(NULL);
+  ck_assert_msg(ctx != NULL, "Unexpected malloc failure.");
+  memset(&options, 0, sizeof(options));
+  options.max_depth = 2;
+  protobuf_c_text_context_set_options(ctx, &options);
+  msg = protobuf_c_text_context_from_buffer(ctx,
+      &tutorial__address_book__descriptor, book, strlen(book), &tf_res);
+  ck_assert_msg(msg == NULL, "Parsed past a limit.");
+  ck_assert_str_eq(tf_res.error_txt,
+      "Error found on line 3.\nMessages nested more than 2 deep.");
+  free(tf_res.error_txt);
+  options.max_depth = 0;
+  options.max_alloc = 100 * 1024;
+  protobuf_c_text_context_set_options(ctx, &options);
+  for (i = 0; i < 3; i++) {
+    f = tmpfile();
+    ck_assert_msg(f != NULL, "Can't create temp file.");
+    fputs(book, f);
+    rewind(f);
+    msg = protobuf_c_text_context_from_file(ctx,
+        &tutorial__address_book__descriptor, f, &tf_res);
+    fclose(f);
+    ck_assert_msg(tf_res.error_txt == NULL,
+        "There was an unexpected error: \"%s\"", tf_res.error_txt);
+    protobuf_c_message_free_unpacked(msg, NULL);
+  }
+  protobuf_c_text_context_set_options(ctx, NULL);
+  msg = protobuf_c_text_context_from_buffer(ctx,
+      &tutorial__address_book__descriptor, book, strlen(book), &tf_res);
+  ck_assert_msg(tf_res.error_txt == NULL,
+      "There was an unexpected error: \"%s\"", tf_res.error_txt);
+  protobuf_c_message_free_unpacked(msg, NULL);
+  protobuf_c_text_context_free(ctx);
+
+  /* A file descriptor, mapped or not. */
+  memset(&options, 0, sizeof(options));
+  options.max_bytes = 10;
+  f = tmpfile();
+  ck_assert_msg(f != NULL, "Can't create temp file.");
+  fputs(book, f);
+  fflush(f);
+  msg = protobuf_c_text_from_fd_ex(&tutorial__address_book__descriptor,
+      fileno(f), &options, &tf_res, NULL);
+  fclose(f);
+  ck_assert_msg(msg == NULL, "Parsed past a limit.");
+  ck_assert_str_eq(tf_res.error_txt, "Error found on line 1.\n"
+      "Input is longer than the 10 byte limit.");
+  free(tf_res.error_txt);
+}
+END_TEST
+
+/** Check protobuf_c_text_from_packed_to_string() gives the text of a
+ * message after it is packed.
+ *
+ * \param[in] descriptor Message type.
+ * \param[in] text Its text format.
+ */
+static void
+check_from_packed(const ProtobufCMessageDescriptor *descriptor,
+    const char *text)
+{
+  ProtobufCTextError tf_res;
+  TestSink packed = { { test_sink_append }, NULL, 0, 0, 0 };
+  ProtobufCMessage *msg;
+  char *expected, *got;
+
+  msg = protobuf_c_text_from_string(descriptor, (char *)text, &tf_res, NULL);
+  ck_assert_msg(tf_res.error_txt == NULL,
+      "There was an unexpected error: \"%s\"", tf_res.error_txt);
+  ck_assert_msg(msg != NULL, "Unexpected malloc failure.");
+  expected = protobuf_c_text_to_string(msg, NULL);
+  ck_assert_msg(expected != NULL, "Unexpected malloc failure.");
+  protobuf_c_message_pack_to_buffer(msg, &packed.base);
+  protobuf_c_message_free_unpacked(msg, NULL);
+
+  got = protobuf_c_text_from_packed_to_string(descriptor,
+      (uint8_t *)packed.data, packed.len, &tf_res, NULL);
+  ck_assert_msg(tf_res.error_txt == NULL,
+      "There was an unexpected error: \"%s\"", tf_res.error_txt);
+  ck_assert_msg(got != NULL, "Unexpected malloc failure.");
+  ck_assert_str_eq(got, expected);
+  free(got);
+  free(expected);
+  free(packed.data);
+}
+
+/** Pack a \c Recurse with \c depth more nested inside it.
+ *
+ * \param[out] buf Where to put it, big enough for 6 bytes a level.
+ * \param[in] size Size of \c buf .
+ * \param[in] depth Number of nested messages.
+ * \return Length of the packed message, at the start of \c buf .
+ */
+static size_t
+pack_nested_recurse(uint8_t *buf, size_t size, unsigned depth)
+{
+  uint8_t *p = buf + size;
+  size_t len;
+  unsigned i;
+
+  *--p = 0x01;
+  *--p = 0x08;
+  for (i = 0; i < depth; i++) {
+    len = buf + size - p;
+    if (len >= 0x80) {
+      *--p = len >> 7;
+      *--p = (len & 0x7f) | 0x80;
+    } else {
+      *--p = len;
+    }
+    *--p = 0x12;
+    *--p = 0x01;
+    *--p = 0x08;
+  }
+  len = buf + size - p;
+  memmove(buf, p, len);
+  return len;
+}
+
+START_TEST(test_from_packed)
+{
+  ProtobufCTextError tf_res;
+  TestSink sink = { { test_sink_append }, NULL, 0, 0, 0 };
+  const char *required =
+    "rq_str_var: \"s\" rq_double_var: 1 rq_float_var: 1 rq_int64_var: 1"
+    " rq_uint32_var: 1 rq_uint64_var: 1 rq_sint32_var: 1 rq_sint64_var: 1"
+    " rq_fixed32_var: 1 rq_fixed64_var: 1 rq_sfixed32_var: 1"
+    " rq_sfixed64_var: 1 rq_bool_var: true rq_bytes_var: \"b\""
+    " rq_msg { rq_enum_var: BAR }";
+  /* Packed rp_sint32_var 1, -1, 300; an unknown field 99; a truncated
+   * rp_sint32_var. */
+  static const uint8_t packed_run[] =
+    { 0xda, 0x01, 0x04, 0x02, 0x01, 0xd8, 0x04 };
+  static const uint8_t unknown[] = { 0x98, 0x06, 0x01 };
+  static const uint8_t truncated[] = { 0xd8, 0x01, 0x80 };
+  uint8_t nested[101 * 6];
+  char *text, *p;
+  size_t i, len, n = 1000;
+
+  check_from_packed(&tutorial__test__descriptor,
+      "rq_str_var: \"a\\n\\000b\\xff\"\n"
+      "rq_double_var: -1.5\n"
+      "rq_float_var: inf\n"
+      "rq_int64_var: -9223372036854775808\n"
+      "rq_uint32_var: 4294967295\n"
+      "rq_uint64_var: 18446744073709551615\n"
+      "rq_sint32_var: -2147483648\n"
+      "rq_sint64_var: -1\n"
+      "rq_fixed32_var: 305419896\n"
+      "rq_fixed64_var: 1\n"
+      "rq_sfixed32_var: -2\n"
+      "rq_sfixed64_var: -3\n"
+      "rq_bool_var: true\n"
+      "rq_bytes_var: \"\\000\\001\"\n"
+      "rp_str_var: \"x\" rp_str_var: \"y\"\n"
+      "rp_double_var: 0.1 rp_float_var: -0.5 rp_int64_var: -7\n"
+      "rp_uint32_var: 200 rp_sint32_var: 63 rp_sint32_var: -64\n"
+      "rp_fixed64_var: 2 rp_sfixed32_var: -4 rp_bool_var: false\n"
+      "rq_msg { rq_enum_var: BAR rp_enum_var: KITTEN }\n"
+      "opt_msg { rq_enum_var: FOO }\n");
+
+  text = malloc(n * 100 + 100);
+  ck_assert_msg(text != NULL, "Unexpected malloc failure.");
+  p = text;
+  for (i = 0; i < n; i++) {
+    p += sprintf(p, "person { name: \"p%zu\" id: %zu"
+        " phone { number: \"%zu\" type: WORK } }\n", i, i, i * 3);
+  }
+  check_from_packed(&tutorial__address_book__descriptor, text);
+  free(text);
+
+  /* Fields out of order, packed repeated values and unknown fields. */
+  text = "rq_msg { rp_enum_var: KITTEN rq_enum_var: BAR }"
+    " rp_sint32_var: 5 rq_bytes_var: \"b\" rq_bool_var: true"
+    " rq_sfixed64_var: 1 rq_sfixed32_var: 1 rq_fixed64_var: 1"
+    " rq_fixed32_var: 1 rq_sint64_var: 1 rq_sint32_var: 1"
+    " rq_uint64_var: 1 rq_uint32_var: 1 rq_int64_var: 1"
+    " rq_float_var: 1 rq_double_var: 1 rq_str_var: \"s\"";
+  ck_assert_int_eq(protobuf_c_text_to_packed(&tutorial__test__descriptor,
+        text, strlen(text), &sink.base, &tf_res, NULL), 1);
+  test_sink_append(&sink.base, sizeof(unknown), unknown);
+  test_sink_append(&sink.base, sizeof(packed_run), packed_run);
+  p = protobuf_c_text_from_packed_to_string(&tutorial__test__descriptor,
+      (uint8_t *)sink.data, sink.len, &tf_res, NULL);
+  ck_assert_msg(tf_res.error_txt == NULL,
+      "There was an unexpected error: \"%s\"", tf_res.error_txt);
+  ck_assert_msg(p != NULL, "Unexpected malloc failure.");
+  ck_assert_str_eq(p,
+      "rq_str_var: \"s\"\n"
+      "rq_double_var: 1\n"
+      "rq_float_var: 1\n"
+      "rq_int64_var: 1\n"
+      "rq_uint32_var: 1\n"
+      "rq_uint64_var: 1\n"
+      "rq_sint32_var: 1\n"
+      "rq_sint64_var: 1\n"
+      "rq_fixed32_var: 1\n"
+      "rq_fixed64_var: 1\n"
+      "rq_sfixed32_var: 1\n"
+      "rq_sfixed64_var: 1\n"
+      "rq_bool_var: true\n"
+      "rq_bytes_var: \"b\"\n"
+      "rp_sint32_var: 5\n"
+      "rp_sint32_var: 1\n"
+      "rp_sint32_var: -1\n"
+      "rp_sint32_var: 300\n"
+      "rq_msg {\n"
+      "  rq_enum_var: BAR\n"
+      "  rp_enum_var: KITTEN\n"
+      "}\n");
+  free(p);
+
+  /* Malformed input. */
+  sink.len -= sizeof(packed_run);
+  test_sink_append(&sink.base, sizeof(truncated), truncated);
+  p = protobuf_c_text_from_packed_to_string(&tutorial__test__descriptor,
+      (uint8_t *)sink.data, sink.len, &tf_res, NULL);
+  ck_assert_msg(p == NULL, "Bad input was accepted.");
+  ck_assert_msg(tf_res.error_txt != NULL, "No error reported.");
+  ck_assert_msg(strstr(tf_res.error_txt, "Bad varint for field 27.") != NULL,
+      "Unexpected error: \"%s\"", tf_res.error_txt);
+  free(tf_res.error_txt);
+  free(sink.data);
+
+  sink.data = NULL;
+  sink.len = 0;
+  ck_assert_int_eq(protobuf_c_text_to_packed(&tutorial__test__descriptor,
+        required, strstr(required, " rq_msg") - required, &sink.base,
+        &tf_res, NULL), 1);
+  p = protobuf_c_text_from_packed_to_string(&tutorial__test__descriptor,
+      (uint8_t *)sink.data, sink.len, &tf_res, NULL);
+  ck_assert_msg(p == NULL, "Bad input was accepted.");
+  ck_assert_str_eq(tf_res.error_txt, "Error found at offset 0.\n"
+      "Message 'tutorial.Test' is missing required field 'rq_msg'.");
+  free(tf_res.error_txt);
+  free(sink.data);
+
+  /* rq_str_var as a varint. */
+  p = protobuf_c_text_from_packed_to_string(&tutorial__test__descriptor,
+      (const uint8_t *)"\x08\x01", 2, &tf_res, NULL);
+  ck_assert_msg(p == NULL, "Bad input was accepted.");
+  ck_assert_str_eq(tf_res.error_txt, "Error found at offset 0.\n"
+      "Wrong wire type 0 for 'rq_str_var'.");
+  free(tf_res.error_txt);
+
+  /* Nesting is limited. */
+  len = pack_nested_recurse(nested, sizeof(nested), 100);
+  p = protobuf_c_text_from_packed_to_string(&tutorial__recurse__descriptor,
+      nested, len, &tf_res, NULL);
+  ck_assert_msg(p != NULL, "Unexpected error: \"%s\"", tf_res.error_txt);
+  free(p);
+  len = pack_nested_recurse(nested, sizeof(nested), 101);
+  p = protobuf_c_text_from_packed_to_string(&tutorial__recurse__descriptor,
+      nested, len, &tf_res, NULL);
+  ck_assert_msg(p == NULL, "Bad input was accepted.");
+  ck_assert_msg(strstr(tf_res.error_txt, "Messages nested more than 100 deep.")
+      != NULL, "Unexpected error: \"%s\"", tf_res.error_txt);
+  free(tf_res.error_txt);
+
+  /* Nothing to print. */
+  p = protobuf_c_text_from_packed_to_string(&tutorial__short__descriptor,
+      (const uint8_t *)"\x08\x00", 2, &tf_res, NULL);
+  ck_assert_str_eq(p, "id: 0\n");
+  free(p);
+  p = protobuf_c_text_from_packed_to_string(
+      &tutorial__address_book__descriptor, NULL, 0, &tf_res, NULL);
+  ck_assert_msg(p == NULL && tf_res.error_txt == NULL,
+      "Empty message wasn't empty.");
+}
+END_TEST
+
+/** Reference escaper, a byte at a time. */
+static size_t
+slow_escape(const unsigned char *src, size_t len, char *dst)
+{
+  char *d = dst;
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    switch (src[i]) {
+      case '\'': d += sprintf(d, "\\'"); break;
+      case '"': d += sprintf(d, "\\\""); break;
+      case '\\': d += sprintf(d, "\\\\"); break;
+      case '\n': d += sprintf(d, "\\n"); break;
+      case '\r': d += sprintf(d, "\\r"); break;
+      case '\t': d += sprintf(d, "\\t"); break;
+      default:
+        if (src[i] < 0x20 || src[i] >= 0x7f) {
+          d += sprintf(d, "\\%03o", src[i]);
+        } else {
+          *d++ = src[i];
+        }
+        break;
+    }
+  }
+  return d - dst;
+}
+
+START_TEST(test_escaping)
+{
+  TestSink sink = { { test_sink_append }, NULL, 0, 0, 0 };
+  Tutorial__Person person;
+  unsigned char src[320], *blob;
+  char want[320 * 4], got[320 * 4], *text, *p;
+  size_t i, start, len, n, blob_len = 20000;
+
+  /* Every byte value, then printable runs of different lengths so the
+   * escapes land at every offset in a vector. */
+  for (i = 0; i < 256; i++) {
+    src[i] = i;
+  }
+  for (; i < sizeof(src); i++) {
+    src[i] = i % 61 == 0? '"': 'a' + i % 26;
+  }
+  for (start = 0; start < 48; start++) {
+    for (len = 0; start + len <= sizeof(src); len += 1 + len / 16) {
+      n = slow_escape(src + start, len, want);
+      ck_assert_int_eq(protobuf_c_text_escaped_size(src + start, len), n);
+      ck_assert_int_eq(protobuf_c_text_escape(src + start, len, got), n);
+      ck_assert_msg(!memcmp(want, got, n),
+          "Escaping %zu bytes from %zu differs.", len, start);
+    }
+  }
+
+  /* A bytes field far bigger than the sink's staging buffer. */
+  blob = malloc(blob_len);
+  ck_assert_msg(blob != NULL, "Unexpected malloc failure.");
+  for (i = 0; i < blob_len; i++) {
+    blob[i] = i % 100 < 90? 'a' + i % 26: i * 7;
+  }
+  tutorial__person__init(&person);
+  person.name = "blob";
+  person.bytes_var.data = blob;
+  person.bytes_var.len = blob_len;
+  person.has_bytes_var = 1;
+  text = protobuf_c_text_to_string((ProtobufCMessage *)&person, NULL);
+  ck_assert_msg(text != NULL, "Unexpected malloc failure.");
+  p = malloc(blob_len * 4);
+  ck_assert_msg(p != NULL, "Unexpected malloc failure.");
+  n = slow_escape(blob, blob_len, p);
+  ck_assert_msg(strstr(text, "bytes_var: \"") != NULL, "No bytes_var.");
+  ck_assert_msg(!memcmp(strstr(text, "bytes_var: \"") + 12, p, n),
+      "Escaped bytes_var differs.");
+  ck_assert_int_eq(protobuf_c_text_to_buffer((ProtobufCMessage *)&person,
+        &sink.base, NULL), 1);
+  ck_assert_str_eq(sink.data, text);
+  free(sink.data);
+  free(p);
+  free(text);
+  free(blob);
+
+  /* A value that escapes to more than a string can hold fails rather
+   * than wrapping the size.  The pages are never written so they all
+   * share the zero page, and each NUL escapes to 4 chars. */
+  if (sizeof(size_t) > 4) {
+    blob_len = (size_t)INT_MAX / 4 + 1;
+    blob = mmap(NULL, blob_len, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS,
+        -1, 0);
+    ck_assert_msg(blob != MAP_FAILED, "Can't map %zu bytes.", blob_len);
+    person.bytes_var.data = blob;
+    person.bytes_var.len = blob_len;
+    text = protobuf_c_text_to_string((ProtobufCMessage *)&person, NULL);
+    ck_assert_msg(text == NULL, "Made a string longer than INT_MAX.");
+    munmap(blob, blob_len);
+  }
+}
+END_TEST
+
+START_TEST(test_generated_code)
+{
+  ProtobufCTextError tf_res;
+  Tutorial__AddressBook *ab;
+  Tutorial__Test *msg;
+  char *text, *generated;
+
+  ab = (Tutorial__AddressBook *)protobuf_c_text_from_string(
+      &tutorial__address_book__descriptor,
+      "person {\n"
+      "  name: \"Ann\"\n"
+      "  id: 1\n"
+      "  email: \"ann@example.com\"\n"
+      "  phone { number: \"555-1212\" }\n"
+      "  phone { number: \"555-1213\" type: WORK }\n"
+      "  double_var: 1.5 float_var: -2.25 int64_var: 123456789012\n"
+      "  uint32_var: 4294967295 uint64_var: 18446744073709551615\n"
+      "  sint32_var: -7 sint64_var: -9223372036854775808\n"
+      "  fixed32_var: 3 fixed64_var: 4 sfixed32_var: -5 sfixed64_var: -6\n"
+      "  bool_var: true string_var: \"tab\\there \\\"quoted\\\"\"\n"
+      "  bytes_var: \"\\001\\000\\n'\"\n"
+      "}\n"
+      "person { name: \"Bob\" id: 2 }\n",
+      &tf_res, NULL);
+  ck_assert_msg(tf_res.error_txt == NULL,
+      "There was an unexpected error: \"%s\"", tf_res.error_txt);
+  ck_assert_msg(ab != NULL, "Unexpected malloc failure.");
+  ck_assert_int_eq(ab->person[0]->bytes_var.len, 4);
+  ab->person[0]->bytes_var.data[0] = 0xff;
+
+  /* The generated printer must match the generic one byte for byte. */
+  text = protobuf_c_text_to_string((ProtobufCMessage *)ab, NULL);
+  generated = tutorial__address_book__to_text(ab, NULL);
+  ck_assert_msg(text != NULL && generated != NULL,
+      "Unexpected malloc failure.");
+  ck_assert_str_eq(generated, text);
+  free(text);
+  free(generated);
+  tutorial__address_book__free_unpacked(ab, NULL);
+
+  msg = (Tutorial__Test *)protobuf_c_text_from_string(
+      &tutorial__test__descriptor,
+      "rq_str_var: \"x\" rq_double_var: 0.1 rq_float_var: 1.25\n"
+      "rq_int64_var: 1 rq_uint32_var: 2 rq_uint64_var: 3\n"
+      "rq_sint32_var: -4 rq_sint64_var: -5 rq_fixed32_var: 6\n"
+      "rq_fixed64_var: 7 rq_sfixed32_var: -8 rq_sfixed64_var: -9\n"
+      "rq_bool_var: false rq_bytes_var: \"\\001\"\n"
+      "rp_str_var: \"a\" rp_str_var: \"b\" rp_uint32_var: 1\n"
+      "rp_uint32_var: 2 rp_bool_var: true rp_bytes_var: \"z\"\n"
+      "rq_msg { rq_enum_var: BAR rp_enum_var: BAR rp_enum_var: KITTEN }\n"
+      "opt_msg { rq_enum_var: FOO }\n",
+      &tf_res, NULL);
+  ck_assert_msg(tf_res.error_txt == NULL,
+      "There was an unexpected error: \"%s\"", tf_res.error_txt);
+  ck_assert_msg(msg != NULL, "Unexpected malloc failure.");
+
+  text = protobuf_c_text_to_string((ProtobufCMessage *)msg, NULL);
+  generated = tutorial__test__to_text(msg, NULL);
+  ck_assert_msg(text != NULL && generated != NULL,
+      "Unexpected malloc failure.");
+  ck_assert_str_eq(generated, text);
+  free(text);
+  free(generated);
+  tutorial__test__free_unpacked(msg, NULL);
+}
+END_TEST
+
 Suite *
 suite_odd_messages(void)
 {
   Suite *s = suite_create("Protobuf C Text Format - Parsing");
   TCase *tc = tcase_create("Odd messages");
+  TCase *tc_input = tcase_create("Input sources");
+  TCase *tc_output = tcase_create("Output sinks");
+  TCase *tc_alloc = tcase_create("Allocation");
+  TCase *tc_generated = tcase_create("Generated code");
 
   /* Tests for odd messages. */
   tcase_add_test(tc, test_deep_nesting);
+  tcase_add_test(tc, test_number_limits);
+  tcase_add_test(tc, test_real_round_trip);
+  tcase_add_test(tc, test_quoted_strings);
   suite_add_tcase(s, tc);
 
+  /* Tests for the different ways input can be provided. */
+  tcase_add_test(tc_input, test_from_buffer);
+  tcase_add_test(tc_input, test_from_fd);
+  tcase_add_test(tc_input, test_long_token_from_file);
+  tcase_add_test(tc_input, test_reader);
+  tcase_add_test(tc_input, test_lookup_cache);
+  tcase_add_test(tc_input, test_parallel_parse);
+  tcase_add_test(tc_input, test_push_parser);
+  tcase_add_test(tc_input, test_parse_limits);
+  tcase_add_test(tc_input, test_parse_limits_everywhere);
+  tcase_add_test(tc_input, test_context);
+  tcase_add_test(tc_input, test_merge);
+  suite_add_tcase(s, tc_input);
+
+  /* Tests for the different places output can go. */
+  tcase_add_test(tc_output, test_to_sinks);
+  tcase_add_test(tc_output, test_to_string_ex);
+  tcase_add_test(tc_output, test_escaping);
+  tcase_add_test(tc_output, test_parallel_generation);
+  tcase_add_test(tc_output, test_to_packed);
+  tcase_add_test(tc_output, test_from_packed);
+  suite_add_tcase(s, tc_output);
+
+  /* Tests for allocation strategies. */
+  tcase_add_test(tc_alloc, test_arena);
+  tcase_add_test(tc_alloc, test_repeated_growth);
+  tcase_add_test(tc_alloc, test_sized_string);
+  tcase_add_test(tc_alloc, test_stats);
+  tcase_add_test(tc_alloc, test_parse_into);
+  suite_add_tcase(s, tc_alloc);
+
+  /* Tests for code generated by protoc-gen-c-text. */
+  tcase_add_test(tc_generated, test_generated_code);
+  suite_add_tcase(s, tc_generated);
+
   return s;
 }
 